@@ -0,0 +1,199 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "AlsaDevice.h"
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+/** Throws a std::runtime_error if an ALSA call failed.
+ */
+static void check(int err, const std::string& message) {
+    if (err < 0) {
+        throw std::runtime_error(message + ": " + snd_strerror(err));
+    }
+}
+
+AlsaDevice::AlsaDevice(const std::string& deviceName, Direction direction, unsigned int sampleRate,
+    unsigned int periodSize, unsigned int periods, unsigned int channels)
+: deviceName_(deviceName)
+, direction_(direction)
+, sampleRate_(sampleRate)
+, periodSize_(periodSize)
+, periods_(periods)
+, channels_(channels)
+, pcm_(nullptr)
+, status_(nullptr) {
+}
+
+AlsaDevice::~AlsaDevice() {
+    close();
+}
+
+void AlsaDevice::open() {
+    close();
+
+    const auto stream = direction_ == Direction::Playback ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE;
+    check(snd_pcm_open(&pcm_, deviceName_.c_str(), stream, 0), "Failed to open device");
+
+    snd_config_update_free_global();
+
+    try {
+        setHardwareParameters();
+        setSoftwareParameters();
+        check(snd_pcm_status_malloc(&status_), "Failed to allocate snd_pcm_status_t");
+    } catch (...) {
+        close();
+        throw;
+    }
+
+    snd_pcm_audio_tstamp_config_t audio_tstamp_config;
+    audio_tstamp_config.type_requested = 0;
+    audio_tstamp_config.report_delay = 1;
+    snd_pcm_status_set_audio_htstamp_config(status_, &audio_tstamp_config);
+
+    snd_output_t* output;
+    int err = snd_output_stdio_attach(&output, stdout, 0);
+    if (err < 0) {
+        std::cerr << "Failed to attach stdout: " << snd_strerror(err) << "\n";
+    } else {
+        snd_pcm_dump(pcm_, output);
+    }
+}
+
+void AlsaDevice::setHardwareParameters() {
+    snd_pcm_hw_params_t* params = nullptr;
+    check(snd_pcm_hw_params_malloc(&params), "Failed to allocate snd_pcm_hw_params_t");
+    std::unique_ptr<snd_pcm_hw_params_t, void (*)(snd_pcm_hw_params_t*)> guard(params, snd_pcm_hw_params_free);
+
+    check(snd_pcm_hw_params_any(pcm_, params),
+        "Failed to fill hardware params with configuration space for a PCM");
+    check(snd_pcm_hw_params_set_access(pcm_, params, SND_PCM_ACCESS_MMAP_INTERLEAVED),
+        "Failed to set access type to SND_PCM_ACCESS_MMAP_INTERLEAVED");
+    check(snd_pcm_hw_params_set_format(pcm_, params, SND_PCM_FORMAT_S16_LE),
+        "Failed to set format to SND_PCM_FORMAT_S16_LE");
+    check(snd_pcm_hw_params_set_rate(pcm_, params, sampleRate_, 0),
+        "Failed to set sample rate to " + std::to_string(sampleRate_));
+    check(snd_pcm_hw_params_set_channels(pcm_, params, channels_),
+        "Failed to set number of channels to " + std::to_string(channels_));
+    check(snd_pcm_hw_params_set_period_size(pcm_, params, periodSize_, 0),
+        "Failed to set period size to " + std::to_string(periodSize_));
+    check(snd_pcm_hw_params_set_periods(pcm_, params, periods_, 0),
+        "Failed to set periods to " + std::to_string(periods_));
+
+    const auto bufferSize = periodSize_ * periods_;
+    check(snd_pcm_hw_params_set_buffer_size(pcm_, params, bufferSize),
+        "Failed to set buffer size to " + std::to_string(bufferSize));
+    check(snd_pcm_hw_params(pcm_, params),
+        "Failed to install hardware configuration for PCM");
+}
+
+void AlsaDevice::setSoftwareParameters() {
+    snd_pcm_sw_params_t* params = nullptr;
+    check(snd_pcm_sw_params_malloc(&params), "Failed to allocate snd_pcm_sw_params_t");
+    std::unique_ptr<snd_pcm_sw_params_t, void (*)(snd_pcm_sw_params_t*)> guard(params, snd_pcm_sw_params_free);
+
+    check(snd_pcm_sw_params_current(pcm_, params), "Failed to get current software configuration");
+
+    const auto bufferSize = periodSize_ * periods_;
+    if (direction_ == Direction::Playback) {
+        check(snd_pcm_sw_params_set_avail_min(pcm_, params, periodSize_), "Failed to set avail min");
+        check(snd_pcm_sw_params_set_start_threshold(pcm_, params, (bufferSize / periodSize_) * periodSize_),
+            "Failed to set start threshold");
+    } else {
+        check(snd_pcm_sw_params_set_avail_min(pcm_, params, 0), "Failed to set avail min");
+        check(snd_pcm_sw_params_set_start_threshold(pcm_, params, 0), "Failed to set start threshold");
+    }
+
+    check(snd_pcm_sw_params_set_tstamp_mode(pcm_, params, SND_PCM_TSTAMP_ENABLE),
+        "Failed to set tstamp mode to SND_PCM_TSTAMP_ENABLE");
+    check(snd_pcm_sw_params_set_tstamp_type(pcm_, params, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY),
+        "Failed to set tstamp type to SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY");
+    check(snd_pcm_sw_params(pcm_, params), "Failed to install software configuration for PCM");
+}
+
+void AlsaDevice::close() {
+    if (status_) {
+        snd_pcm_status_free(status_);
+        status_ = nullptr;
+    }
+    if (pcm_) {
+        int err = snd_pcm_close(pcm_);
+        if (err < 0) {
+            std::cerr << "Failed to close PCM: " << snd_strerror(err) << "\n";
+        }
+        pcm_ = nullptr;
+    }
+}
+
+AudioDevice::State AlsaDevice::state() {
+    const auto state = snd_pcm_state(pcm_);
+    if (state == SND_PCM_STATE_PREPARED) {
+        return State::Prepared;
+    } else if (state == SND_PCM_STATE_RUNNING) {
+        return State::Running;
+    } else if (state == SND_PCM_STATE_XRUN) {
+        return State::Xrun;
+    } else if (state == SND_PCM_STATE_SUSPENDED) {
+        return State::Suspended;
+    }
+    return State::Other;
+}
+
+long AlsaDevice::avail() {
+    int err = snd_pcm_status(pcm_, status_);
+    if (err < 0) {
+        return err;
+    }
+    return static_cast<long>(snd_pcm_status_get_avail(status_));
+}
+
+int AlsaDevice::start() {
+    return snd_pcm_start(pcm_);
+}
+
+int AlsaDevice::wait(int timeout) {
+    return snd_pcm_wait(pcm_, timeout);
+}
+
+void AlsaDevice::pollDescriptors(std::vector<struct pollfd>& fds) {
+    const int count = snd_pcm_poll_descriptors_count(pcm_);
+    check(count, "Failed to get number of poll descriptors");
+    const auto first = fds.size();
+    fds.resize(first + static_cast<std::size_t>(count));
+    const int filled = snd_pcm_poll_descriptors(pcm_, &fds[first], static_cast<unsigned int>(count));
+    check(filled, "Failed to get poll descriptors");
+    fds.resize(first + static_cast<std::size_t>(filled));
+}
+
+int AlsaDevice::pollEvents(struct pollfd* fds, unsigned int count) {
+    unsigned short revents = 0;
+    const int err = snd_pcm_poll_descriptors_revents(pcm_, fds, count, &revents);
+    return err < 0 ? err : revents;
+}
+
+int AlsaDevice::begin(int16_t*& area, unsigned long& offset, unsigned long& frames) {
+    const snd_pcm_channel_area_t* channel_area = nullptr;
+    snd_pcm_uframes_t off = 0, n = frames;
+    int err = snd_pcm_mmap_begin(pcm_, &channel_area, &off, &n);
+    if (err < 0) {
+        return err;
+    }
+    area = static_cast<int16_t*>(channel_area[0].addr) + ((channel_area[0].first + off * channel_area[0].step) / 16);
+    offset = off;
+    frames = n;
+    return 0;
+}
+
+long AlsaDevice::commit(unsigned long offset, unsigned long frames) {
+    return snd_pcm_mmap_commit(pcm_, offset, frames);
+}
+
+int AlsaDevice::recover(int err) {
+    return snd_pcm_recover(pcm_, err, 1);
+}
+
+const char* AlsaDevice::errorString(int err) const {
+    return snd_strerror(err);
+}
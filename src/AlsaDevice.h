@@ -0,0 +1,67 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __ALSADEVICE_H
+#define __ALSADEVICE_H
+
+#include "AudioDevice.h"
+
+#include <alsa/asoundlib.h>
+#include <string>
+
+/** An audio device using the ALSA mmap interface.
+ */
+class AlsaDevice : public AudioDevice {
+public:
+    /** Constructor
+     *
+     *  \param deviceName the name of the ALSA device.
+     *  \param direction the transfer direction.
+     *  \param sampleRate the sample rate.
+     *  \param periodSize the period size in frames.
+     *  \param periods the number of periods in the device buffer.
+     *  \param channels the number of channels per frame.
+     */
+    AlsaDevice(const std::string& deviceName, Direction direction, unsigned int sampleRate,
+        unsigned int periodSize, unsigned int periods, unsigned int channels);
+
+    AlsaDevice(const AlsaDevice&) = delete;
+    AlsaDevice& operator =(const AlsaDevice&) = delete;
+
+    /** Destructor.
+     */
+    ~AlsaDevice();
+
+    void open() override;
+    void close() override;
+    State state() override;
+    long avail() override;
+    int start() override;
+    int wait(int timeout) override;
+    void pollDescriptors(std::vector<struct pollfd>& fds) override;
+    int pollEvents(struct pollfd* fds, unsigned int count) override;
+    int begin(int16_t*& area, unsigned long& offset, unsigned long& frames) override;
+    long commit(unsigned long offset, unsigned long frames) override;
+    int recover(int err) override;
+    const char* errorString(int err) const override;
+
+private:
+    /** Set ALSA hardware parameters.
+     */
+    void setHardwareParameters();
+
+    /** Set ALSA software parameters.
+     */
+    void setSoftwareParameters();
+
+    const std::string deviceName_;      /**< The name of the ALSA audio device. */
+    const Direction direction_;         /**< The transfer direction.            */
+    const unsigned int sampleRate_;     /**< The sample rate.                   */
+    const unsigned int periodSize_;     /**< The period size in frames.         */
+    const unsigned int periods_;        /**< The number of periods per buffer.  */
+    const unsigned int channels_;       /**< The number of channels per frame.  */
+    snd_pcm_t* pcm_;                    /**< ALSA handle.                       */
+    snd_pcm_status_t* status_;          /**< The status used to query avail.    */
+};
+
+#endif  // __ALSADEVICE_H
@@ -0,0 +1,302 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Announcement.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const uint8_t SapVersion = 0x20;     // version 1 in the three most significant bits
+static const uint8_t SapDeletion = 0x04;    // the message type bit of a deletion
+static const uint8_t SapEncrypted = 0x02;
+static const uint8_t SapCompressed = 0x01;
+static const uint8_t SapIpv6 = 0x10;        // the address type bit of an IPv6 source
+static const char PayloadType[] = "application/sdp";
+static const char Format[] = "S16LE";
+
+const char* const StreamAnnouncement::Group = "224.2.127.254";
+
+/** Splits text into its space separated key=value pairs.
+ */
+static std::map<std::string, std::string> parse(const std::string& text) {
+    std::map<std::string, std::string> values;
+    std::istringstream stream(text);
+    std::string token;
+    while (stream >> token) {
+        const auto pos = token.find('=');
+        if (pos != std::string::npos) {
+            values[token.substr(0, pos)] = token.substr(pos + 1);
+        }
+    }
+    return values;
+}
+
+/** Returns a SAP message.
+ *
+ *  \param deletion true for the deletion of a session, false for its announcement.
+ *  \param source the IPv4 address of the sender in network byte order.
+ *  \param payload the SDP of the session, the origin line only for a deletion.
+ *  \param id the message ID hash, the same for the announcement and deletion of a session.
+ */
+static std::string sapMessage(bool deletion, uint32_t source, const std::string& payload, uint16_t id) {
+    std::string message;
+    message.push_back(static_cast<char>(SapVersion | (deletion ? SapDeletion : 0)));
+    message.push_back(0);   // no authentication data
+    const uint16_t hash = htons(id);
+    message.append(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    message.append(reinterpret_cast<const char*>(&source), sizeof(source));
+    message.append(PayloadType, sizeof(PayloadType));
+    message.append(payload);
+    return message;
+}
+
+/** Returns a 16 bit hash of a text.
+ */
+static uint16_t hash16(const std::string& text) {
+    uint32_t hash = 2166136261u;
+    for (const auto c : text) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return static_cast<uint16_t>(hash ^ (hash >> 16));
+}
+
+StreamAnnouncement::StreamAnnouncement()
+: address()
+, port(0)
+, streamId(0)
+, sampleRate(0)
+, periodTime(0)
+, periodSize(0)
+, channels(0)
+, packetTime(0) {
+}
+
+std::string StreamAnnouncement::toSdp(const std::string& origin) const {
+    std::ostringstream sdp;
+    sdp << "v=0\r\n"
+        << "o=- " << streamId << " 1 IN IP4 " << origin << "\r\n"
+        << "s=Stream " << streamId << "\r\n"
+        << "c=IN IP4 " << address << "/1\r\n"
+        << "t=0 0\r\n"
+        << "m=audio " << port << " udp " << Format << "\r\n"
+        << "a=x-stream:id=" << streamId << " rate=" << sampleRate << " channels=" << channels
+        << " periodtime=" << periodTime << " periodframes=" << periodSize << " packettime=" << packetTime
+        << " format=" << Format << "\r\n";
+    return sdp.str();
+}
+
+bool StreamAnnouncement::fromSdp(const std::string& sdp) {
+    std::string connection, media, attribute;
+    std::istringstream lines(sdp);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.compare(0, 2, "c=") == 0) {
+            connection = line.substr(2);
+        } else if (line.compare(0, 2, "m=") == 0) {
+            media = line.substr(2);
+        } else if (line.compare(0, 11, "a=x-stream:") == 0) {
+            attribute = line.substr(11);
+        }
+    }
+
+    std::istringstream c(connection), m(media);
+    std::string network, type, group, kind;
+    unsigned int mediaPort = 0;
+    if (!(c >> network >> type >> group) || network != "IN" || type != "IP4"
+        || !(m >> kind >> mediaPort) || kind != "audio" || mediaPort == 0 || mediaPort > 65535) {
+        return false;
+    }
+    auto values = parse(attribute);
+    if (values["format"] != Format) {
+        return false;
+    }
+    try {
+        const auto id = std::stoul(values["id"]);
+        if (id > 65535) {
+            return false;
+        }
+        streamId = static_cast<uint16_t>(id);
+        sampleRate = static_cast<unsigned int>(std::stoul(values["rate"]));
+        channels = static_cast<unsigned int>(std::stoul(values["channels"]));
+        periodTime = static_cast<unsigned int>(std::stoul(values["periodtime"]));
+        periodSize = static_cast<unsigned int>(std::stoul(values["periodframes"]));
+        packetTime = static_cast<unsigned int>(std::stoul(values["packettime"]));
+    } catch (const std::exception&) {
+        return false;
+    }
+    address = group.substr(0, group.find('/'));
+    port = static_cast<unsigned short>(mediaPort);
+    return sampleRate != 0 && channels != 0 && periodTime != 0 && periodSize != 0;
+}
+
+Announcer::Announcer(const std::vector<StreamAnnouncement>& streams, unsigned int interval, const std::string& interface)
+: streams_(streams)
+, interval_(interval)
+, interface_(interface)
+, socket_(-1)
+, announcements_()
+, deletions_()
+, running_(false)
+, mutex_()
+, condition_()
+, thread_() {
+}
+
+Announcer::~Announcer() {
+    stop();
+}
+
+void Announcer::start() {
+    stop();
+
+    socket_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        throw std::runtime_error(std::string("Failed to create announcement socket: ") + strerror(errno));
+    }
+    if (!interface_.empty()) {
+        struct ip_mreqn mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_ifindex = static_cast<int>(if_nametoindex(interface_.c_str()));
+        if (mreq.imr_ifindex == 0 || setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) != 0) {
+            close(socket_);
+            socket_ = -1;
+            throw std::runtime_error("Failed to announce on interface " + interface_);
+        }
+    }
+    // Connecting selects the source address the announcements carry.
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(StreamAnnouncement::Port);
+    inet_pton(AF_INET, StreamAnnouncement::Group, &addr.sin_addr);
+    struct sockaddr_in source;
+    socklen_t length = sizeof(source);
+    if (connect(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || getsockname(socket_, reinterpret_cast<struct sockaddr*>(&source), &length) != 0) {
+        const std::string error = strerror(errno);
+        close(socket_);
+        socket_ = -1;
+        throw std::runtime_error("Failed to connect announcement socket: " + error);
+    }
+
+    char origin[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &source.sin_addr, origin, sizeof(origin));
+    announcements_.clear();
+    deletions_.clear();
+    for (const auto& stream : streams_) {
+        const auto sdp = stream.toSdp(origin);
+        const auto id = hash16(sdp);
+        announcements_.push_back(sapMessage(false, source.sin_addr.s_addr, sdp, id));
+        deletions_.push_back(sapMessage(true, source.sin_addr.s_addr, sdp.substr(0, sdp.find("s=")), id));
+    }
+
+    running_ = true;
+    thread_.reset(new std::thread([this] () { run(); }));
+}
+
+void Announcer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    condition_.notify_all();
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+    send(deletions_);
+    close(socket_);
+    socket_ = -1;
+}
+
+void Announcer::run() {
+    const auto interval = std::chrono::milliseconds(interval_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    do {
+        send(announcements_);
+    } while (!condition_.wait_for(lock, interval, [this] () { return !running_; }));
+}
+
+void Announcer::send(const std::vector<std::string>& messages) {
+    for (const auto& message : messages) {
+        ::send(socket_, message.data(), message.size(), 0);
+    }
+}
+
+bool waitForAnnouncement(uint16_t streamId, const std::string& address, unsigned int timeout,
+    const std::string& interface, StreamAnnouncement& result) {
+    const int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Failed to create announcement socket: ") + strerror(errno));
+    }
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(StreamAnnouncement::Port);
+    inet_pton(AF_INET, StreamAnnouncement::Group, &addr.sin_addr);
+    struct ip_mreqn mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr = addr.sin_addr;
+    mreq.imr_address.s_addr = htonl(INADDR_ANY);
+    mreq.imr_ifindex = static_cast<int>(if_nametoindex(interface.c_str()));
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+        const std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Failed to join the announcement group: " + error);
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    int remaining = static_cast<int>(timeout);
+    bool found = false;
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    while (!found && remaining > 0 && poll(&pfd, 1, remaining) > 0) {
+        char buffer[4096];
+        const auto n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        // Skips deletions and the encrypted and compressed messages of other senders.
+        const auto flags = n >= 4 ? static_cast<uint8_t>(buffer[0]) : 0;
+        if ((flags & 0xe0) == SapVersion && (flags & (SapDeletion | SapEncrypted | SapCompressed)) == 0) {
+            const auto header = 4 + static_cast<std::size_t>(static_cast<uint8_t>(buffer[1])) * 4
+                + ((flags & SapIpv6) ? 16 : 4);
+            std::string payload(buffer + std::min(header, static_cast<std::size_t>(n)), buffer + n);
+            // The payload type is optional and absent if the payload starts with the SDP.
+            if (payload.compare(0, 4, "v=0\r") != 0 && payload.compare(0, 4, "v=0\n") != 0) {
+                const auto end = payload.find('\0');
+                payload = end != std::string::npos && payload.compare(0, end, PayloadType) == 0
+                    ? payload.substr(end + 1) : std::string();
+            }
+            StreamAnnouncement announcement;
+            if (announcement.fromSdp(payload) && announcement.streamId == streamId
+                && (address.empty() || announcement.address == address)) {
+                result = announcement;
+                found = true;
+            }
+        }
+        remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count());
+    }
+    close(fd);
+    return found;
+}
@@ -0,0 +1,119 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __ANNOUNCEMENT_H
+#define __ANNOUNCEMENT_H
+
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/** The description of a stream a sender announces. Announcements are sent
+ *  with the Session Announcement Protocol (RFC 2974) and describe the stream
+ *  in SDP. The stream is not RTP, so its format is carried in an
+ *  x-stream attribute, e.g.
+ *
+ *      m=audio 23776 udp S16LE
+ *      a=x-stream:id=0 rate=48000 channels=2 periodtime=1000 periodframes=48 packettime=1000 format=S16LE
+ */
+struct StreamAnnouncement {
+    /** Constructor of an empty announcement.
+     */
+    StreamAnnouncement();
+
+    /** Returns the description of the stream in SDP.
+     *
+     *  \param origin the IPv4 address of the sender.
+     */
+    std::string toSdp(const std::string& origin) const;
+
+    /** Parses a description of a stream in SDP.
+     *
+     *  \param sdp the description.
+     *  \return false if the description is not the one of a stream.
+     */
+    bool fromSdp(const std::string& sdp);
+
+    std::string address;        /**< The destination address of the stream.     */
+    unsigned short port;        /**< The destination port of the stream.        */
+    uint16_t streamId;          /**< The ID of the stream.                      */
+    unsigned int sampleRate;    /**< The sample rate.                           */
+    unsigned int periodTime;    /**< The period time in microseconds.           */
+    unsigned int periodSize;    /**< The number of frames per period.           */
+    unsigned int channels;      /**< The number of channels.                    */
+    unsigned int packetTime;    /**< The time in microseconds sent in a packet. */
+
+    static const unsigned short Port = 9875;    /**< The SAP port.                       */
+    static const char* const Group;             /**< The SAP group of global scope.      */
+};
+
+/** Announces the streams of a sender periodically from a background thread
+ *  and withdraws them when stopped.
+ */
+class Announcer {
+public:
+    /** Constructor.
+     *
+     *  \param streams the streams to announce.
+     *  \param interval the time between announcements in milliseconds.
+     *  \param interface the network interface to announce on, empty for the default.
+     */
+    Announcer(const std::vector<StreamAnnouncement>& streams, unsigned int interval, const std::string& interface);
+
+    Announcer(const Announcer&) = delete;
+    Announcer& operator =(const Announcer&) = delete;
+
+    /** Destructor. Withdraws the streams.
+     */
+    ~Announcer();
+
+    /** Starts announcing the streams. Throws a std::runtime_error if the
+     *  socket cannot be set up.
+     */
+    void start();
+
+    /** Stops announcing and withdraws the streams, if started.
+     */
+    void stop();
+
+private:
+    /** Sends the announcements until stop() is called.
+     */
+    void run();
+
+    /** Sends one SAP message per stream.
+     *
+     *  \param messages the messages.
+     */
+    void send(const std::vector<std::string>& messages);
+
+    const std::vector<StreamAnnouncement> streams_; /**< The streams to announce.                   */
+    const unsigned int interval_;                   /**< The interval in milliseconds.              */
+    const std::string interface_;                   /**< The network interface, empty for default.  */
+    int socket_;                                    /**< The UDP socket, -1 if closed.              */
+    std::vector<std::string> announcements_;        /**< The SAP announcement of each stream.       */
+    std::vector<std::string> deletions_;            /**< The SAP deletion of each stream.           */
+    bool running_;                                  /**< True while the streams are announced.      */
+    std::mutex mutex_;                              /**< Guards running_ against the thread.        */
+    std::condition_variable condition_;             /**< Wakes the thread on stop().                */
+    std::unique_ptr<std::thread> thread_;           /**< The announcement thread.                   */
+};
+
+/** Waits for the announcement of a stream. Throws a std::runtime_error if
+ *  the SAP group cannot be joined.
+ *
+ *  \param streamId the ID of the stream.
+ *  \param address the destination address of the stream, empty for any.
+ *  \param timeout the time to wait in milliseconds.
+ *  \param interface the network interface to listen on, empty for the default.
+ *  \param result the announcement.
+ *  \return false if the stream has not been announced within the timeout.
+ */
+bool waitForAnnouncement(uint16_t streamId, const std::string& address, unsigned int timeout,
+    const std::string& interface, StreamAnnouncement& result);
+
+#endif  // __ANNOUNCEMENT_H
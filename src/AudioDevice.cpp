@@ -0,0 +1,18 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "AudioDevice.h"
+#include "AlsaDevice.h"
+#include "NullDevice.h"
+
+std::unique_ptr<AudioDevice> createAudioDevice(const std::string& name, AudioDevice::Direction direction,
+    unsigned int sampleRate, unsigned int periodSize, unsigned int periods, unsigned int channels, double drift) {
+    static const std::string filePrefix = "file:";
+    if (name == "null") {
+        return std::unique_ptr<AudioDevice>(new NullDevice("", direction, sampleRate, periodSize, periods, channels, drift));
+    } else if (name.compare(0, filePrefix.size(), filePrefix) == 0) {
+        return std::unique_ptr<AudioDevice>(new NullDevice(name.substr(filePrefix.size()), direction,
+            sampleRate, periodSize, periods, channels, drift));
+    }
+    return std::unique_ptr<AudioDevice>(new AlsaDevice(name, direction, sampleRate, periodSize, periods, channels));
+}
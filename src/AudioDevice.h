@@ -0,0 +1,134 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __AUDIODEVICE_H
+#define __AUDIODEVICE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <poll.h>
+
+/** The interface of an audio backend used by Player and Recorder.
+ *
+ *  The interface follows the ALSA mmap transfer model: the caller waits until
+ *  at least one period is available, obtains a pointer into the device buffer
+ *  with begin(), reads or writes interleaved S16 frames and hands them back
+ *  with commit(). Errors are reported as negative errno codes, -EPIPE signals
+ *  an over- or under-run. Setup errors are reported as std::runtime_error.
+ */
+class AudioDevice {
+public:
+    /** Transfer directions.
+     */
+    enum class Direction {
+        Playback,
+        Capture
+    };
+
+    /** Device states.
+     */
+    enum class State {
+        Prepared,
+        Running,
+        Xrun,
+        Suspended,
+        Other
+    };
+
+    virtual ~AudioDevice() {}
+
+    /** Opens and configures the device.
+     */
+    virtual void open() = 0;
+
+    /** Closes the device.
+     */
+    virtual void close() = 0;
+
+    /** Returns the current state.
+     */
+    virtual State state() = 0;
+
+    /** Returns the number of frames that can be transferred or a negative error code.
+     */
+    virtual long avail() = 0;
+
+    /** Starts the device.
+     */
+    virtual int start() = 0;
+
+    /** Waits until at least one period is available.
+     *
+     *  \param timeout the timeout in milliseconds, -1 to wait forever.
+     *  \return a positive value if ready, 0 on timeout or a negative error code.
+     */
+    virtual int wait(int timeout) = 0;
+
+    /** Appends the descriptors to poll for the device becoming ready.
+     *  Valid between open() and close().
+     *
+     *  \param fds the vector the descriptors are appended to.
+     */
+    virtual void pollDescriptors(std::vector<struct pollfd>& fds) = 0;
+
+    /** Translates the result of polling the descriptors into device events.
+     *
+     *  \param fds the descriptors from pollDescriptors() with revents set.
+     *  \param count the number of descriptors.
+     *  \return POLLOUT or POLLIN if the device is ready, POLLERR on errors,
+     *          0 for spurious wakeups or a negative error code.
+     */
+    virtual int pollEvents(struct pollfd* fds, unsigned int count) = 0;
+
+    /** Returns access to the device buffer.
+     *
+     *  \param area the pointer to the first available frame is written to this reference.
+     *  \param offset the offset of the area in frames is written to this reference.
+     *  \param frames the number of requested frames, on return the number of contiguous frames.
+     *  \return 0 on success or a negative error code.
+     */
+    virtual int begin(int16_t*& area, unsigned long& offset, unsigned long& frames) = 0;
+
+    /** Finishes a transfer started with begin().
+     *
+     *  \param offset the offset returned by begin().
+     *  \param frames the number of frames transferred.
+     *  \return the number of committed frames or a negative error code.
+     */
+    virtual long commit(unsigned long offset, unsigned long frames) = 0;
+
+    /** Recovers from an error.
+     *
+     *  \param err the error code.
+     *  \return 0 on success or a negative error code.
+     */
+    virtual int recover(int err) = 0;
+
+    /** Returns a description of an error code.
+     *
+     *  \param err the error code.
+     */
+    virtual const char* errorString(int err) const = 0;
+};
+
+/** Creates an audio device.
+ *
+ *  "null" selects a headless device that advances on a timer and discards
+ *  playback or captures silence, "file:<path>" a headless device that writes
+ *  playback to or reads capture from a raw interleaved S16_LE file. Any other
+ *  name is passed to ALSA.
+ *
+ *  \param name the name of the device.
+ *  \param direction the transfer direction.
+ *  \param sampleRate the sample rate.
+ *  \param periodSize the period size in frames.
+ *  \param periods the number of periods in the device buffer.
+ *  \param channels the number of channels per frame.
+ *  \param drift the deviation of a headless device from the nominal sample rate in ppm.
+ */
+std::unique_ptr<AudioDevice> createAudioDevice(const std::string& name, AudioDevice::Direction direction,
+    unsigned int sampleRate, unsigned int periodSize, unsigned int periods, unsigned int channels, double drift);
+
+#endif  // __AUDIODEVICE_H
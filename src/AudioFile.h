@@ -0,0 +1,197 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __AUDIOFILE_H
+#define __AUDIOFILE_H
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** A read-only view of a recording, either a WAV file or raw interleaved
+ *  16-bit little-endian PCM. The file is memory-mapped so that recordings
+ *  of several hours can be processed without loading them into memory.
+ */
+class AudioFile {
+public:
+    /** Opens a WAV file.
+     *
+     *  \param path the path of the file.
+     */
+    explicit AudioFile(const std::string& path)
+    : AudioFile(path, 0, 0) {
+    }
+
+    /** Opens a file. If sampleRate and channels are non-zero the file is
+     *  treated as raw interleaved S16_LE data, otherwise as a WAV file.
+     *
+     *  \param path the path of the file.
+     *  \param sampleRate the sample rate of a raw file.
+     *  \param channels the number of channels of a raw file.
+     */
+    AudioFile(const std::string& path, unsigned int sampleRate, unsigned int channels)
+    : fd_(-1)
+    , map_(nullptr)
+    , mapSize_(0)
+    , data_(nullptr)
+    , frames_(0)
+    , sampleRate_(sampleRate)
+    , channels_(channels)
+    , bytesPerSample_(2)
+    , isFloat_(false) {
+        fd_ = open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || st.st_size == 0) {
+            close(fd_);
+            throw std::runtime_error("Failed to stat " + path);
+        }
+        mapSize_ = static_cast<std::size_t>(st.st_size);
+        map_ = static_cast<const uint8_t*>(mmap(nullptr, mapSize_, PROT_READ, MAP_PRIVATE, fd_, 0));
+        if (map_ == MAP_FAILED) {
+            close(fd_);
+            throw std::runtime_error("Failed to map " + path + ": " + strerror(errno));
+        }
+        madvise(const_cast<uint8_t*>(map_), mapSize_, MADV_SEQUENTIAL);
+
+        if (sampleRate_ != 0 && channels_ != 0) {
+            data_ = map_;
+            frames_ = mapSize_ / (channels_ * bytesPerSample_);
+        } else {
+            try {
+                parseWav();
+            } catch (...) {
+                unmap();
+                throw;
+            }
+        }
+    }
+
+    AudioFile(const AudioFile&) = delete;
+    AudioFile& operator =(const AudioFile&) = delete;
+
+    /** Destructor.
+     */
+    ~AudioFile() {
+        unmap();
+    }
+
+    /** Returns the number of frames.
+     */
+    std::size_t frames() const { return frames_; }
+
+    /** Returns the sample rate.
+     */
+    unsigned int sampleRate() const { return sampleRate_; }
+
+    /** Returns the number of channels.
+     */
+    unsigned int channels() const { return channels_; }
+
+    /** Returns a sample normalized to [-1, 1).
+     *
+     *  \param frame the index of the frame.
+     *  \param channel the index of the channel.
+     */
+    double sample(std::size_t frame, unsigned int channel) const {
+        const uint8_t* p = data_ + (frame * channels_ + channel) * bytesPerSample_;
+        if (isFloat_) {
+            float value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+        switch (bytesPerSample_) {
+        case 2:
+            return static_cast<int16_t>(p[0] | (p[1] << 8)) / 32768.0;
+        case 3:
+            return static_cast<int32_t>((p[0] << 8) | (p[1] << 16) | (static_cast<uint32_t>(p[2]) << 24)) / 2147483648.0;
+        case 4:
+            return static_cast<int32_t>(p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24)) / 2147483648.0;
+        default:
+            return 0;
+        }
+    }
+
+private:
+    /** Parses the RIFF chunks of a WAV file.
+     */
+    void parseWav() {
+        if (mapSize_ < 12 || memcmp(map_, "RIFF", 4) != 0 || memcmp(map_ + 8, "WAVE", 4) != 0) {
+            throw std::runtime_error("Not a WAV file");
+        }
+        bool haveFormat = false;
+        std::size_t pos = 12;
+        while (pos + 8 <= mapSize_) {
+            const uint8_t* chunk = map_ + pos;
+            const std::size_t size = read32(chunk + 4);
+            const uint8_t* body = chunk + 8;
+            if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+                uint16_t format = read16(body);
+                channels_ = read16(body + 2);
+                sampleRate_ = read32(body + 4);
+                bytesPerSample_ = read16(body + 14) / 8;
+                if (format == 0xFFFE && size >= 26) {
+                    format = read16(body + 24);
+                }
+                if (format == 3 && bytesPerSample_ == 4) {
+                    isFloat_ = true;
+                } else if (format != 1 || bytesPerSample_ < 2 || bytesPerSample_ > 4) {
+                    throw std::runtime_error("Unsupported WAV sample format");
+                }
+                haveFormat = true;
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                if (!haveFormat || channels_ == 0) {
+                    throw std::runtime_error("WAV data chunk before format chunk");
+                }
+                data_ = body;
+                auto available = mapSize_ - (pos + 8);
+                frames_ = (size < available ? size : available) / (channels_ * bytesPerSample_);
+                return;
+            }
+            pos += 8 + size + (size & 1);
+        }
+        throw std::runtime_error("WAV file without data chunk");
+    }
+
+    /** Unmaps and closes the file.
+     */
+    void unmap() {
+        if (map_ != nullptr && map_ != MAP_FAILED) {
+            munmap(const_cast<uint8_t*>(map_), mapSize_);
+        }
+        map_ = nullptr;
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    static uint16_t read16(const uint8_t* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t read32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    int fd_;                        /**< The file descriptor.                   */
+    const uint8_t* map_;            /**< The mapped file.                       */
+    std::size_t mapSize_;           /**< The size of the mapping in bytes.      */
+    const uint8_t* data_;           /**< A pointer to the first sample.         */
+    std::size_t frames_;            /**< The number of frames.                  */
+    unsigned int sampleRate_;       /**< The sample rate.                       */
+    unsigned int channels_;         /**< The number of channels.                */
+    unsigned int bytesPerSample_;   /**< The size of one sample in bytes.       */
+    bool isFloat_;                  /**< True for 32-bit float samples.         */
+};
+
+#endif  // __AUDIOFILE_H
@@ -0,0 +1,80 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Calibration.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <map>
+
+Calibration::Calibration()
+: deviceName()
+, sampleRate(0)
+, periodTime(0)
+, channels(0)
+, latency(0)
+, periods(0)
+, jitter(0) {
+}
+
+bool Calibration::matches(const std::string& name, unsigned int rate,
+    unsigned int time, unsigned int count) const {
+    return deviceName == name && sampleRate == rate && periodTime == time && channels == count;
+}
+
+bool Calibration::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::map<std::string, std::string> values;
+    std::string line;
+    while (std::getline(file, line)) {
+        const auto pos = line.find('=');
+        if (line.empty() || line[0] == '#' || pos == std::string::npos) {
+            continue;
+        }
+        values[line.substr(0, pos)] = line.substr(pos + 1);
+    }
+
+    static const char* const keys[] = {
+        "device", "samplerate", "periodtime", "channels", "latency", "periods", "jitter"
+    };
+    for (const auto key : keys) {
+        if (values.count(key) == 0) {
+            return false;
+        }
+    }
+
+    try {
+        deviceName = values["device"];
+        sampleRate = static_cast<unsigned int>(std::stoul(values["samplerate"]));
+        periodTime = static_cast<unsigned int>(std::stoul(values["periodtime"]));
+        channels = static_cast<unsigned int>(std::stoul(values["channels"]));
+        latency = static_cast<unsigned int>(std::stoul(values["latency"]));
+        periods = static_cast<unsigned int>(std::stoul(values["periods"]));
+        jitter = std::stod(values["jitter"]);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return latency > 0 && periods > 0;
+}
+
+void Calibration::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    file << "# Latency calibration of the receiver\n"
+         << "device=" << deviceName << "\n"
+         << "samplerate=" << sampleRate << "\n"
+         << "periodtime=" << periodTime << "\n"
+         << "channels=" << channels << "\n"
+         << "latency=" << latency << "\n"
+         << "periods=" << periods << "\n"
+         << "jitter=" << jitter << "\n";
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
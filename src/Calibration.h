@@ -0,0 +1,68 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __CALIBRATION_H
+#define __CALIBRATION_H
+
+#include <string>
+#include <cstdint>
+
+/** The measurements of one calibration trial.
+ */
+struct CalibrationTrial {
+    unsigned int latency;   /**< The latency of the circular buffer in periods.           */
+    unsigned int periods;   /**< The number of periods in the buffer of the audio device. */
+    uint64_t xruns;         /**< The number of under-runs of the audio device.            */
+    uint64_t underruns;     /**< The number of reads of frames not received yet.          */
+    int64_t minHeadroom;    /**< The smallest number of received frames ahead of a read.  */
+    double jitter;          /**< The largest packet arrival jitter in seconds.            */
+
+    /** Returns true if the pipeline ran without dropouts and received
+     *  frames were always ahead of the playback.
+     */
+    bool stable() const {
+        return xruns == 0 && underruns == 0 && minHeadroom > 0;
+    }
+};
+
+/** The result of a latency calibration for one audio device and stream
+ *  format. It is stored in a text file with one key=value pair per line.
+ */
+struct Calibration {
+    /** Constructor.
+     */
+    Calibration();
+
+    /** Returns true if the calibration was done with the given configuration.
+     *
+     *  \param deviceName the name of the audio device.
+     *  \param sampleRate the sample rate.
+     *  \param periodTime the period time in microseconds.
+     *  \param channels the number of channels.
+     */
+    bool matches(const std::string& deviceName, unsigned int sampleRate,
+        unsigned int periodTime, unsigned int channels) const;
+
+    /** Loads a calibration from a file.
+     *
+     *  \param path the path of the file.
+     *  \return false if the file does not exist or is incomplete.
+     */
+    bool load(const std::string& path);
+
+    /** Saves the calibration to a file. Throws a std::runtime_error on failure.
+     *
+     *  \param path the path of the file.
+     */
+    void save(const std::string& path) const;
+
+    std::string deviceName;     /**< The name of the audio device.                        */
+    unsigned int sampleRate;    /**< The sample rate.                                     */
+    unsigned int periodTime;    /**< The period time in microseconds.                     */
+    unsigned int channels;      /**< The number of channels.                              */
+    unsigned int latency;       /**< The latency of the circular buffer in periods.       */
+    unsigned int periods;       /**< The number of periods in the buffer of the device.   */
+    double jitter;              /**< The largest packet arrival jitter in seconds.        */
+};
+
+#endif  // __CALIBRATION_H
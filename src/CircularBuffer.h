@@ -4,10 +4,14 @@
 #ifndef __CIRCULARBUFFER_H
 #define __CIRCULARBUFFER_H
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 
-/** A circular buffer specialized for adaptive resampling.
+/** A circular buffer specialized for adaptive resampling. Frames are stored
+ *  at their media timestamp. The buffer is sized for the largest latency,
+ *  so the latency can change without reallocation.
  */
 class CircularBuffer {
 public:
@@ -15,16 +19,18 @@ public:
      *
      *  \param periodSize the size of a period in frames.
      *  \param channels the number of channels in each frame.
-     *  \param latency the target latency.
+     *  \param latency the largest target latency in periods.
      */
     CircularBuffer(unsigned int periodSize, unsigned int channels, unsigned int latency)
     : periodSize_(periodSize)
     , channels_(channels)
     , latency_(latency)
-    , capacity_(periodSize_ * channels_ * 2 * latency_)
+    , frames_(periodSize_ * 2 * latency_)
+    , capacity_(frames_ * channels_)
     , data_(new int16_t [capacity_])
     , lastRead_(0)
-    , lastWrite_(0) {
+    , lastWrite_(0)
+    , writeEnd_(0) {
         memset(data_, 0, capacity_ * sizeof(int16_t));
     }
 
@@ -41,18 +47,16 @@ public:
      *
      *  \param sample the index of the sample.
      */
-    int16_t operator [] (int sample) const {
-        const auto pos = (sample % (periodSize_ * 2 * latency_)) * channels_;
-        return data_[pos];
+    int16_t operator [] (uint64_t sample) const {
+        return data_[position(sample)];
     }
 
     /** Index operator (non-const)
      *
      *  \param sample the index of the sample.
      */
-    int16_t& operator [] (int sample) {
-        const auto pos = (sample % (periodSize_ * 2 * latency_)) * channels_;
-        return data_[pos];
+    int16_t& operator [] (uint64_t sample) {
+        return data_[position(sample)];
     }
 
     /** Writes frames to the buffer.
@@ -61,9 +65,12 @@ public:
      *  \param data a pointer to data that should be written to the buffer.
      *  \param length the number frames in the input.
      */
-    void write(int32_t sample, int16_t* data, uint32_t length) {
-        const auto pos = (sample % (periodSize_ * 2 * latency_)) * channels_;
+    void write(uint64_t sample, const int16_t* data, uint32_t length) {
+        const auto pos = position(sample);
         lastWrite_ = pos;
+        if (sample + length > writeEnd_.load(std::memory_order_relaxed)) {
+            writeEnd_.store(sample + length, std::memory_order_release);
+        }
         auto rest = static_cast<int>(pos + (length * channels_)) - static_cast<int>(capacity_);
         if (rest < 0) {
             rest = 0;
@@ -81,8 +88,8 @@ public:
      *  \param data a pointer to the output memory.
      *  \param length the number of frames to read from the buffer.
      */
-    void read(int32_t sample, int16_t* data, uint32_t length) {
-        const auto pos = (sample % (periodSize_ * 2 * latency_)) * channels_;
+    void read(uint64_t sample, int16_t* data, uint32_t length) {
+        const auto pos = position(sample);
         lastRead_ = pos;
         auto rest = static_cast<int>(pos + (length * channels_)) - static_cast<int>(capacity_);
         if (rest < 0) {
@@ -95,6 +102,12 @@ public:
         }
     }
 
+    /** Returns the largest target latency in periods the buffer holds.
+     */
+    unsigned int maxLatency() const {
+        return latency_;
+    }
+
     /** Returns the difference between the last read and the last write in frames.
      */
     int32_t readWriteDiff() const {
@@ -102,14 +115,35 @@ public:
         return diff / channels_;
     }
 
+    /** Returns the number of frames written beyond the end of a read. A
+     *  negative value means that the read contains frames that have not
+     *  been written yet. Returns 0 before the first write.
+     *
+     *  \param end the media timestamp following the last frame of the read.
+     */
+    int64_t headroom(uint64_t end) const {
+        const auto written = writeEnd_.load(std::memory_order_acquire);
+        return written == 0 ? 0 : static_cast<int64_t>(written - end);
+    }
+
 private:
+    /** Returns the position of a sample in the buffer data.
+     *
+     *  \param sample the media timestamp of the sample.
+     */
+    int32_t position(uint64_t sample) const {
+        return static_cast<int32_t>((sample % frames_) * channels_);
+    }
+
     const unsigned int periodSize_;     /**< The size of one period in frames.      */
     const unsigned int channels_;       /**< The number of channels in each frame.  */
-    const unsigned int latency_;        /**< The target latency in periods.         */
+    const unsigned int latency_;        /**< The largest target latency in periods. */
+    const unsigned int frames_;         /**< The capacity of the buffer in frames.  */
     const unsigned int capacity_;       /**< The capacity of the buffer.            */
     int16_t * const data_;              /**< A pointer to the buffer data.          */
     int32_t lastRead_;                  /**< The index of the last read.            */
     int32_t lastWrite_;                 /**< The index of the last write.           */
+    std::atomic<uint64_t> writeEnd_;    /**< The media timestamp after the latest written frame. */
 };
 
 #endif  // __CIRCULARBUFFER_H
@@ -0,0 +1,119 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "ClockState.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+static const double MaxDeviation = 0.05;    // the largest deviation of a rate from 1 taken from a file
+
+/** Splits a line into its key=value pairs.
+ */
+static std::map<std::string, std::string> parse(const std::string& line) {
+    std::map<std::string, std::string> values;
+    std::istringstream stream(line);
+    std::string token;
+    while (stream >> token) {
+        const auto pos = token.find('=');
+        if (pos != std::string::npos) {
+            values[token.substr(0, pos)] = token.substr(pos + 1);
+        }
+    }
+    return values;
+}
+
+ClockState::ClockState(const std::string& streamName, const std::string& deviceName)
+: stream(streamName)
+, device(deviceName)
+, ratio(1.0)
+, networkRate(1.0)
+, deviceRate(1.0) {
+}
+
+bool ClockState::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto values = parse(line);
+        if (values["stream"] != stream || values["device"] != device) {
+            continue;
+        }
+        try {
+            ratio = std::stod(values["ratio"]);
+            networkRate = std::stod(values["network"]);
+            deviceRate = std::stod(values["playback"]);
+        } catch (const std::exception&) {
+            return false;
+        }
+        return std::fabs(ratio - 1.0) < MaxDeviation && std::fabs(networkRate - 1.0) < MaxDeviation
+            && std::fabs(deviceRate - 1.0) < MaxDeviation;
+    }
+    return false;
+}
+
+void ClockState::save(const std::string& path) const {
+    if (stream.find_first_of(" \t") != std::string::npos || device.find_first_of(" \t") != std::string::npos) {
+        throw std::runtime_error("Cannot store the clock state of names with spaces");
+    }
+
+    // Keeps the states of other streams and devices.
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            auto values = parse(line);
+            if (values["stream"] != stream || values["device"] != device) {
+                lines.push_back(line);
+            }
+        }
+    }
+    std::ostringstream state;
+    state.precision(12);
+    state << "stream=" << stream << " device=" << device << " ratio=" << ratio
+          << " network=" << networkRate << " playback=" << deviceRate;
+    lines.push_back(state.str());
+
+    // Written to a file of its own and renamed over the state, so a crash or
+    // another receiver saving at the same time never leaves a truncated file.
+    const std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Failed to open " + temporary);
+        }
+        file << "# Clock state of the receiver per stream and device\n";
+        for (const auto& line : lines) {
+            file << line << "\n";
+        }
+        file.close();
+        if (!file) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Failed to write " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        const std::string error = strerror(errno);
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Failed to replace " + path + ": " + error);
+    }
+}
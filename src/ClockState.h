@@ -0,0 +1,47 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __CLOCKSTATE_H
+#define __CLOCKSTATE_H
+
+#include <string>
+
+/** The converged clock state of a receiver for one stream and audio device.
+ *  The clocks of the same sender and device drift against each other at an
+ *  almost constant rate, so a receiver started from the state of its last
+ *  run locks much faster than one starting from nominal rates.
+ *
+ *  The states of all streams and devices are stored in one text file with
+ *  one line of space separated key=value pairs per stream and device.
+ */
+struct ClockState {
+    /** Constructor.
+     *
+     *  \param stream the identification of the stream, e.g. address:port/id.
+     *  \param device the name of the audio device.
+     */
+    ClockState(const std::string& stream, const std::string& device);
+
+    /** Loads the state of the stream and device from a file.
+     *
+     *  \param path the path of the file.
+     *  \return false if the file does not exist or holds no valid state of the stream and device.
+     */
+    bool load(const std::string& path);
+
+    /** Saves the state to a file, replacing a previous state of the stream
+     *  and device and keeping the states of others. The file is replaced
+     *  atomically. Throws a std::runtime_error on failure.
+     *
+     *  \param path the path of the file.
+     */
+    void save(const std::string& path) const;
+
+    std::string stream;     /**< The identification of the stream.                                */
+    std::string device;     /**< The name of the audio device.                                    */
+    double ratio;           /**< The resampling ratio.                                            */
+    double networkRate;     /**< The packet period of the sender over its nominal value.          */
+    double deviceRate;      /**< The period of the audio device over its nominal value.           */
+};
+
+#endif  // __CLOCKSTATE_H
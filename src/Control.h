@@ -0,0 +1,80 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include <cstdint>
+#include <arpa/inet.h>
+
+/** The types of control messages.
+ */
+enum class ControlType : uint8_t {
+    Join = 1,       /**< A receiver requests a stream or refreshes its membership.   */
+    Leave = 2,      /**< A receiver no longer wants a stream.                         */
+    Accept = 3,     /**< The sender sends the stream and describes its format.       */
+    Reject = 4,     /**< The sender does not know the requested stream.              */
+    CatchUp = 5     /**< A joined receiver requests the recent packets of the stream. */
+};
+
+/** The format of a stream, as described by the Accept of a join.
+ */
+struct StreamFormat {
+    uint16_t id;                /**< The ID of the stream.                              */
+    unsigned int sampleRate;    /**< The sample rate.                                   */
+    unsigned int periodTime;    /**< The period time in microseconds.                   */
+    unsigned int channels;      /**< The number of channels.                            */
+    unsigned int timeout;       /**< The membership timeout in milliseconds, set by the control server. */
+};
+
+/** A message of the control protocol, exchanged over UDP between a receiver
+ *  and the control port of a sender. A receiver joins a stream, repeats the
+ *  join to keep its membership alive and leaves on shutdown. The sender
+ *  answers every join with the format of the stream and drops receivers that
+ *  have not refreshed their membership within the timeout. Once it is ready to
+ *  play, a joined receiver can request the recent packets of the stream to
+ *  fill its buffer at once. All fields are in network byte order.
+ */
+struct ControlMessage {
+    uint32_t magic;         /**< ControlMessage::Magic.                                  */
+    uint8_t version;        /**< ControlMessage::Version.                                */
+    uint8_t type;           /**< The ControlType.                                        */
+    uint16_t streamId;      /**< The ID of the stream.                                   */
+    uint16_t port;          /**< Join, Leave: the UDP port the receiver gets packets on. */
+    uint16_t channels;      /**< Accept: the number of channels.                         */
+    uint32_t sampleRate;    /**< Accept: the sample rate.                                */
+    uint32_t periodTime;    /**< Accept: the period time in microseconds.                */
+    uint32_t timeout;       /**< Accept: the membership timeout in milliseconds.         */
+    uint32_t history;       /**< CatchUp: the time of recent audio requested in microseconds. */
+
+    static const uint32_t Magic = 0x5343544c;   /**< "SCTL". */
+    static const uint8_t Version = 2;           /**< The version of the message layout. */
+
+    /** Returns a message of the given type with all other fields zero.
+     *
+     *  \param type the type.
+     *  \param streamId the ID of the stream.
+     */
+    static ControlMessage make(ControlType type, uint16_t streamId) {
+        ControlMessage message;
+        message.magic = htonl(Magic);
+        message.version = Version;
+        message.type = static_cast<uint8_t>(type);
+        message.streamId = htons(streamId);
+        message.port = 0;
+        message.channels = 0;
+        message.sampleRate = 0;
+        message.periodTime = 0;
+        message.timeout = 0;
+        message.history = 0;
+        return message;
+    }
+
+    /** Returns true if the message has the expected magic and version.
+     */
+    bool isValid() const {
+        return ntohl(magic) == Magic && version == Version;
+    }
+} __attribute__((packed));
+
+#endif  // __CONTROL_H
@@ -0,0 +1,127 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "ControlClient.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+static const int RetryInterval = 500;   // milliseconds between unanswered joins
+static const unsigned int Attempts = 10;
+
+ControlClient::ControlClient(const std::string& host, unsigned short controlPort, unsigned short port)
+: port_(port)
+, sender_()
+, socket_(-1)
+, streamId_(0)
+, timeout_(0)
+, joined_(false)
+, mutex_()
+, condition_()
+, thread_() {
+    sender_.sin_family = AF_INET;
+    sender_.sin_port = htons(controlPort);
+    if (inet_pton(AF_INET, host.c_str(), &sender_.sin_addr) != 1) {
+        throw std::runtime_error("Invalid sender address " + host);
+    }
+    socket_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        throw std::runtime_error(std::string("Failed to create control socket: ") + strerror(errno));
+    }
+}
+
+ControlClient::~ControlClient() {
+    leave();
+    close(socket_);
+}
+
+StreamFormat ControlClient::join(uint16_t streamId) {
+    leave();
+    streamId_ = streamId;
+
+    for (unsigned int attempt = 0; attempt < Attempts; ++attempt) {
+        send(ControlType::Join);
+
+        struct pollfd fd;
+        fd.fd = socket_;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RetryInterval);
+        int remaining = RetryInterval;
+        while (remaining > 0 && poll(&fd, 1, remaining) > 0) {
+            ControlMessage reply;
+            const auto n = recv(socket_, &reply, sizeof(reply), MSG_DONTWAIT);
+            if (n == static_cast<ssize_t>(sizeof(reply)) && reply.isValid() && ntohs(reply.streamId) == streamId) {
+                const auto type = static_cast<ControlType>(reply.type);
+                if (type == ControlType::Reject) {
+                    throw std::runtime_error("Sender rejected stream " + std::to_string(streamId));
+                } else if (type == ControlType::Accept) {
+                    StreamFormat format;
+                    format.id = streamId;
+                    format.sampleRate = ntohl(reply.sampleRate);
+                    format.periodTime = ntohl(reply.periodTime);
+                    format.channels = ntohs(reply.channels);
+                    format.timeout = ntohl(reply.timeout);
+
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    timeout_ = format.timeout;
+                    joined_ = true;
+                    thread_.reset(new std::thread([this] () { keepalive(); }));
+                    return format;
+                }
+            }
+            remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count());
+        }
+    }
+    throw std::runtime_error("No answer from sender for stream " + std::to_string(streamId));
+}
+
+void ControlClient::leave() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!joined_) {
+            return;
+        }
+        joined_ = false;
+    }
+    condition_.notify_all();
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+    send(ControlType::Leave);
+}
+
+void ControlClient::catchUp(unsigned int time) {
+    ControlMessage message = ControlMessage::make(ControlType::CatchUp, streamId_);
+    message.port = htons(port_);
+    message.history = htonl(time);
+    sendto(socket_, &message, sizeof(message), 0, reinterpret_cast<const struct sockaddr*>(&sender_), sizeof(sender_));
+}
+
+void ControlClient::send(ControlType type) {
+    ControlMessage message = ControlMessage::make(type, streamId_);
+    message.port = htons(port_);
+    sendto(socket_, &message, sizeof(message), 0, reinterpret_cast<const struct sockaddr*>(&sender_), sizeof(sender_));
+}
+
+void ControlClient::keepalive() {
+    // Refreshing three times per timeout tolerates the loss of two joins.
+    const auto interval = std::chrono::milliseconds(std::max(timeout_ / 3, 1u));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!condition_.wait_for(lock, interval, [this] () { return !joined_; })) {
+        send(ControlType::Join);
+        // Drains the Accept answering the refresh.
+        ControlMessage reply;
+        while (recv(socket_, &reply, sizeof(reply), MSG_DONTWAIT) > 0) {
+        }
+    }
+}
@@ -0,0 +1,80 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __CONTROLCLIENT_H
+#define __CONTROLCLIENT_H
+
+#include "Control.h"
+
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <cstdint>
+#include <netinet/in.h>
+
+/** The receiver side of the control protocol, see ControlMessage. Joins a
+ *  stream at the control port of a sender, keeps the membership alive from a
+ *  background thread and leaves the stream again.
+ */
+class ControlClient {
+public:
+    /** Constructor.
+     *
+     *  \param host the IPv4 address of the sender.
+     *  \param controlPort the control port of the sender.
+     *  \param port the UDP port the receiver gets packets on.
+     */
+    ControlClient(const std::string& host, unsigned short controlPort, unsigned short port);
+
+    ControlClient(const ControlClient&) = delete;
+    ControlClient& operator =(const ControlClient&) = delete;
+
+    /** Destructor. Leaves the current stream.
+     */
+    ~ControlClient();
+
+    /** Joins a stream and starts refreshing the membership. Leaves the
+     *  current stream first. Throws a std::runtime_error if the sender
+     *  rejects the stream or does not answer.
+     *
+     *  \param streamId the ID of the stream.
+     *  \return the format of the stream.
+     */
+    StreamFormat join(uint16_t streamId);
+
+    /** Requests the recent packets of the joined stream. The sender sends
+     *  them at once to the UDP port of the receiver, if it keeps a history.
+     *
+     *  \param time the time of audio requested in microseconds.
+     */
+    void catchUp(unsigned int time);
+
+    /** Leaves the current stream, if any.
+     */
+    void leave();
+
+private:
+    /** Sends a control message of the given type for the current stream.
+     *
+     *  \param type the type of the message.
+     */
+    void send(ControlType type);
+
+    /** Refreshes the membership until leave() is called.
+     */
+    void keepalive();
+
+    const unsigned short port_;                 /**< The UDP port the receiver gets packets on.     */
+    struct sockaddr_in sender_;                 /**< The address of the control port.               */
+    int socket_;                                /**< The UDP socket.                                */
+    uint16_t streamId_;                         /**< The ID of the current stream.                  */
+    unsigned int timeout_;                      /**< The membership timeout in milliseconds.        */
+    bool joined_;                               /**< True while a stream is joined.                 */
+    std::mutex mutex_;                          /**< Guards joined_ against the keepalive thread.   */
+    std::condition_variable condition_;         /**< Wakes the keepalive thread on leave().         */
+    std::unique_ptr<std::thread> thread_;       /**< The keepalive thread.                          */
+};
+
+#endif  // __CONTROLCLIENT_H
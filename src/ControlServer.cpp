@@ -0,0 +1,173 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "ControlServer.h"
+#include "Transmitter.h"
+#include "Log.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+static const int PollTimeout = 100;    // milliseconds between checks for expired receivers
+
+/** Returns the monotonic time in milliseconds.
+ */
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+/** Returns the IPv4 address of an endpoint for logging.
+ */
+static LogAddress address(const boost::asio::ip::udp::endpoint& endpoint) {
+    return LogAddress{static_cast<uint32_t>(endpoint.address().to_v4().to_ulong())};
+}
+
+ControlServer::ControlServer(unsigned short port, const std::vector<StreamFormat>& streams, unsigned int timeout,
+    Transmitter& transmitter)
+: port_(port)
+, streams_(streams)
+, timeout_(timeout)
+, transmitter_(transmitter)
+, socket_(-1)
+, members_()
+, thread_()
+, running_(false) {
+}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+void ControlServer::start() {
+    stop();
+
+    socket_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        throw std::runtime_error(std::string("Failed to create control socket: ") + strerror(errno));
+    }
+    int enable = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port_);
+    if (bind(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        const std::string error = strerror(errno);
+        close(socket_);
+        socket_ = -1;
+        throw std::runtime_error("Failed to bind control port " + std::to_string(port_) + ": " + error);
+    }
+
+    running_ = true;
+    thread_.reset(new std::thread([this] () { run(); }));
+}
+
+void ControlServer::stop() {
+    running_ = false;
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+    for (const auto& member : members_) {
+        transmitter_.removeDestination(member.first.first, member.first.second);
+    }
+    members_.clear();
+    if (socket_ >= 0) {
+        close(socket_);
+        socket_ = -1;
+    }
+}
+
+void ControlServer::run() {
+    log_register_thread();
+    while (running_) {
+        struct pollfd fd;
+        fd.fd = socket_;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        const int result = poll(&fd, 1, PollTimeout);
+        if (result < 0 && errno != EINTR) {
+            log_error("Failed to poll control socket: {}", LogErrno{errno});
+            break;
+        }
+        const auto now = monotonic_ms();
+        if (result > 0) {
+            ControlMessage message;
+            struct sockaddr_in from;
+            socklen_t length = sizeof(from);
+            const auto n = recvfrom(socket_, &message, sizeof(message), MSG_DONTWAIT,
+                reinterpret_cast<struct sockaddr*>(&from), &length);
+            if (n == static_cast<ssize_t>(sizeof(message)) && message.isValid() && from.sin_family == AF_INET) {
+                const boost::asio::ip::udp::endpoint sender(boost::asio::ip::address_v4(ntohl(from.sin_addr.s_addr)),
+                    ntohs(from.sin_port));
+                handle(message, sender, now);
+            }
+        }
+        expire(now);
+    }
+}
+
+void ControlServer::handle(const ControlMessage& message, const boost::asio::ip::udp::endpoint& sender, uint64_t now) {
+    const auto streamId = ntohs(message.streamId);
+    const auto type = static_cast<ControlType>(message.type);
+    // Packets go to the address the request came from and the port it names.
+    const Membership membership(streamId, boost::asio::ip::udp::endpoint(sender.address(), ntohs(message.port)));
+
+    if (type == ControlType::Join) {
+        const StreamFormat* format = nullptr;
+        for (const auto& stream : streams_) {
+            if (stream.id == streamId) {
+                format = &stream;
+            }
+        }
+
+        ControlMessage reply = ControlMessage::make(format ? ControlType::Accept : ControlType::Reject, streamId);
+        if (format) {
+            reply.port = message.port;
+            reply.channels = htons(static_cast<uint16_t>(format->channels));
+            reply.sampleRate = htonl(format->sampleRate);
+            reply.periodTime = htonl(format->periodTime);
+            reply.timeout = htonl(timeout_);
+
+            if (members_.count(membership) == 0) {
+                transmitter_.addDestination(streamId, membership.second);
+                log_info("Receiver {}:{} joined stream {}", address(membership.second),
+                    membership.second.port(), streamId);
+            }
+            members_[membership] = now;
+        }
+        sendto(socket_, &reply, sizeof(reply), MSG_DONTWAIT, sender.data(), static_cast<socklen_t>(sender.size()));
+    } else if (type == ControlType::CatchUp) {
+        if (members_.count(membership) > 0) {
+            transmitter_.sendHistory(streamId, membership.second, ntohl(message.history));
+        }
+    } else if (type == ControlType::Leave) {
+        if (members_.erase(membership) > 0) {
+            transmitter_.removeDestination(streamId, membership.second);
+            log_info("Receiver {}:{} left stream {}", address(membership.second),
+                membership.second.port(), streamId);
+        }
+    }
+}
+
+void ControlServer::expire(uint64_t now) {
+    for (auto it = members_.begin(); it != members_.end();) {
+        if (now - it->second > timeout_) {
+            transmitter_.removeDestination(it->first.first, it->first.second);
+            log_info("Receiver {}:{} timed out on stream {}", address(it->first.second), it->first.second.port(),
+                it->first.first);
+            it = members_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
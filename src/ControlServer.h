@@ -0,0 +1,85 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __CONTROLSERVER_H
+#define __CONTROLSERVER_H
+
+#include <boost/asio.hpp>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+
+#include "Control.h"
+
+class Transmitter;
+
+/** The control port of a sender. Receivers join and leave the streams of the
+ *  sender, see ControlMessage. Joined receivers are added to the destinations
+ *  of their stream in the transmitter and removed when they leave or stop
+ *  refreshing their membership. A joined receiver can request the history of
+ *  its stream kept by the transmitter.
+ */
+class ControlServer {
+public:
+    /** Constructor.
+     *
+     *  \param port the UDP port to listen on.
+     *  \param streams the streams receivers can join.
+     *  \param timeout the time in milliseconds a membership lasts without a refresh.
+     *  \param transmitter the transmitter sending the streams.
+     */
+    ControlServer(unsigned short port, const std::vector<StreamFormat>& streams, unsigned int timeout,
+        Transmitter& transmitter);
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator =(const ControlServer&) = delete;
+
+    /** Destructor.
+     */
+    ~ControlServer();
+
+    /** Opens the control port and starts the control thread. Throws a
+     *  std::runtime_error if the port cannot be opened.
+     */
+    void start();
+
+    /** Stops the control thread and removes all receivers.
+     */
+    void stop();
+
+private:
+    typedef std::pair<uint16_t, boost::asio::ip::udp::endpoint> Membership;
+
+    /** Runs the control loop.
+     */
+    void run();
+
+    /** Handles a control message.
+     *
+     *  \param message the message.
+     *  \param sender the address the message was received from.
+     *  \param now the current monotonic time in milliseconds.
+     */
+    void handle(const ControlMessage& message, const boost::asio::ip::udp::endpoint& sender, uint64_t now);
+
+    /** Removes the receivers that have not refreshed their membership.
+     *
+     *  \param now the current monotonic time in milliseconds.
+     */
+    void expire(uint64_t now);
+
+    const unsigned short port_;                 /**< The UDP port.                                  */
+    const std::vector<StreamFormat> streams_;   /**< The streams of the sender.                     */
+    const unsigned int timeout_;                /**< The membership timeout in milliseconds.        */
+    Transmitter& transmitter_;                  /**< The transmitter sending the streams.           */
+    int socket_;                                /**< The UDP socket, -1 if closed.                  */
+    std::map<Membership, uint64_t> members_;    /**< The time of the last join of each receiver.    */
+    std::unique_ptr<std::thread> thread_;       /**< The control thread.                            */
+    std::atomic<bool> running_;                 /**< True while the control thread runs.            */
+};
+
+#endif  // __CONTROLSERVER_H
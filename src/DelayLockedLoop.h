@@ -23,21 +23,45 @@ public:
      *  \param periodTimeUs the expected period time in microseconds.
      */
     DelayLockedLoop(double periodTimeUs)
-    : tper_(periodTimeUs)
+    : tper_(0)
+    , rate_(1.0)
     , b_(0), c_(0), t0_(0), t1_(0), e2_(0) {
+        setPeriodTime(periodTimeUs);
+    }
+
+    /** Changes the expected period time. Takes effect with the next reset().
+     *
+     *  \param periodTimeUs the expected period time in microseconds.
+     */
+    void setPeriodTime(double periodTimeUs) {
         const double sqrt2 = 1.414213562373095;
         const double pi = 3.141592653589793;
+        tper_ = periodTimeUs;
         const double omega = 2.0 * pi * 0.1 * tper_;
         b_ = sqrt2 * omega;
         c_ = omega * omega;
     }
 
+    /** Sets the ratio of the actual to the expected period time the loop
+     *  starts with, e.g. the one a previous run converged to. Takes effect
+     *  with the next reset().
+     *
+     *  \param rate the ratio of the period times.
+     */
+    void setRate(double rate) {
+        rate_ = rate;
+    }
+
+    /** Returns the ratio of the estimated to the expected period time.
+     */
+    inline double rate() const { return e2_ / tper_; }
+
     /** Resets the state to a new start time.
      *
      *  \param t the current system time.
      */
     void reset(double t) {
-        e2_ = tper_;
+        e2_ = tper_ * rate_;
         t0_ = t;
         t1_ = t0_ + e2_;
     }
@@ -66,7 +90,8 @@ public:
     inline double periodTime() const { return t1_ - t0_; }
 
 private:
-    const double tper_;     /**< The expected period time in microsecond.           */
+    double tper_;           /**< The expected period time in microsecond.           */
+    double rate_;           /**< The ratio of the period times the loop starts with. */
     double b_;              /**< Coefficient b                                      */
     double c_;              /**< Coefficient c                                      */
     double t0_;             /**< The estimated current time in seconds.             */
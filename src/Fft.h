@@ -0,0 +1,105 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __FFT_H
+#define __FFT_H
+
+#include <complex>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+/** An iterative radix-2 fast Fourier transform of a fixed size.
+ */
+class Fft {
+public:
+    /** Constructor
+     *
+     *  \param size the size of the transform, must be a power of two.
+     */
+    explicit Fft(std::size_t size)
+    : size_(size)
+    , twiddles_(size / 2)
+    , reversed_(size) {
+        const double pi = 3.141592653589793;
+        for (std::size_t i = 0; i < size_ / 2; ++i) {
+            twiddles_[i] = std::polar(1.0, -2.0 * pi * static_cast<double>(i) / static_cast<double>(size_));
+        }
+        std::size_t bits = 0;
+        while ((static_cast<std::size_t>(1) << bits) < size_) {
+            bits += 1;
+        }
+        for (std::size_t i = 0; i < size_; ++i) {
+            std::size_t r = 0;
+            for (std::size_t b = 0; b < bits; ++b) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            reversed_[i] = r;
+        }
+    }
+
+    /** Returns the size of the transform.
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    /** Computes the forward transform in place.
+     *
+     *  \param data the data to transform, must contain size() elements.
+     */
+    void forward(std::vector<std::complex<double>>& data) const {
+        transform(data, false);
+    }
+
+    /** Computes the inverse transform in place including the 1/N scaling.
+     *
+     *  \param data the data to transform, must contain size() elements.
+     */
+    void inverse(std::vector<std::complex<double>>& data) const {
+        transform(data, true);
+        const double scale = 1.0 / static_cast<double>(size_);
+        for (auto& value : data) {
+            value *= scale;
+        }
+    }
+
+private:
+    /** Runs the butterflies.
+     *
+     *  \param data the data to transform.
+     *  \param inverse true for the inverse transform.
+     */
+    void transform(std::vector<std::complex<double>>& data, bool inverse) const {
+        for (std::size_t i = 0; i < size_; ++i) {
+            if (i < reversed_[i]) {
+                std::swap(data[i], data[reversed_[i]]);
+            }
+        }
+        // The complex products are written out by hand, std::complex<double>
+        // multiplication checks for NaN and infinity and is several times slower.
+        const double sign = inverse ? -1.0 : 1.0;
+        for (std::size_t length = 2; length <= size_; length <<= 1) {
+            const std::size_t half = length / 2;
+            const std::size_t stride = size_ / length;
+            for (std::size_t start = 0; start < size_; start += length) {
+                for (std::size_t k = 0; k < half; ++k) {
+                    const double wr = twiddles_[k * stride].real();
+                    const double wi = sign * twiddles_[k * stride].imag();
+                    const auto u = data[start + k];
+                    const auto x = data[start + k + half];
+                    const double vr = x.real() * wr - x.imag() * wi;
+                    const double vi = x.real() * wi + x.imag() * wr;
+                    data[start + k] = std::complex<double>(u.real() + vr, u.imag() + vi);
+                    data[start + k + half] = std::complex<double>(u.real() - vr, u.imag() - vi);
+                }
+            }
+        }
+    }
+
+    const std::size_t size_;                            /**< The size of the transform.         */
+    std::vector<std::complex<double>> twiddles_;        /**< The precomputed twiddle factors.   */
+    std::vector<std::size_t> reversed_;                 /**< The bit-reversed indices.          */
+};
+
+#endif  // __FFT_H
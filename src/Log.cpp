@@ -0,0 +1,233 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Log.h"
+#include "Utils.h"
+
+#include <readerwriterqueue.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+using namespace moodycamel;
+
+static const std::size_t RingCapacity = 256;    // records per thread
+static const double RateLimit = 200.0;          // records per second and thread
+static const double RateBurst = 50.0;           // records logged at once before the rate limit applies
+static const unsigned int FlushInterval = 10;   // milliseconds
+
+/** A formatted-later log message.
+ */
+struct LogEntry {
+    double time;                        /**< The time the record was logged.    */
+    bool error;                         /**< True if written to stderr.         */
+    const char* format;                 /**< The format string.                 */
+    std::size_t count;                  /**< The number of values.              */
+    LogValue values[MaxLogValues];      /**< The values.                        */
+};
+
+/** The log ring of a thread. The thread is the only producer, the flush
+ *  thread the only consumer.
+ */
+struct LogRing {
+    LogRing()
+    : queue(RingCapacity)
+    , dropped(0)
+    , tokens(RateBurst)
+    , lastRefill(0)
+    , closed(false) {
+    }
+
+    ReaderWriterQueue<LogEntry> queue;  /**< The records.                                   */
+    std::atomic<uint64_t> dropped;      /**< The number of records dropped.                 */
+    double tokens;                      /**< The records allowed by the rate limit.         */
+    double lastRefill;                  /**< The time the tokens were last refilled.        */
+    std::atomic<bool> closed;           /**< True if the thread of the ring has exited.     */
+};
+
+/** Owns the rings of all threads and the flush thread.
+ */
+class Logger {
+public:
+    /** Returns the process wide instance.
+     */
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator =(const Logger&) = delete;
+
+    /** Destructor. Stops the flush thread and writes all pending records.
+     */
+    ~Logger() {
+        running_ = false;
+        if (thread_ && thread_->joinable()) {
+            thread_->join();
+        }
+        flush();
+    }
+
+    /** Creates a ring for a thread and starts the flush thread if necessary.
+     */
+    LogRing* add() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.emplace_back(new LogRing());
+        if (!thread_) {
+            running_ = true;
+            thread_.reset(new std::thread([this] () {
+                while (running_) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(FlushInterval));
+                    flush();
+                }
+            }));
+        }
+        return rings_.back().get();
+    }
+
+    /** Writes all pending records ordered by time and removes the rings of
+     *  exited threads.
+     */
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        uint64_t dropped = 0;
+        for (auto& ring : rings_) {
+            const bool closed = ring->closed;
+            LogEntry entry;
+            while (ring->queue.try_dequeue(entry)) {
+                entries_.push_back(entry);
+            }
+            dropped += ring->dropped.exchange(0);
+            if (closed) {
+                ring.reset();
+            }
+        }
+        rings_.erase(std::remove(rings_.begin(), rings_.end(), nullptr), rings_.end());
+
+        std::stable_sort(entries_.begin(), entries_.end(), [] (const LogEntry& a, const LogEntry& b) {
+            return a.time < b.time;
+        });
+        bool out = false, err = false;
+        for (const auto& entry : entries_) {
+            auto& stream = entry.error ? std::cerr : std::cout;
+            write(stream, entry);
+            out = out || !entry.error;
+            err = err || entry.error;
+        }
+        if (dropped > 0) {
+            std::cerr << dropped << " log messages dropped\n";
+            err = true;
+        }
+        if (out) {
+            std::cout.flush();
+        }
+        if (err) {
+            std::cerr.flush();
+        }
+    }
+
+private:
+    Logger()
+    : mutex_()
+    , rings_()
+    , entries_()
+    , thread_()
+    , running_(false) {
+    }
+
+    /** Formats a record.
+     */
+    static void write(std::ostream& stream, const LogEntry& entry) {
+        std::size_t next = 0;
+        for (const char* c = entry.format; *c != '\0'; ++c) {
+            if (c[0] == '{' && c[1] == '}' && next < entry.count) {
+                const auto& value = entry.values[next++];
+                if (value.type == LogValue::Type::Signed) {
+                    stream << value.i;
+                } else if (value.type == LogValue::Type::Unsigned) {
+                    stream << value.u;
+                } else if (value.type == LogValue::Type::Double) {
+                    stream << value.d;
+                } else if (value.type == LogValue::Type::String) {
+                    stream << (value.s ? value.s : "(null)");
+                } else if (value.type == LogValue::Type::Errno) {
+                    stream << strerror(static_cast<int>(value.i));
+                } else if (value.type == LogValue::Type::Address) {
+                    stream << ((value.u >> 24) & 0xff) << '.' << ((value.u >> 16) & 0xff) << '.'
+                           << ((value.u >> 8) & 0xff) << '.' << (value.u & 0xff);
+                }
+                ++c;
+            } else {
+                stream << *c;
+            }
+        }
+        stream << "\n";
+    }
+
+    std::mutex mutex_;                              /**< Guards the rings.                      */
+    std::vector<std::unique_ptr<LogRing>> rings_;   /**< The rings of all threads.              */
+    std::vector<LogEntry> entries_;                 /**< The records of the current flush.      */
+    std::unique_ptr<std::thread> thread_;           /**< The flush thread.                      */
+    std::atomic<bool> running_;                     /**< True while the flush thread runs.      */
+};
+
+/** The ring of the current thread, closed when the thread exits.
+ */
+class LogThread {
+public:
+    LogThread() : ring_(nullptr) {}
+
+    LogThread(const LogThread&) = delete;
+    LogThread& operator =(const LogThread&) = delete;
+
+    ~LogThread() {
+        if (ring_) {
+            ring_->closed = true;
+        }
+    }
+
+    /** Returns the ring, created on first use.
+     */
+    LogRing* ring() {
+        if (!ring_) {
+            ring_ = Logger::instance().add();
+        }
+        return ring_;
+    }
+
+private:
+    LogRing* ring_;     /**< The ring of the thread. */
+};
+
+static thread_local LogThread currentThread;
+
+void log_record(bool error, const char* format, const LogValue* values, std::size_t count) {
+    auto ring = currentThread.ring();
+
+    LogEntry entry;
+    entry.time = get_time();
+    entry.error = error;
+    entry.format = format;
+    entry.count = std::min(count, MaxLogValues);
+    std::copy(values, values + entry.count, entry.values);
+
+    ring->tokens = std::min(RateBurst, ring->tokens + (entry.time - ring->lastRefill) * RateLimit);
+    ring->lastRefill = entry.time;
+    if (ring->tokens < 1.0 || !ring->queue.try_enqueue(entry)) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->tokens -= 1.0;
+}
+
+void log_register_thread() {
+    currentThread.ring();
+}
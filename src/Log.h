@@ -0,0 +1,98 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __LOG_H
+#define __LOG_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** An errno value logged as its description.
+ */
+struct LogErrno {
+    int value;  /**< The errno value. */
+};
+
+/** An IPv4 address in host byte order logged in dotted notation.
+ */
+struct LogAddress {
+    uint32_t value; /**< The address. */
+};
+
+/** A value of a log record. The record is formatted by the flush thread
+ *  later, so strings must remain valid, e.g. string literals or the
+ *  static strings returned by snd_strerror().
+ */
+struct LogValue {
+    /** The type of a value.
+     */
+    enum class Type {
+        None,
+        Signed,
+        Unsigned,
+        Double,
+        String,
+        Errno,
+        Address
+    };
+
+    LogValue() : type(Type::None), u(0) {}
+    LogValue(int v) : type(Type::Signed), i(v) {}
+    LogValue(long v) : type(Type::Signed), i(v) {}
+    LogValue(long long v) : type(Type::Signed), i(v) {}
+    LogValue(unsigned int v) : type(Type::Unsigned), u(v) {}
+    LogValue(unsigned long v) : type(Type::Unsigned), u(v) {}
+    LogValue(unsigned long long v) : type(Type::Unsigned), u(v) {}
+    LogValue(double v) : type(Type::Double), d(v) {}
+    LogValue(const char* v) : type(Type::String), s(v) {}
+    LogValue(LogErrno v) : type(Type::Errno), i(v.value) {}
+    LogValue(LogAddress v) : type(Type::Address), u(v.value) {}
+
+    Type type;              /**< The type of the value. */
+    union {
+        int64_t i;          /**< A signed integer.      */
+        uint64_t u;         /**< An unsigned integer.   */
+        double d;           /**< A floating point number. */
+        const char* s;      /**< A static string.       */
+    };
+};
+
+/** The maximum number of values of a log record.
+ */
+static const std::size_t MaxLogValues = 4;
+
+/** Appends a record to the log ring of the calling thread. Does not block
+ *  and does not allocate once the thread is registered. Records exceeding
+ *  the rate limit or the capacity of the ring are dropped and counted.
+ *
+ *  \param error true to write the record to stderr, false for stdout.
+ *  \param format a string literal in which every {} is replaced by the next value.
+ *  \param values the values.
+ *  \param count the number of values.
+ */
+void log_record(bool error, const char* format, const LogValue* values, std::size_t count);
+
+/** Allocates the log ring of the calling thread and starts the flush thread
+ *  if necessary. Called by threads before entering their real-time loop.
+ */
+void log_register_thread();
+
+/** Logs a message to stdout, see log_record().
+ */
+template <typename... Args>
+void log_info(const char* format, Args... args) {
+    static_assert(sizeof...(Args) <= MaxLogValues, "Too many values for a log record");
+    const LogValue values[] = { LogValue(), LogValue(args)... };
+    log_record(false, format, values + 1, sizeof...(Args));
+}
+
+/** Logs a message to stderr, see log_record().
+ */
+template <typename... Args>
+void log_error(const char* format, Args... args) {
+    static_assert(sizeof...(Args) <= MaxLogValues, "Too many values for a log record");
+    const LogValue values[] = { LogValue(), LogValue(args)... };
+    log_record(true, format, values + 1, sizeof...(Args));
+}
+
+#endif  // __LOG_H
@@ -0,0 +1,267 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Metrics.h"
+
+#include <stdexcept>
+#include <sstream>
+#include <limits>
+#include <map>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t MetricsMagic = 0x6d747273;    // "mtrs"
+static const uint32_t MetricsVersion = 2;
+static const std::string MetricsPrefix = "streaming-";
+
+/** Copies a string into a fixed size buffer, truncating it if necessary.
+ */
+static void copy_string(char* destination, std::size_t size, const std::string& source) {
+    const auto n = std::min(size - 1, source.size());
+    memcpy(destination, source.data(), n);
+    destination[n] = '\0';
+}
+
+Metrics::Metrics(const std::string& name)
+: path_("/" + MetricsPrefix + name)
+, segment_(nullptr) {
+    const int fd = shm_open(path_.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create metrics segment " + path_ + ": " + strerror(errno));
+    }
+    if (ftruncate(fd, sizeof(MetricsSegment)) != 0) {
+        const std::string error = strerror(errno);
+        ::close(fd);
+        shm_unlink(path_.c_str());
+        throw std::runtime_error("Failed to size metrics segment " + path_ + ": " + error);
+    }
+    void* address = mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        shm_unlink(path_.c_str());
+        throw std::runtime_error("Failed to map metrics segment " + path_ + ": " + strerror(errno));
+    }
+    segment_ = static_cast<MetricsSegment*>(address);
+    segment_->magic = MetricsMagic;
+    segment_->version = MetricsVersion;
+    segment_->pid = static_cast<int32_t>(getpid());
+    segment_->count.store(0, std::memory_order_release);
+}
+
+Metrics::~Metrics() {
+    munmap(segment_, sizeof(MetricsSegment));
+    shm_unlink(path_.c_str());
+}
+
+MetricSlot* Metrics::find(const std::string& name, MetricType type) {
+    const auto count = segment_->count.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < count; ++i) {
+        auto slot = &segment_->slots[i];
+        if (name == slot->name && slot->type == type) {
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+MetricSlot* Metrics::add(const std::string& name, const std::string& help, MetricType type) {
+    const auto index = segment_->count.load(std::memory_order_relaxed);
+    if (index >= MaxMetrics) {
+        throw std::runtime_error("Too many metrics in " + path_);
+    }
+    // A truncated name would cut off the closing brace of its labels.
+    if (name.size() >= MetricNameSize) {
+        throw std::runtime_error("Metric name too long: " + name);
+    }
+    auto slot = &segment_->slots[index];
+    copy_string(slot->name, MetricNameSize, name);
+    copy_string(slot->help, MetricHelpSize, help);
+    slot->type = type;
+    for (std::size_t i = 0; i < MetricBuckets; ++i) {
+        slot->bounds[i] = std::numeric_limits<double>::infinity();
+    }
+    slot->value.store(0, std::memory_order_relaxed);
+    slot->count.store(0, std::memory_order_relaxed);
+    for (auto& bucket : slot->buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    return slot;
+}
+
+MetricCounter Metrics::counter(const std::string& name, const std::string& help) {
+    if (auto slot = find(name, MetricType::Counter)) {
+        return MetricCounter(slot);
+    }
+    auto slot = add(name, help, MetricType::Counter);
+    segment_->count.fetch_add(1, std::memory_order_release);
+    return MetricCounter(slot);
+}
+
+MetricGauge Metrics::gauge(const std::string& name, const std::string& help) {
+    if (auto slot = find(name, MetricType::Gauge)) {
+        return MetricGauge(slot);
+    }
+    auto slot = add(name, help, MetricType::Gauge);
+    segment_->count.fetch_add(1, std::memory_order_release);
+    return MetricGauge(slot);
+}
+
+MetricHistogram Metrics::histogram(const std::string& name, const std::string& help, double first, double factor) {
+    if (auto slot = find(name, MetricType::Histogram)) {
+        return MetricHistogram(slot);
+    }
+    auto slot = add(name, help, MetricType::Histogram);
+    double bound = first;
+    for (std::size_t i = 0; i < MetricBuckets; ++i) {
+        slot->bounds[i] = bound;
+        bound *= factor;
+    }
+    segment_->count.fetch_add(1, std::memory_order_release);
+    return MetricHistogram(slot);
+}
+
+std::string escape_label(const std::string& value) {
+    std::string escaped;
+    for (const auto c : value) {
+        if (c == '\\' || c == '"') {
+            escaped.push_back('\\');
+            escaped.push_back(c);
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+std::vector<std::string> list_metrics() {
+    std::vector<std::string> names;
+    DIR* directory = opendir("/dev/shm");
+    if (!directory) {
+        return names;
+    }
+    while (auto entry = readdir(directory)) {
+        const std::string file = entry->d_name;
+        if (file.compare(0, MetricsPrefix.size(), MetricsPrefix) != 0) {
+            continue;
+        }
+        const int fd = open(("/dev/shm/" + file).c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        MetricsSegment header;
+        const auto n = read(fd, &header, offsetof(MetricsSegment, count));
+        ::close(fd);
+        if (n == static_cast<ssize_t>(offsetof(MetricsSegment, count)) && header.magic == MetricsMagic
+            && (kill(header.pid, 0) == 0 || errno == EPERM)) {
+            names.push_back(file.substr(MetricsPrefix.size()));
+        }
+    }
+    closedir(directory);
+    return names;
+}
+
+/** The samples of one metric family.
+ */
+struct MetricFamily {
+    std::string help;           /**< The description.   */
+    MetricType type;            /**< The type.          */
+    std::ostringstream samples; /**< The sample lines.  */
+};
+
+/** Returns the labels of a sample with the instance label prepended.
+ *
+ *  \param instance the name of the segment.
+ *  \param labels the labels of the metric without braces, may be empty.
+ *  \param extra an additional label, may be empty.
+ */
+static std::string labels(const std::string& instance, const std::string& labels, const std::string& extra) {
+    std::string result = "{instance=\"" + escape_label(instance) + "\"";
+    if (!labels.empty()) {
+        result += "," + labels;
+    }
+    if (!extra.empty()) {
+        result += "," + extra;
+    }
+    return result + "}";
+}
+
+std::string format_metrics(const std::vector<std::string>& names) {
+    std::vector<std::string> order;
+    std::map<std::string, MetricFamily> families;
+    std::ostringstream errors;
+
+    for (const auto& instance : names) {
+        const std::string path = "/" + MetricsPrefix + instance;
+        const int fd = shm_open(path.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            errors << "# Failed to open " << path << ": " << strerror(errno) << "\n";
+            continue;
+        }
+        void* address = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            errors << "# Failed to map " << path << ": " << strerror(errno) << "\n";
+            continue;
+        }
+        const auto segment = static_cast<const MetricsSegment*>(address);
+        if (segment->magic != MetricsMagic || segment->version != MetricsVersion) {
+            errors << "# Unsupported segment " << path << "\n";
+            munmap(address, sizeof(MetricsSegment));
+            continue;
+        }
+
+        const auto count = std::min<std::size_t>(segment->count.load(std::memory_order_acquire), MaxMetrics);
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto& slot = segment->slots[i];
+            const std::string name(slot.name);
+            const auto brace = name.find('{');
+            const std::string base = name.substr(0, brace);
+            const std::string own = brace == std::string::npos ? "" : name.substr(brace + 1, name.size() - brace - 2);
+
+            if (families.count(base) == 0) {
+                order.push_back(base);
+                families[base].help = slot.help;
+                families[base].type = slot.type;
+                families[base].samples.precision(15);
+            }
+            auto& samples = families[base].samples;
+            if (slot.type == MetricType::Histogram) {
+                uint64_t cumulative = 0;
+                for (std::size_t bucket = 0; bucket < MetricBuckets; ++bucket) {
+                    cumulative += slot.buckets[bucket].load(std::memory_order_relaxed);
+                    std::ostringstream bound;
+                    bound.precision(15);
+                    bound << "le=\"" << slot.bounds[bucket] << "\"";
+                    samples << base << "_bucket" << labels(instance, own, bound.str()) << " " << cumulative << "\n";
+                }
+                cumulative += slot.buckets[MetricBuckets].load(std::memory_order_relaxed);
+                samples << base << "_bucket" << labels(instance, own, "le=\"+Inf\"") << " " << cumulative << "\n";
+                samples << base << "_sum" << labels(instance, own, "") << " " << slot.value.load(std::memory_order_relaxed) << "\n";
+                samples << base << "_count" << labels(instance, own, "") << " " << cumulative << "\n";
+            } else {
+                samples << base << labels(instance, own, "") << " " << slot.value.load(std::memory_order_relaxed) << "\n";
+            }
+        }
+        munmap(address, sizeof(MetricsSegment));
+    }
+
+    std::ostringstream text;
+    text << errors.str();
+    for (const auto& base : order) {
+        const auto& family = families[base];
+        const char* type = family.type == MetricType::Counter ? "counter"
+            : family.type == MetricType::Gauge ? "gauge" : "histogram";
+        text << "# HELP " << base << " " << family.help << "\n"
+             << "# TYPE " << base << " " << type << "\n"
+             << family.samples.str();
+    }
+    return text.str();
+}
@@ -0,0 +1,194 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+static const std::size_t MetricNameSize = 128;
+static const std::size_t MetricHelpSize = 128;
+static const std::size_t MetricBuckets = 12;
+static const std::size_t MaxMetrics = 48;
+
+/** The types of metrics.
+ */
+enum class MetricType : uint32_t {
+    Counter,
+    Gauge,
+    Histogram
+};
+
+/** A metric in shared memory. Each metric has exactly one writing thread,
+ *  readers in other processes see its values without locking.
+ */
+struct MetricSlot {
+    char name[MetricNameSize];                      /**< The name, optionally with Prometheus labels.   */
+    char help[MetricHelpSize];                      /**< The description.                               */
+    MetricType type;                                /**< The type.                                      */
+    double bounds[MetricBuckets];                   /**< The upper bounds of the histogram buckets.     */
+    std::atomic<double> value;                      /**< The counter or gauge value, the histogram sum. */
+    std::atomic<uint64_t> count;                    /**< The number of histogram observations.          */
+    std::atomic<uint64_t> buckets[MetricBuckets + 1];  /**< The observations per bucket, the last one unbounded. */
+};
+
+/** The layout of a metrics segment.
+ */
+struct MetricsSegment {
+    uint32_t magic;                                 /**< Identifies a metrics segment.                  */
+    uint32_t version;                               /**< The version of the layout.                     */
+    int32_t pid;                                    /**< The process owning the segment.                */
+    std::atomic<uint32_t> count;                    /**< The number of published slots.                 */
+    MetricSlot slots[MaxMetrics];                   /**< The metrics.                                   */
+};
+
+/** A counter. A default constructed counter does nothing.
+ */
+class MetricCounter {
+public:
+    MetricCounter() : slot_(nullptr) {}
+    explicit MetricCounter(MetricSlot* slot) : slot_(slot) {}
+
+    /** Adds to the counter.
+     *
+     *  \param n the amount to add.
+     */
+    void add(double n = 1) const {
+        if (slot_) {
+            slot_->value.store(slot_->value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    MetricSlot* slot_;  /**< The slot in shared memory. */
+};
+
+/** A gauge. A default constructed gauge does nothing.
+ */
+class MetricGauge {
+public:
+    MetricGauge() : slot_(nullptr) {}
+    explicit MetricGauge(MetricSlot* slot) : slot_(slot) {}
+
+    /** Sets the gauge.
+     *
+     *  \param value the new value.
+     */
+    void set(double value) const {
+        if (slot_) {
+            slot_->value.store(value, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    MetricSlot* slot_;  /**< The slot in shared memory. */
+};
+
+/** A histogram. A default constructed histogram does nothing.
+ */
+class MetricHistogram {
+public:
+    MetricHistogram() : slot_(nullptr) {}
+    explicit MetricHistogram(MetricSlot* slot) : slot_(slot) {}
+
+    /** Adds an observation.
+     *
+     *  \param value the observed value.
+     */
+    void observe(double value) const {
+        if (!slot_) {
+            return;
+        }
+        std::size_t bucket = 0;
+        while (bucket < MetricBuckets && value > slot_->bounds[bucket]) {
+            ++bucket;
+        }
+        slot_->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        slot_->value.store(slot_->value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        slot_->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    MetricSlot* slot_;  /**< The slot in shared memory. */
+};
+
+/** A shared-memory segment the metrics of a process are published to. The
+ *  segment is named /streaming-<name> and removed when the object is destroyed.
+ *  Metrics are registered during setup, before the threads updating them start.
+ *  Registering a metric again returns the existing one.
+ */
+class Metrics {
+public:
+    /** Constructor. Throws a std::runtime_error if the segment cannot be created.
+     *
+     *  \param name the name of the segment without prefix.
+     */
+    explicit Metrics(const std::string& name);
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator =(const Metrics&) = delete;
+
+    /** Destructor.
+     */
+    ~Metrics();
+
+    /** Registers a counter.
+     *
+     *  \param name the name of the metric.
+     *  \param help the description of the metric.
+     */
+    MetricCounter counter(const std::string& name, const std::string& help);
+
+    /** Registers a gauge.
+     *
+     *  \param name the name of the metric.
+     *  \param help the description of the metric.
+     */
+    MetricGauge gauge(const std::string& name, const std::string& help);
+
+    /** Registers a histogram with exponentially growing buckets.
+     *
+     *  \param name the name of the metric.
+     *  \param help the description of the metric.
+     *  \param first the upper bound of the first bucket.
+     *  \param factor the ratio between the upper bounds of adjacent buckets.
+     */
+    MetricHistogram histogram(const std::string& name, const std::string& help, double first, double factor);
+
+private:
+    /** Returns the registered slot with the given name and type or nullptr.
+     */
+    MetricSlot* find(const std::string& name, MetricType type);
+
+    /** Allocates and initializes a slot, throws a std::runtime_error if the
+     *  segment is full or the name does not fit into a slot.
+     */
+    MetricSlot* add(const std::string& name, const std::string& help, MetricType type);
+
+    const std::string path_;        /**< The name of the shared-memory object.  */
+    MetricsSegment* segment_;       /**< The mapped segment.                    */
+};
+
+/** Returns a text escaped for use as a Prometheus label value.
+ *
+ *  \param value the text.
+ */
+std::string escape_label(const std::string& value);
+
+/** Returns the names of the metrics segments of running processes.
+ */
+std::vector<std::string> list_metrics();
+
+/** Formats metrics segments in the Prometheus text exposition format. Every
+ *  sample carries an instance label with the name of its segment. Segments
+ *  that cannot be opened are reported in a comment.
+ *
+ *  \param names the names of the segments without prefix.
+ */
+std::string format_metrics(const std::vector<std::string>& names);
+
+#endif  // __METRICS_H
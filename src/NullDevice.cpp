@@ -0,0 +1,256 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "NullDevice.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+/** Returns the current monotonic time in nanoseconds.
+ */
+static int64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+NullDevice::NullDevice(const std::string& path, Direction direction, unsigned int sampleRate,
+    unsigned int periodSize, unsigned int periods, unsigned int channels, double drift)
+: path_(path)
+, direction_(direction)
+, periodSize_(periodSize)
+, channels_(channels)
+, bufferSize_(periodSize * periods)
+, rate_(sampleRate * (1.0 + drift * 0.000001))
+, buffer_()
+, timer_(-1)
+, file_(-1)
+, state_(State::Other)
+, startTime_(0)
+, hardwareStart_(0)
+, application_(0) {
+}
+
+NullDevice::~NullDevice() {
+    close();
+}
+
+void NullDevice::open() {
+    close();
+
+    buffer_.assign(bufferSize_ * channels_, 0);
+
+    timer_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_ < 0) {
+        throw std::runtime_error(std::string("Failed to create timer: ") + strerror(errno));
+    }
+
+    if (!path_.empty()) {
+        if (direction_ == Direction::Playback) {
+            file_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        } else {
+            file_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (file_ < 0) {
+            const std::string error = strerror(errno);
+            close();
+            throw std::runtime_error("Failed to open " + path_ + ": " + error);
+        }
+    }
+
+    state_ = State::Prepared;
+    hardwareStart_ = 0;
+    application_ = 0;
+
+    std::cout << "Headless " << (direction_ == Direction::Playback ? "playback" : "capture")
+              << " device" << (path_.empty() ? "" : " on " + path_) << ", " << rate_ << " Hz, "
+              << periodSize_ << " frames per period, "
+              << bufferSize_ / periodSize_ << " periods, " << channels_ << " channels\n";
+}
+
+void NullDevice::close() {
+    if (timer_ >= 0) {
+        ::close(timer_);
+        timer_ = -1;
+    }
+    if (file_ >= 0) {
+        ::close(file_);
+        file_ = -1;
+    }
+    state_ = State::Other;
+}
+
+uint64_t NullDevice::hardwarePosition() const {
+    if (state_ != State::Running) {
+        return hardwareStart_;
+    }
+    // The small offset keeps rounding errors from delaying a period boundary
+    // reported by the timer to the next expiration.
+    const double elapsed = (monotonic_ns() - startTime_) * 0.000000001;
+    return hardwareStart_ + static_cast<uint64_t>(elapsed * rate_ + 0.000001);
+}
+
+AudioDevice::State NullDevice::state() {
+    if (state_ == State::Running) {
+        avail();
+    }
+    return state_;
+}
+
+long NullDevice::avail() {
+    if (state_ == State::Xrun) {
+        return -EPIPE;
+    }
+    const auto hardware = hardwarePosition();
+    if (direction_ == Direction::Playback) {
+        if (state_ == State::Running && hardware > application_) {
+            state_ = State::Xrun;
+            return -EPIPE;
+        }
+        return static_cast<long>(bufferSize_ - (application_ - hardware));
+    }
+    const auto available = hardware - application_;
+    if (available > bufferSize_) {
+        state_ = State::Xrun;
+        return -EPIPE;
+    }
+    return static_cast<long>(available);
+}
+
+int NullDevice::start() {
+    if (state_ != State::Prepared) {
+        return -EBADFD;
+    }
+    const int64_t period = static_cast<int64_t>(periodSize_ * 1000000000.0 / rate_);
+    startTime_ = monotonic_ns();
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period / 1000000000LL;
+    spec.it_interval.tv_nsec = period % 1000000000LL;
+    spec.it_value.tv_sec = (startTime_ + period) / 1000000000LL;
+    spec.it_value.tv_nsec = (startTime_ + period) % 1000000000LL;
+    if (timerfd_settime(timer_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+        return -errno;
+    }
+    state_ = State::Running;
+    return 0;
+}
+
+int NullDevice::wait(int timeout) {
+    while (true) {
+        const long available = avail();
+        if (available < 0) {
+            return static_cast<int>(available);
+        }
+        if (available >= static_cast<long>(periodSize_)) {
+            return 1;
+        }
+        if (state_ != State::Running) {
+            return -EBADFD;
+        }
+        struct pollfd fd;
+        fd.fd = timer_;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        const int result = poll(&fd, 1, timeout);
+        if (result < 0) {
+            return errno == EINTR ? 0 : -errno;
+        } else if (result == 0) {
+            return 0;
+        }
+        uint64_t expirations = 0;
+        if (read(timer_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            return -errno;
+        }
+    }
+}
+
+void NullDevice::pollDescriptors(std::vector<struct pollfd>& fds) {
+    struct pollfd fd;
+    fd.fd = timer_;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    fds.push_back(fd);
+}
+
+int NullDevice::pollEvents(struct pollfd* fds, unsigned int count) {
+    if (count == 0 || (fds[0].revents & POLLIN) == 0) {
+        return 0;
+    }
+    uint64_t expirations = 0;
+    if (read(timer_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return -errno;
+    }
+    return direction_ == Direction::Playback ? POLLOUT : POLLIN;
+}
+
+int NullDevice::begin(int16_t*& area, unsigned long& offset, unsigned long& frames) {
+    const long available = avail();
+    if (available < 0) {
+        return static_cast<int>(available);
+    }
+    offset = static_cast<unsigned long>(application_ % bufferSize_);
+    frames = std::min(frames, std::min(static_cast<unsigned long>(available), bufferSize_ - offset));
+    area = buffer_.data() + offset * channels_;
+    if (direction_ == Direction::Capture && file_ >= 0) {
+        readFile(area, frames);
+    }
+    return 0;
+}
+
+long NullDevice::commit(unsigned long offset, unsigned long frames) {
+    if (direction_ == Direction::Playback && file_ >= 0) {
+        const auto bytes = frames * channels_ * sizeof(int16_t);
+        if (write(file_, buffer_.data() + offset * channels_, bytes) != static_cast<ssize_t>(bytes)) {
+            return -EIO;
+        }
+    }
+    application_ += frames;
+    return static_cast<long>(frames);
+}
+
+int NullDevice::recover(int err) {
+    if (err == -EINTR) {
+        return 0;
+    }
+    if (err != -EPIPE && err != -ESTRPIPE) {
+        return err;
+    }
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    timerfd_settime(timer_, 0, &spec, nullptr);
+    hardwareStart_ = application_;
+    state_ = State::Prepared;
+    return 0;
+}
+
+const char* NullDevice::errorString(int err) const {
+    return strerror(-err);
+}
+
+void NullDevice::readFile(int16_t* data, unsigned long frames) {
+    auto bytes = frames * channels_ * sizeof(int16_t);
+    auto out = reinterpret_cast<uint8_t*>(data);
+    bool rewound = false;
+    while (bytes > 0) {
+        const auto n = read(file_, out, bytes);
+        if (n > 0) {
+            out += n;
+            bytes -= static_cast<std::size_t>(n);
+            rewound = false;
+        } else if (n == 0 && !rewound) {
+            lseek(file_, 0, SEEK_SET);
+            rewound = true;
+        } else {
+            memset(out, 0, bytes);
+            break;
+        }
+    }
+}
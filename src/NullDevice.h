@@ -0,0 +1,84 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __NULLDEVICE_H
+#define __NULLDEVICE_H
+
+#include "AudioDevice.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/** A headless audio device without hardware. The hardware pointer advances
+ *  with the monotonic clock at the nominal sample rate, optionally detuned by
+ *  a drift in ppm to emulate the clock deviation of a real sound card. Waiting
+ *  is implemented with a timerfd that expires once per period.
+ *
+ *  Without a file the device discards playback and captures silence. With a
+ *  file it writes playback to and reads capture from raw interleaved S16_LE
+ *  data; capture restarts at the beginning of the file at its end.
+ */
+class NullDevice : public AudioDevice {
+public:
+    /** Constructor
+     *
+     *  \param path the path of the file, empty for no file.
+     *  \param direction the transfer direction.
+     *  \param sampleRate the nominal sample rate.
+     *  \param periodSize the period size in frames.
+     *  \param periods the number of periods in the device buffer.
+     *  \param channels the number of channels per frame.
+     *  \param drift the deviation from the nominal sample rate in ppm.
+     */
+    NullDevice(const std::string& path, Direction direction, unsigned int sampleRate,
+        unsigned int periodSize, unsigned int periods, unsigned int channels, double drift);
+
+    NullDevice(const NullDevice&) = delete;
+    NullDevice& operator =(const NullDevice&) = delete;
+
+    /** Destructor.
+     */
+    ~NullDevice();
+
+    void open() override;
+    void close() override;
+    State state() override;
+    long avail() override;
+    int start() override;
+    int wait(int timeout) override;
+    void pollDescriptors(std::vector<struct pollfd>& fds) override;
+    int pollEvents(struct pollfd* fds, unsigned int count) override;
+    int begin(int16_t*& area, unsigned long& offset, unsigned long& frames) override;
+    long commit(unsigned long offset, unsigned long frames) override;
+    int recover(int err) override;
+    const char* errorString(int err) const override;
+
+private:
+    /** Returns the position of the emulated hardware in frames.
+     */
+    uint64_t hardwarePosition() const;
+
+    /** Reads frames from the file into the device buffer.
+     *
+     *  \param data the destination.
+     *  \param frames the number of frames.
+     */
+    void readFile(int16_t* data, unsigned long frames);
+
+    const std::string path_;            /**< The path of the file.                      */
+    const Direction direction_;         /**< The transfer direction.                    */
+    const unsigned int periodSize_;     /**< The period size in frames.                 */
+    const unsigned int channels_;       /**< The number of channels per frame.          */
+    const unsigned int bufferSize_;     /**< The size of the device buffer in frames.   */
+    const double rate_;                 /**< The effective sample rate.                 */
+    std::vector<int16_t> buffer_;       /**< The device buffer.                         */
+    int timer_;                         /**< The timerfd expiring once per period.      */
+    int file_;                          /**< The file descriptor of the file.           */
+    State state_;                       /**< The current state.                         */
+    int64_t startTime_;                 /**< The monotonic time of start() in ns.       */
+    uint64_t hardwareStart_;            /**< The hardware position at start().          */
+    uint64_t application_;              /**< The application position in frames.        */
+};
+
+#endif  // __NULLDEVICE_H
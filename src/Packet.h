@@ -6,14 +6,27 @@
 
 #include <cstdint>
 #include <arpa/inet.h>
+#include <endian.h>
 
-/** The header of the packet.
+/** The header of the packet. All fields are in network byte order.
  */
 struct PacketHeader {
-    uint32_t timestamp;
+    uint8_t version;        /**< The version of the header layout.                           */
+    uint8_t periods;        /**< The number of consecutive periods in the payload.           */
+    uint16_t streamId;      /**< The ID of the stream chosen by the sender.                  */
+    uint32_t epoch;         /**< The start time of the stream in seconds since the Unix epoch. */
+    uint64_t timestamp;     /**< The media timestamp of the first frame in samples since the Unix epoch. */
+    uint32_t sampleRate;    /**< The sample rate of the stream.                              */
+    uint16_t periodSize;    /**< The number of frames per period.                            */
+    uint8_t channels;       /**< The number of channels per frame.                           */
+    uint8_t format;         /**< The sample format of the payload, e.g. Packet::formatS16LE. */
 } __attribute__((packed));
 
-/** A packet used to send unencoded audio data.
+/** A packet used to send unencoded audio data. A packet carries one or more
+ *  consecutive periods of a stream, the timestamp of a period is the
+ *  timestamp of the packet plus the frames of the periods before it. The
+ *  header describes the format of the payload, so a receiver configured for
+ *  another format can reject the packet instead of misinterpreting it.
  */
 struct Packet {
     /** Constructor
@@ -25,13 +38,41 @@ struct Packet {
     , packetSize_(dataSize_ + headerSize)
     , packet_(new uint8_t [packetSize_])
     , data_(packet_ + headerSize)
-    , header_(reinterpret_cast<PacketHeader*>(packet_)) {
+    , header_(reinterpret_cast<PacketHeader*>(packet_))
+    , length_(packetSize_)
+    , owned_(true) {
+        header_->version = version;
+        header_->periods = 1;
+        header_->streamId = 0;
+        header_->epoch = 0;
+        header_->timestamp = 0;
+        header_->sampleRate = 0;
+        header_->periodSize = 0;
+        header_->channels = 0;
+        header_->format = formatS16LE;
+    }
+
+    /** Constructor of a packet referring to received bytes it does not own.
+     *
+     *  \param packet the packet.
+     *  \param packetSize the size of the packet in bytes, at least headerSize.
+     */
+    Packet(uint8_t* packet, uint32_t packetSize)
+    : dataSize_(packetSize - headerSize)
+    , packetSize_(packetSize)
+    , packet_(packet)
+    , data_(packet_ + headerSize)
+    , header_(reinterpret_cast<PacketHeader*>(packet_))
+    , length_(packetSize_)
+    , owned_(false) {
     }
 
     /** Destructor
      */
     ~Packet() {
-        delete [] packet_;
+        if (owned_) {
+            delete [] packet_;
+        }
     }
 
     Packet(const Packet&) = delete;
@@ -41,22 +82,109 @@ struct Packet {
      *
      *  \param timestamp the timestamp to set.
      */
-    void setTimestamp(uint32_t timestamp) {
-        header_->timestamp = htonl(timestamp);
+    void setTimestamp(uint64_t timestamp) {
+        header_->timestamp = htobe64(timestamp);
     }
 
     /** Returns the timestamp.
      */
-    uint32_t getTimestamp() {
-        return ntohl(header_->timestamp);
+    uint64_t getTimestamp() const {
+        return be64toh(header_->timestamp);
+    }
+
+    /** Sets the stream identification.
+     *
+     *  \param streamId the ID of the stream.
+     *  \param epoch the start time of the stream in seconds since the Unix epoch.
+     */
+    void setStream(uint16_t streamId, uint32_t epoch) {
+        header_->streamId = htons(streamId);
+        header_->epoch = htonl(epoch);
+    }
+
+    /** Returns the ID of the stream.
+     */
+    uint16_t getStreamId() const {
+        return ntohs(header_->streamId);
+    }
+
+    /** Returns the start time of the stream in seconds since the Unix epoch.
+     */
+    uint32_t getEpoch() const {
+        return ntohl(header_->epoch);
+    }
+
+    /** Sets the format of the payload.
+     *
+     *  \param sampleRate the sample rate.
+     *  \param periodSize the number of frames per period.
+     *  \param channels the number of channels per frame.
+     */
+    void setFormat(uint32_t sampleRate, uint16_t periodSize, uint8_t channels) {
+        header_->sampleRate = htonl(sampleRate);
+        header_->periodSize = htons(periodSize);
+        header_->channels = channels;
+        header_->format = formatS16LE;
+    }
+
+    /** Returns the sample rate.
+     */
+    uint32_t getSampleRate() const {
+        return ntohl(header_->sampleRate);
+    }
+
+    /** Returns the number of frames per period.
+     */
+    unsigned int getPeriodSize() const {
+        return ntohs(header_->periodSize);
+    }
+
+    /** Returns the number of channels per frame.
+     */
+    unsigned int getChannels() const {
+        return header_->channels;
+    }
+
+    /** Returns the sample format of the payload.
+     */
+    uint8_t getFormat() const {
+        return header_->format;
+    }
+
+    /** Sets the number of periods in the payload and the number of bytes to send.
+     *
+     *  \param periods the number of periods.
+     *  \param periodBytes the size of a period in bytes.
+     */
+    void setPeriods(unsigned int periods, uint32_t periodBytes) {
+        header_->periods = static_cast<uint8_t>(periods);
+        length_ = headerSize + periods * periodBytes;
+    }
+
+    /** Returns the number of periods in the payload.
+     */
+    unsigned int getPeriods() const {
+        return header_->periods;
+    }
+
+    /** Returns true if the header has a known version.
+     */
+    bool isValid() const {
+        return header_->version == version;
     }
 
-    static const uint32_t headerSize = 4;       /**< The header size in bytes.                  */
+    static const uint8_t version = 3;           /**< The version of the header layout.          */
+    static const uint8_t formatS16LE = 1;       /**< Interleaved signed 16 bit little-endian samples. */
+    static const unsigned int maxPeriods = 32;  /**< The largest number of periods in a packet. */
+    static const unsigned int maxChannels = 255;    /**< The largest number of channels of a stream. */
+    static const uint32_t headerSize = sizeof(PacketHeader);    /**< The header size in bytes.  */
     const uint32_t dataSize_;                   /**< The size of the data payload in bytes.     */
     const uint32_t packetSize_;                 /**< The total packet size in bytes.            */
     uint8_t* packet_;                           /**< A pointer to the packet.                   */
     uint8_t* data_;                             /**< A pointer to the data payload.             */
     PacketHeader* header_;                      /**< A pointer to the packet header.            */
+    uint32_t length_;                           /**< The number of bytes to send.               */
+    const bool owned_;                          /**< True if the packet owns its bytes.         */
 };
 
 #endif  // __PACKET_H
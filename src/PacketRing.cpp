@@ -0,0 +1,321 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "PacketRing.h"
+#include "Packet.h"
+#include "Utils.h"
+#include "Log.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+static const unsigned int BlockSize = 1 << 16;      // bytes per block, holds the largest datagram
+static const unsigned int BlockCount = 64;          // blocks in the ring
+static const unsigned int FrameSize = 2048;         // nominal frame size, TPACKET_V3 packs packets tightly
+static const unsigned int BlockTimeout = 1;         // ms until a partially filled block is handed over
+static const std::size_t MaxPorts = 200;            // ports the filter can match with 8-bit jumps
+
+PacketRing::PacketRing(const std::string& interface)
+: interface_(interface)
+, ifindex_(0)
+, handlers_()
+, groups_()
+, settings_()
+, socket_(-1)
+, wakeup_(-1)
+, sinks_()
+, ring_(nullptr)
+, ringSize_(0)
+, thread_()
+, running_(false)
+, packets_()
+, unmatched_()
+, drops_() {
+}
+
+PacketRing::~PacketRing() {
+    stop();
+}
+
+uint64_t PacketRing::key(uint32_t address, unsigned short port, uint16_t streamId) {
+    return (static_cast<uint64_t>(address) << 32) | (static_cast<uint64_t>(port) << 16) | streamId;
+}
+
+void PacketRing::subscribe(const std::string& address, unsigned short port, uint16_t streamId,
+    const Handler& handler) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, address.c_str(), &addr) != 1) {
+        throw std::runtime_error("Invalid stream address " + address);
+    }
+    handlers_[key(addr.s_addr, port, streamId)] = handler;
+    groups_[port].insert(addr.s_addr);
+}
+
+void PacketRing::setThreadSettings(const ThreadSettings& settings) {
+    settings_ = settings;
+}
+
+void PacketRing::setMetrics(Metrics& metrics) {
+    packets_ = metrics.counter("packet_ring_packets_total", "Datagrams handed to a stream by the packet ring.");
+    unmatched_ = metrics.counter("packet_ring_unmatched_total", "Datagrams on a subscribed port without a subscribed stream.");
+    drops_ = metrics.counter("packet_ring_drops_total", "Datagrams dropped by the kernel because the packet ring was full.");
+}
+
+void PacketRing::start() {
+    stop();
+    if (handlers_.empty()) {
+        throw std::runtime_error("No streams subscribed on the packet ring");
+    }
+    if (groups_.size() > MaxPorts) {
+        throw std::runtime_error("Too many ports subscribed on the packet ring");
+    }
+    ifindex_ = static_cast<int>(if_nametoindex(interface_.c_str()));
+    if (ifindex_ == 0) {
+        throw std::runtime_error("Unknown network interface " + interface_);
+    }
+
+    try {
+        openSinks();
+        open();
+    } catch (...) {
+        close();
+        throw;
+    }
+
+    running_ = true;
+    thread_.reset(new std::thread([this] () {
+        applyThreadSettings("ring", settings_);
+        run();
+    }));
+}
+
+void PacketRing::stop() {
+    running_ = false;
+    if (thread_ && thread_->joinable()) {
+        const uint64_t value = 1;
+        if (write(wakeup_, &value, sizeof(value)) < 0) {
+            std::cerr << "Failed to wake up packet ring: " << strerror(errno) << "\n";
+        }
+        thread_->join();
+    }
+    thread_.reset();
+    close();
+}
+
+void PacketRing::open() {
+    wakeup_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    // The socket receives nothing until it is bound with a protocol, so no
+    // packet bypasses the filter.
+    socket_ = ::socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_ < 0 || wakeup_ < 0) {
+        throw std::runtime_error(std::string("Failed to open packet socket (requires CAP_NET_RAW): ") + strerror(errno));
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(socket_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+        throw std::runtime_error(std::string("Failed to select TPACKET_V3: ") + strerror(errno));
+    }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = BlockSize;
+    req.tp_block_nr = BlockCount;
+    req.tp_frame_size = FrameSize;
+    req.tp_frame_nr = BlockSize / FrameSize * BlockCount;
+    req.tp_retire_blk_tov = BlockTimeout;
+    if (setsockopt(socket_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+        throw std::runtime_error(std::string("Failed to set up packet ring: ") + strerror(errno));
+    }
+    ringSize_ = static_cast<std::size_t>(BlockSize) * BlockCount;
+    void* ring = mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, socket_, 0);
+    if (ring == MAP_FAILED) {
+        ringSize_ = 0;
+        throw std::runtime_error(std::string("Failed to map packet ring: ") + strerror(errno));
+    }
+    ring_ = static_cast<uint8_t*>(ring);
+
+    // Accepts unfragmented UDP datagrams to the subscribed ports. The packet
+    // starts with the IP header on a SOCK_DGRAM packet socket.
+    const auto ports = static_cast<uint8_t>(groups_.size());
+    const uint8_t drop = static_cast<uint8_t>(6 + ports);
+    std::vector<struct sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9));
+    code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, static_cast<uint8_t>(drop - 2)));
+    code.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6));
+    code.push_back(BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, static_cast<uint8_t>(drop - 4), 0));
+    code.push_back(BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0));
+    code.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2));
+    uint8_t remaining = ports;
+    for (const auto& group : groups_) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, group.first, remaining, 0));
+        remaining -= 1;
+    }
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0x40000));
+    struct sock_fprog program;
+    program.len = static_cast<unsigned short>(code.size());
+    program.filter = code.data();
+    if (setsockopt(socket_, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0) {
+        throw std::runtime_error(std::string("Failed to attach packet filter: ") + strerror(errno));
+    }
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = ifindex_;
+    if (bind(socket_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw std::runtime_error("Failed to bind packet socket to " + interface_ + ": " + strerror(errno));
+    }
+}
+
+void PacketRing::openSinks() {
+    struct sock_filter dropAll = BPF_STMT(BPF_RET | BPF_K, 0);
+    struct sock_fprog program;
+    program.len = 1;
+    program.filter = &dropAll;
+
+    for (const auto& group : groups_) {
+        const int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("Failed to open socket: ") + strerror(errno));
+        }
+        sinks_.push_back(fd);
+
+        int enable = 1;
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(group.first);
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) != 0
+            || setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0
+            || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("Failed to bind port " + std::to_string(group.first) + ": " + strerror(errno));
+        }
+
+        for (const auto address : group.second) {
+            if (!IN_MULTICAST(ntohl(address))) {
+                continue;
+            }
+            struct ip_mreqn mreq;
+            memset(&mreq, 0, sizeof(mreq));
+            mreq.imr_multiaddr.s_addr = address;
+            mreq.imr_ifindex = ifindex_;
+            if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+                throw std::runtime_error("Failed to join multicast group on " + interface_ + ": " + strerror(errno));
+            }
+        }
+    }
+}
+
+void PacketRing::close() {
+    if (ring_) {
+        munmap(ring_, ringSize_);
+        ring_ = nullptr;
+        ringSize_ = 0;
+    }
+    if (socket_ >= 0) {
+        ::close(socket_);
+        socket_ = -1;
+    }
+    if (wakeup_ >= 0) {
+        ::close(wakeup_);
+        wakeup_ = -1;
+    }
+    for (const auto fd : sinks_) {
+        ::close(fd);
+    }
+    sinks_.clear();
+}
+
+void PacketRing::run() {
+    struct pollfd fds[2];
+    fds[0].fd = socket_;
+    fds[0].events = POLLIN | POLLERR;
+    fds[1].fd = wakeup_;
+    fds[1].events = POLLIN;
+
+    unsigned int index = 0;
+    while (running_) {
+        auto block = ring_ + static_cast<std::size_t>(index) * BlockSize;
+        auto desc = reinterpret_cast<struct tpacket_block_desc*>(block);
+        if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            fds[0].revents = 0;
+            fds[1].revents = 0;
+            if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+                log_error("Failed to poll packet ring: {}", LogErrno{errno});
+                break;
+            }
+            continue;
+        }
+        processBlock(block);
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        index = (index + 1) % BlockCount;
+    }
+}
+
+void PacketRing::processBlock(uint8_t* block) {
+    const auto desc = reinterpret_cast<const struct tpacket_block_desc*>(block);
+    if (desc->hdr.bh1.block_status & TP_STATUS_LOSING) {
+        // Reading the statistics resets them.
+        struct tpacket_stats_v3 stats;
+        socklen_t length = sizeof(stats);
+        if (getsockopt(socket_, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == 0) {
+            drops_.add(stats.tp_drops);
+        }
+    }
+
+    const auto origin = time_origin();
+    auto frame = block + desc->hdr.bh1.offset_to_first_pkt;
+    for (uint32_t i = 0; i < desc->hdr.bh1.num_pkts; ++i) {
+        const auto header = reinterpret_cast<const struct tpacket3_hdr*>(frame);
+        const auto link = reinterpret_cast<const struct sockaddr_ll*>(frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        uint8_t* packet = frame + header->tp_net;
+        const std::size_t size = header->tp_snaplen;
+        frame += header->tp_next_offset;
+
+        // On the loopback interface each packet is seen leaving and arriving.
+        if (link->sll_pkttype == PACKET_OUTGOING) {
+            continue;
+        }
+        const auto ip = reinterpret_cast<const struct iphdr*>(packet);
+        const std::size_t ipSize = ip->ihl * 4u;
+        if (size < sizeof(struct iphdr) || size < ipSize + sizeof(struct udphdr)) {
+            unmatched_.add();
+            continue;
+        }
+        const auto udp = reinterpret_cast<const struct udphdr*>(packet + ipSize);
+        const std::size_t udpSize = ntohs(udp->len);
+        if (udpSize < sizeof(struct udphdr) + Packet::headerSize || ipSize + udpSize > size) {
+            unmatched_.add();
+            continue;
+        }
+        uint8_t* payload = packet + ipSize + sizeof(struct udphdr);
+        const auto streamId = ntohs(reinterpret_cast<const PacketHeader*>(payload)->streamId);
+        const auto handler = handlers_.find(key(ip->daddr, ntohs(udp->dest), streamId));
+        if (handler == handlers_.end()) {
+            unmatched_.add();
+            continue;
+        }
+        const double arrival = static_cast<double>(static_cast<int64_t>(header->tp_sec - origin))
+            + header->tp_nsec * 0.000000001;
+        packets_.add();
+        handler->second(payload, udpSize - sizeof(struct udphdr), arrival);
+    }
+}
@@ -0,0 +1,133 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __PACKETRING_H
+#define __PACKETRING_H
+
+#include "Realtime.h"
+#include "Metrics.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/** Receives the packets of many streams through one memory-mapped TPACKET_V3
+ *  ring of an AF_PACKET socket. The kernel fills whole blocks of the ring
+ *  with the UDP datagrams accepted by a BPF filter on the subscribed ports,
+ *  and a single thread walks each block and hands the payloads to the
+ *  handlers of the streams in place, without a copy and without a system
+ *  call per packet.
+ *
+ *  The kernel hands a block over when it is full or after the block timeout
+ *  of one millisecond, which adds up to one millisecond of latency. The
+ *  arrival time passed to the handlers is the kernel timestamp of the
+ *  packet, so the delay of the block does not show up as arrival jitter.
+ *
+ *  Opening an AF_PACKET socket requires CAP_NET_RAW.
+ */
+class PacketRing {
+public:
+    /** The function called with the payload of a datagram of a stream, its
+     *  size in bytes and its arrival time as returned by get_time(). The
+     *  payload is valid during the call only.
+     */
+    typedef std::function<void (uint8_t*, std::size_t, double)> Handler;
+
+    /** Constructor
+     *
+     *  \param interface the name of the network interface to receive from.
+     */
+    explicit PacketRing(const std::string& interface);
+
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator =(const PacketRing&) = delete;
+
+    /** Destructor.
+     */
+    ~PacketRing();
+
+    /** Subscribes to a stream. Must be called before start().
+     *
+     *  \param address the destination address of the stream, a multicast group is joined.
+     *  \param port the destination UDP port of the stream.
+     *  \param streamId the ID of the stream in the packet header.
+     *  \param handler the function called with each packet of the stream.
+     */
+    void subscribe(const std::string& address, unsigned short port, uint16_t streamId, const Handler& handler);
+
+    /** Opens the ring and starts the thread. Throws a std::runtime_error if
+     *  the socket or the ring cannot be set up.
+     */
+    void start();
+
+    /** Stops the thread and closes the ring.
+     */
+    void stop();
+
+    /** Sets the scheduling settings of the thread. Takes effect with the next start().
+     *
+     *  \param settings the scheduling settings.
+     */
+    void setThreadSettings(const ThreadSettings& settings);
+
+    /** Registers the metrics of the ring. Must be called before start().
+     *
+     *  \param metrics the metrics segment.
+     */
+    void setMetrics(Metrics& metrics);
+
+private:
+    /** Opens the packet socket, attaches the filter and maps the ring.
+     */
+    void open();
+
+    /** Opens a socket on each subscribed port that joins the multicast
+     *  groups and drops all datagrams, so the kernel neither answers with
+     *  ICMP port unreachable nor queues a copy of the packets.
+     */
+    void openSinks();
+
+    /** Closes all sockets and unmaps the ring.
+     */
+    void close();
+
+    /** Runs the receive loop.
+     */
+    void run();
+
+    /** Dispatches the packets of a block to the handlers.
+     *
+     *  \param block the block descriptor.
+     */
+    void processBlock(uint8_t* block);
+
+    /** Returns the key of a stream in the subscriptions.
+     */
+    static uint64_t key(uint32_t address, unsigned short port, uint16_t streamId);
+
+    const std::string interface_;                   /**< The name of the network interface.         */
+    int ifindex_;                                   /**< The index of the network interface.        */
+    std::unordered_map<uint64_t, Handler> handlers_;    /**< The handlers by address, port and stream.  */
+    std::map<unsigned short, std::set<uint32_t>> groups_;   /**< The addresses subscribed per port.     */
+    ThreadSettings settings_;                       /**< The scheduling settings of the thread.     */
+    int socket_;                                    /**< The AF_PACKET socket.                      */
+    int wakeup_;                                    /**< The eventfd used to interrupt the loop.    */
+    std::vector<int> sinks_;                        /**< The sockets holding the ports and groups.  */
+    uint8_t* ring_;                                 /**< The mapped ring.                           */
+    std::size_t ringSize_;                          /**< The size of the mapping.                   */
+    std::unique_ptr<std::thread> thread_;           /**< The receive thread.                        */
+    std::atomic<bool> running_;                     /**< False to stop the loop.                    */
+    MetricCounter packets_;                         /**< The datagrams handed to a stream.          */
+    MetricCounter unmatched_;                       /**< The datagrams without a subscribed stream. */
+    MetricCounter drops_;                           /**< The datagrams dropped by a full ring.      */
+};
+
+#endif  // __PACKETRING_H
@@ -2,40 +2,96 @@
 // Distributed under the BSD license.
 
 #include "Player.h"
+#include "AudioDevice.h"
 #include "CircularBuffer.h"
+#include "TimeInfo.h"
 #include "Utils.h"
 #include "DelayLockedLoop.h"
+#include "Log.h"
+#include "Trace.h"
 
-#include <iostream>
 #include <fstream>
 #include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
 
-Player::Player(const std::string& deviceName, unsigned int sampleRate, unsigned int periodTime, 
+Player::Player(AudioDevice& device, unsigned int sampleRate, unsigned int periodTime,
     unsigned int channels, unsigned int latency, CircularBuffer& buffer, 
-    moodycamel::ReaderWriterQueue<double>& q, std::atomic<bool>& streaming)
-: deviceName_(deviceName)
+    SharedTimeInfo& timeInfo, std::atomic<bool>& streaming)
+: device_(device)
 , sampleRate_(sampleRate)
 , periodTime_(periodTime)
 , periodSize_(static_cast<unsigned int>(std::round(sampleRate_ * 0.000001 * periodTime_)))
 , channels_(channels)
 , latency_(latency)
+, targetLatency_(latency)
 , buffer_(buffer)
 , streaming_(streaming)
-, timeInfoQueue_(q)
-, pcm_(nullptr)
+, timeInfo_(timeInfo)
+, settings_()
 , thread_()
-, running_(false) {
+, running_(false)
+, dll_(periodTime * 0.000001)
+, first_(true)
+, prefilling_(false)
+, recovering_(false)
+, firstPeriod_(true)
+, lastSample_(0)
+, nextSample_(0)
+, framesPlayed_(0)
+, generation_(0)
+, xrunTime_(0)
+, skipped_(0)
+, scheduleMutex_()
+, nextSchedule_()
+, scheduleSequence_(0)
+, startSample_(0)
+, stopSample_(0)
+, muteFrom_(0)
+, muteUntil_(0)
+, schedule_()
+, audible_(true)
+, crossfade_(periodSize_ * channels_)
+, xruns_(0)
+, underruns_(0)
+, minHeadroom_(std::numeric_limits<int64_t>::max())
+, recoveries_(0)
+, maxRecoveryTime_(0)
+, xrunsMetric_()
+, underrunsMetric_()
+, resyncsMetric_()
+, headroomMetric_()
+, latencyMetric_()
+, processingTime_() {
 }
 
 Player::~Player() {
     stop();
+    device_.close();
+}
+
+void Player::prepare() {
+    device_.open();
+    dll_.reset(get_time());
+    first_ = true;
+    prefilling_ = false;
+    recovering_ = false;
+    firstPeriod_ = true;
+    lastSample_ = 0;
+    nextSample_ = 0;
+    framesPlayed_ = 0;
+    audible_ = true;
+    running_ = true;
 }
 
 void Player::start() {
     stop();
-    setUpAlsa();
-    running_ = true;
-    thread_.reset(new std::thread([this] () { playback(); }));    
+    prepare();
+    thread_.reset(new std::thread([this] () {
+        applyThreadSettings("playback", settings_);
+        playback();
+    }));
 }
 
 void Player::stop() {
@@ -46,295 +102,368 @@ void Player::stop() {
     thread_.reset();
 }
 
-void Player::setUpAlsa() {
-    tearDownAlsa();
-
-    int err = 0;
-    err = snd_pcm_open(&pcm_, deviceName_.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
-    if (err < 0) {
-        std::cerr << "Failed to open device: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    snd_config_update_free_global();
-
-    setHardwareParameters();
-    setSoftwareParameters();
-
-    snd_output_t* output;
-    err = snd_output_stdio_attach(&output, stdout, 0);
-    if (err < 0) {
-        std::cerr << "Failed to attach stdout: " << snd_strerror(err) << "\n";
-    }
-
-    snd_pcm_dump(pcm_, output);
+void Player::setClockRate(double rate) {
+    dll_.setRate(rate);
 }
 
-void Player::setHardwareParameters() {
-    int err = 0;
-
-    snd_pcm_hw_params_t* params = nullptr;
-    err = snd_pcm_hw_params_malloc(&params);
-    if (err < 0) {
-        std::cerr << "Failed to allocate snd_pcm_hw_params_t: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_any(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to fill hardware params with configuration space for a PCM: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_access(pcm_, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
-    if (err < 0) {
-        std::cerr << "Failed to set access type to SND_PCM_ACCESS_MMAP_INTERLEAVED: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_format(pcm_, params, SND_PCM_FORMAT_S16_LE);
-    if (err < 0) {
-        std::cerr << "Failed to set format to SND_PCM_FORMAT_S16_LE: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_rate(pcm_, params, sampleRate_, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set sample rate to " << sampleRate_ << ": " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_channels(pcm_, params, channels_);
-    if (err < 0) {
-        std::cerr << "Failed to set number of channels to " << channels_ << " : " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_period_size(pcm_, params, periodSize_, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set period size to " << periodSize_ << " : " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_periods(pcm_, params, 2, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set periods to 2: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    const auto bufferSize = periodSize_ * 2;
-    err = snd_pcm_hw_params_set_buffer_size(pcm_, params, bufferSize);
-    if (err < 0) {
-        std::cerr << "Failed to set buffer size to " << bufferSize << ": " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to install hardware configuration for PCM: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    snd_pcm_hw_params_free(params);
+double Player::clockRate() const {
+    return dll_.rate();
 }
 
+void Player::setThreadSettings(const ThreadSettings& settings) {
+    settings_ = settings;
+}
 
-void Player::setSoftwareParameters() {
-    int err = 0;
-
-    snd_pcm_sw_params_t* params = nullptr;
-    err = snd_pcm_sw_params_malloc(&params);
-    if (err < 0) {
-        std::cerr << "Failed to allocate snd_pcm_sw_params_t: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_current(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to get current software configuration: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_avail_min(pcm_, params, periodSize_);
-    if (err < 0) {
-        std::cerr << "Failed to set avail min: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    const auto bufferSize = periodSize_ * 2;
-    err = snd_pcm_sw_params_set_start_threshold(pcm_, params, (bufferSize / periodSize_) * periodSize_);
-    if (err < 0) {
-        std::cerr << "Failed to set start threshold: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_tstamp_mode(pcm_, params, SND_PCM_TSTAMP_ENABLE);
-    if (err < 0) {
-        std::cerr << "Failed to set tstamp mode to SND_PCM_TSTAMP_ENABLE: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_tstamp_type(pcm_, params, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY);
-    if (err < 0) {
-        std::cerr << "Failed to set tstamp type to SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
+Player::Statistics Player::statistics() const {
+    Statistics statistics;
+    statistics.xruns = xruns_;
+    statistics.underruns = underruns_;
+    statistics.minHeadroom = minHeadroom_;
+    statistics.recoveries = recoveries_;
+    statistics.maxRecoveryTime = maxRecoveryTime_;
+    return statistics;
+}
 
-    err = snd_pcm_sw_params(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to install software configuration for PCM: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
+void Player::resetStatistics() {
+    xruns_ = 0;
+    underruns_ = 0;
+    minHeadroom_ = std::numeric_limits<int64_t>::max();
+    recoveries_ = 0;
+    maxRecoveryTime_ = 0;
+}
 
-    snd_pcm_sw_params_free(params);
+void Player::setMetrics(Metrics& metrics) {
+    xrunsMetric_ = metrics.counter("player_xruns_total", "Buffer under-runs of the playback device.");
+    underrunsMetric_ = metrics.counter("player_underruns_total", "Reads of frames not received yet.");
+    resyncsMetric_ = metrics.counter("player_resyncs_total", "Resynchronizations after an XRUN.");
+    headroomMetric_ = metrics.gauge("player_buffer_headroom_frames", "Received frames ahead of the last read.");
+    latencyMetric_ = metrics.gauge("player_latency_periods", "Target latency of the playback.");
+    latencyMetric_.set(targetLatency_);
+    processingTime_ = metrics.histogram("player_processing_seconds", "Time spent writing a period.", 0.000001, 2);
 }
 
-void Player::tearDownAlsa() {
-    if (pcm_) {
-        int err = snd_pcm_close(pcm_);
+int Player::playback() {
+    while (running_) {
+        int err = process();
         if (err < 0) {
-            std::cerr << "Failed to close PCM: " << snd_strerror(err) << "\n";
+            return err;
+        }
+        err = device_.wait(-1);
+        if (err < 0) {
+            log_error("Failed to wait for device");
+            if ((err = recover(err)) < 0) {
+                log_error("Failed to wait for PCM: {}", device_.errorString(err));
+                return err;
+            }
+            first_ = true;
         }
-        pcm_ = nullptr;
     }
+    return 0;
 }
 
-int Player::playback() {
-    int err = 0, first = 1;
-
-    snd_pcm_status_t *status = nullptr;
-    snd_pcm_status_malloc(&status);
-
-    snd_pcm_audio_tstamp_config_t audio_tstamp_config;
-    audio_tstamp_config.type_requested = 0;
-    audio_tstamp_config.report_delay = 1;
-    snd_pcm_status_set_audio_htstamp_config(status, &audio_tstamp_config);
-
-    DelayLockedLoop dll(periodTime_ * 0.000001);
-    dll.reset(get_time());
-
-    bool firstPeriod = true;
-    uint32_t lastSample = 0, nextSample = 0;
+int Player::process() {
+    int err = 0;
 
     while (running_) {
-        auto state = snd_pcm_state(pcm_);
-        if (state == SND_PCM_STATE_XRUN) {
-            std::cerr << "XRUN\n";
+        auto state = device_.state();
+        if (state == AudioDevice::State::Xrun) {
+            log_error("XRUN");
             err = recover(-EPIPE);
             if (err < 0) {
-                std::cerr << "Failed to recover from XRUN: " << snd_strerror(err) << "\n";
+                log_error("Failed to recover from XRUN: {}", device_.errorString(err));
                 return err;
             }            
-            first = 1;
-        } else if (state == SND_PCM_STATE_SUSPENDED) {
-            std::cerr << "SUSPENDED\n";
+            first_ = true;
+        } else if (state == AudioDevice::State::Suspended) {
+            log_error("SUSPENDED");
             err = recover(-ESTRPIPE);
             if (err < 0) {
-                std::cerr << "Failed to recover from SUSPEND: " << snd_strerror(err) << "\n";
+                log_error("Failed to recover from SUSPEND: {}", device_.errorString(err));
                 return err;
             }            
         }
 
-        err = snd_pcm_status(pcm_, status);
-        if (err < 0) {
-            std::cerr << "snd_pcm_status failed\n";
-            err = recover(static_cast<int>(err));
+        const long avail = device_.avail();
+        if (avail < 0) {
+            log_error("Failed to query avail");
+            err = recover(static_cast<int>(avail));
             if (err < 0) {
-                std::cerr << "Failed to update avail: " << snd_strerror(err) << "\n";
+                log_error("Failed to update avail: {}", device_.errorString(err));
                 return err;
             }            
-            first = 1;
+            first_ = true;
             continue;
         }
-    
-        snd_pcm_sframes_t avail = snd_pcm_status_get_avail(status);
-        if (avail < static_cast<snd_pcm_sframes_t>(periodSize_)) {
-            if (first) {
-                first = 0;
-                err = snd_pcm_start(pcm_);
-                if (err < 0) {
-                    std::cerr << "Failed to start: " << snd_strerror(err) << "\n";
-                    return err;
-                }
-            } else {
-                err = snd_pcm_wait(pcm_, -1);
-                if (err < 0) {
-                    std::cerr << "snd_pcm_wait failed\n";
-                    if ((err = recover(err)) < 0) {
-                        std::cerr << "Failed to wait for PCM: " << snd_strerror(err) << "\n";
-                        return err;
-                    }                    
-                    first = 1;
-                }
+
+        if (avail < static_cast<long>(periodSize_)) {
+            if (!first_) {
+                return 0;
             }
+            first_ = false;
+            err = device_.start();
+            if (err < 0) {
+                log_error("Failed to start: {}", device_.errorString(err));
+                return err;
+            }
+            resynchronize();
             continue;
         }
 
-        dll.update(get_time());
-        uint32_t sample = static_cast<uint32_t>(static_cast<int64_t>(
-                std::floor(dll.t0() * sampleRate_ + 0.5)
-            ) % 4294967296);
-        sample -= latency_ * periodSize_;
-
+        const double begin = get_time();
+        uint64_t sample = 0;
         int32_t error = 0;
-        if (firstPeriod == false) {
-            auto diff = sample - lastSample;
+        int64_t jump = 0;
+        if (first_) {
+            // The device is stopped and plays the prefilled periods back-to-back
+            // once it is started, so they are read contiguously from the position
+            // the steady state will have reached when the last of them is played.
+            if (!prefilling_) {
+                prefilling_ = true;
+                latency_ = targetLatency_.load(std::memory_order_relaxed);
+                const auto queued = (static_cast<uint64_t>(avail) / periodSize_) * periodSize_;
+                const auto base = media_timestamp(get_time(), sampleRate_) - latency_ * periodSize_ - (queued - periodSize_);
+                if (!firstPeriod_) {
+                    // Account the frames skipped during the XRUN so the sample
+                    // count seen by the network thread continues seamlessly.
+                    skipped_ = static_cast<int64_t>(base - (lastSample_ + periodSize_));
+                    framesPlayed_ += static_cast<uint64_t>(skipped_);
+                }
+                lastSample_ = base - periodSize_;
+            }
+            sample = lastSample_ + periodSize_;
+            nextSample_ = sample;
+        } else {
+            jump = changeLatency();
+            dll_.update(get_time());
+            sample = media_timestamp(dll_.t0(), sampleRate_);
+            sample -= latency_ * periodSize_;
+
+            const auto diff = static_cast<int64_t>(sample - lastSample_);
             if (diff != periodSize_) {
-                error = periodSize_ - diff;
+                error = static_cast<int32_t>(periodSize_ - diff);
             }
-            if (nextSample - error != sample) {
-                std::cout << sample << " " << nextSample << "\n";
+            if (nextSample_ - error != sample) {
+                log_info("{} {}", sample, nextSample_);
             }
+
+            TimeInfo info;
+            info.time = dll_.t1();
+            info.periodTime = dll_.periodTime();
+            info.sample = framesPlayed_;
+            info.periodSize = periodSize_;
+            info.generation = generation_;
+            info.latency = latency_;
+            timeInfo_.publish(info);
         }
-        firstPeriod = false;
-        lastSample = sample;
+        firstPeriod_ = false;
+        lastSample_ = sample;
+        framesPlayed_ += periodSize_;
+        trace(TracePoint::PlaybackBegin, sample + error);
 
-        snd_pcm_uframes_t size = periodSize_;
+        unsigned long size = periodSize_;
         while (size > 0) {
-            snd_pcm_uframes_t offset = 0, frames = size;
-            const snd_pcm_channel_area_t* channel_area = nullptr;
-            err = snd_pcm_mmap_begin(pcm_, &channel_area, &offset, &frames);
+            unsigned long offset = 0, frames = size;
+            int16_t* output = nullptr;
+            err = device_.begin(output, offset, frames);
             if (err < 0) {
-                std::cerr << "snd_pcm_mmap_begin failed\n";
+                log_error("Failed to begin transfer");
                 if ((err = recover(err)) < 0) {
-                    std::cerr << "Failed MMAP begin: " << snd_strerror(err) << "\n";
+                    log_error("Failed MMAP begin: {}", device_.errorString(err));
                     return err;
                 }                
-                first = 1;
+                first_ = true;
+                break;
             }
 
-            int16_t* output = (int16_t*)channel_area[0].addr + ((channel_area[0].first + offset * channel_area[0l].step) / 16);
-            buffer_.read(sample + error, output, periodSize_);
+            // Only reads with frames scheduled to be played can miss frames.
+            buffer_.read(sample + error, output, static_cast<uint32_t>(frames));
+            if (jump != 0) {
+                // Fades linearly from the frames at the old position to those at the new one.
+                const auto done = periodSize_ - size;
+                buffer_.read(sample + error - static_cast<uint64_t>(jump), crossfade_.data(), static_cast<uint32_t>(frames));
+                for (unsigned long i = 0; i < frames; ++i) {
+                    const double gain = static_cast<double>(done + i + 1) / (periodSize_ + 1);
+                    for (unsigned int c = 0; c < channels_; ++c) {
+                        auto& value = output[i * channels_ + c];
+                        value = static_cast<int16_t>(std::lround(value * gain + crossfade_[i * channels_ + c] * (1.0 - gain)));
+                    }
+                }
+            }
+            if (applySchedule(sample + error, output, frames) > 0) {
+                const auto headroom = buffer_.headroom(sample + error + frames);
+                if (headroom < minHeadroom_.load(std::memory_order_relaxed)) {
+                    minHeadroom_.store(headroom, std::memory_order_relaxed);
+                }
+                if (headroom < 0) {
+                    underruns_.fetch_add(1, std::memory_order_relaxed);
+                    underrunsMetric_.add();
+                }
+                headroomMetric_.set(static_cast<double>(headroom));
+            }
+            trace(TracePoint::PlaybackRead, sample + error);
 
-            nextSample = sample + periodSize_;
+            nextSample_ = sample + periodSize_;
 
-            timeInfoQueue_.try_enqueue(dll.t1());
-            
             if (!streaming_) {
                 streaming_ = true;
             }
 
-            snd_pcm_sframes_t commit_result = snd_pcm_mmap_commit(pcm_, offset, frames);
-            if (commit_result < 0 || (snd_pcm_uframes_t)commit_result != frames) {
-                std::cerr << "snd_pcm_mmap_commit failed\n";
+            const long commit_result = device_.commit(offset, frames);
+            if (commit_result < 0 || static_cast<unsigned long>(commit_result) != frames) {
+                log_error("Failed to commit transfer");
                 if ((err = recover(commit_result >= 0 ? -EPIPE : static_cast<int>(commit_result))) < 0) {
-                    std::cerr << "Failed MMAP commit: " << snd_strerror(err) << "\n";
+                    log_error("Failed MMAP commit: {}", device_.errorString(err));
                     return err;
                 }                
-                first = 1;
+                first_ = true;
             }
 
-            sample += static_cast<uint32_t>(frames);
+            sample += frames;
 
             size -= frames;
         }
+        trace(TracePoint::PlaybackEnd, lastSample_ + error);
+        processingTime_.observe(get_time() - begin);
     }
 
-    snd_pcm_status_free(status);   
-
     return 0;
 }
 
 int Player::recover(int err) {
-    return snd_pcm_recover(pcm_, err, 1);
+    if (err == -EPIPE) {
+        xruns_.fetch_add(1, std::memory_order_relaxed);
+        xrunsMetric_.add();
+    }
+    // A resumed device keeps running, everything else restarts with a prefill.
+    if (!recovering_ && !firstPeriod_ && err != -ESTRPIPE) {
+        recovering_ = true;
+        xrunTime_ = get_time();
+    }
+    prefilling_ = false;
+    return device_.recover(err);
+}
+
+bool Player::setLatency(unsigned int latency) {
+    if (latency == 0 || latency > buffer_.maxLatency()) {
+        return false;
+    }
+    targetLatency_.store(latency, std::memory_order_relaxed);
+    latencyMetric_.set(latency);
+    return true;
+}
+
+unsigned int Player::latency() const {
+    return targetLatency_.load(std::memory_order_relaxed);
+}
+
+unsigned int Player::maxLatency() const {
+    return buffer_.maxLatency();
+}
+
+int64_t Player::changeLatency() {
+    const auto target = targetLatency_.load(std::memory_order_relaxed);
+    if (target == latency_) {
+        return 0;
+    }
+    // Frames skipped by a lower latency count as played and frames played
+    // again after a higher one do not, so the delay the network thread
+    // measures changes by the same amount as the target.
+    const auto jump = (static_cast<int64_t>(latency_) - static_cast<int64_t>(target)) * periodSize_;
+    log_info("Latency changed from {} to {} periods", latency_, target);
+    latency_ = target;
+    lastSample_ += static_cast<uint64_t>(jump);
+    nextSample_ += static_cast<uint64_t>(jump);
+    framesPlayed_ += static_cast<uint64_t>(jump);
+    return jump;
+}
+
+void Player::scheduleStart(uint64_t sample) {
+    std::lock_guard<std::mutex> lock(scheduleMutex_);
+    nextSchedule_.start = sample;
+    publishSchedule();
+}
+
+void Player::scheduleStop(uint64_t sample) {
+    std::lock_guard<std::mutex> lock(scheduleMutex_);
+    nextSchedule_.stop = sample;
+    publishSchedule();
+}
+
+void Player::scheduleMute(bool mute, uint64_t sample) {
+    std::lock_guard<std::mutex> lock(scheduleMutex_);
+    if (mute) {
+        nextSchedule_.muteFrom = sample;
+        nextSchedule_.muteUntil = 0;
+    } else if (nextSchedule_.muteFrom != 0) {
+        nextSchedule_.muteUntil = std::max(sample, nextSchedule_.muteFrom);
+    }
+    publishSchedule();
+}
+
+void Player::publishSchedule() {
+    const auto sequence = scheduleSequence_.load(std::memory_order_relaxed);
+    scheduleSequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    startSample_.store(nextSchedule_.start, std::memory_order_relaxed);
+    stopSample_.store(nextSchedule_.stop, std::memory_order_relaxed);
+    muteFrom_.store(nextSchedule_.muteFrom, std::memory_order_relaxed);
+    muteUntil_.store(nextSchedule_.muteUntil, std::memory_order_relaxed);
+    scheduleSequence_.store(sequence + 2, std::memory_order_release);
+}
+
+void Player::readSchedule() {
+    const auto before = scheduleSequence_.load(std::memory_order_acquire);
+    Schedule schedule;
+    schedule.start = startSample_.load(std::memory_order_relaxed);
+    schedule.stop = stopSample_.load(std::memory_order_relaxed);
+    schedule.muteFrom = muteFrom_.load(std::memory_order_relaxed);
+    schedule.muteUntil = muteUntil_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto after = scheduleSequence_.load(std::memory_order_relaxed);
+    // The writer is not real-time, so a torn read is retried with the next read.
+    if ((before & 1) == 0 && before == after) {
+        schedule_ = schedule;
+    }
+}
+
+unsigned long Player::applySchedule(uint64_t sample, int16_t* output, unsigned long frames) {
+    readSchedule();
+    const auto start = schedule_.start;
+    const auto stop = schedule_.stop;
+    const auto muteFrom = schedule_.muteFrom;
+    const auto muteUntil = schedule_.muteUntil;
+    unsigned long played = 0;
+    for (unsigned long i = 0; i < frames; ++i) {
+        const auto frame = sample + i;
+        const bool audible = frame >= start && (stop == 0 || frame < stop)
+            && !(muteFrom != 0 && frame >= muteFrom && (muteUntil == 0 || frame < muteUntil));
+        if (audible != audible_) {
+            audible_ = audible;
+            log_info("Playback {} at sample {}", audible ? "audible" : "silent", frame);
+        }
+        if (audible) {
+            played += 1;
+        } else {
+            memset(output + i * channels_, 0, channels_ * sizeof(int16_t));
+        }
+    }
+    return played;
+}
+
+void Player::resynchronize() {
+    const double now = get_time();
+    // The next period is due when the first prefilled period has been played.
+    dll_.reset(now);
+    prefilling_ = false;
+    if (recovering_) {
+        recovering_ = false;
+        generation_ += 1;
+        const double recoveryTime = now - xrunTime_;
+        recoveries_.fetch_add(1, std::memory_order_relaxed);
+        resyncsMetric_.add();
+        if (recoveryTime > maxRecoveryTime_.load(std::memory_order_relaxed)) {
+            maxRecoveryTime_.store(recoveryTime, std::memory_order_relaxed);
+        }
+        log_error("Resynchronized after XRUN, skipped {} frames, restarted in {}us", skipped_, recoveryTime * 1000000.0);
+    }
 }
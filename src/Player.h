@@ -5,33 +5,50 @@
 #define __PLAYER_H
 
 #include "Utils.h"
+#include "Realtime.h"
+#include "Metrics.h"
+#include "DelayLockedLoop.h"
 
-#include <readerwriterqueue.h>
 #include <thread>
 #include <memory>
+#include <string>
 #include <atomic>
-#include <alsa/asoundlib.h>
+#include <mutex>
+#include <vector>
 #include <cstddef>
+#include <cstdint>
 
+class AudioDevice;
 class CircularBuffer;
 class Filter;
+class SharedTimeInfo;
 
 class Player {
 public:
+    /** Playback statistics collected since the last reset.
+     */
+    struct Statistics {
+        uint64_t xruns;         /**< The number of buffer under-runs of the audio device.              */
+        uint64_t underruns;     /**< The number of reads of frames not received yet.                   */
+        int64_t minHeadroom;    /**< The smallest number of received frames ahead of a read.           */
+        uint64_t recoveries;    /**< The number of resynchronizations after an XRUN.                   */
+        double maxRecoveryTime; /**< The longest time from an XRUN to the restart of the device in s.  */
+    };
+
     /** Constructor
      *
-     *  \param deviceName the name of the ALSA device.
+     *  \param device the audio device used for playback.
      *  \param sampleRate the sample rate to be used.
      *  \param periodTime the period time in microseconds.
      *  \param channel the number of channels per frame.
-     *  \param latency the target latency in periods.
+     *  \param latency the initial target latency in periods.
      *  \param buffer the circular buffer to read the audio data from.
-     *  \param timeInfoQueue the queue to transfer the time info to the network thread.
+     *  \param timeInfo the shared timing state published to the network thread.
      *  \param streaming a flag to synchronize startup with the network thread.
      */
-    Player(const std::string& deviceName, unsigned int sampleRate, unsigned int periodTime,
+    Player(AudioDevice& device, unsigned int sampleRate, unsigned int periodTime,
      unsigned int channels, unsigned int latency, CircularBuffer& buffer, 
-     moodycamel::ReaderWriterQueue<double>& timeInfoQueue, std::atomic<bool>& streaming);
+     SharedTimeInfo& timeInfo, std::atomic<bool>& streaming);
 
     Player(const Player&) = delete;
     Player& operator =(const Player&) = delete;
@@ -44,27 +61,96 @@ public:
      */
     void start();
 
+    /** Opens the device and resets the playback state without starting the
+     *  internal thread. Used when the caller drives process() itself.
+     */
+    void prepare();
+
+    /** Writes all periods the device can take and starts the device if
+     *  necessary. Returns when the device needs to be waited for.
+     *
+     *  \return 0 on success or a negative error code.
+     */
+    int process();
+
     /** Stop the player.
      */
     void stop();
 
-private:
-    /** Setup ALSA.
+    /** Sets the scheduling settings of the audio thread. Takes effect with the next start().
+     *
+     *  \param settings the scheduling settings.
+     */
+    void setThreadSettings(const ThreadSettings& settings);
+
+    /** Returns the statistics collected since the last reset.
      */
-    void setUpAlsa();
+    Statistics statistics() const;
 
-    /** Set ALSA hardware parameters.
+    /** Resets the statistics.
      */
-    void setHardwareParameters();
+    void resetStatistics();
 
-    /** Set ALSA software parameters.
+    /** Starts the delay-locked loop at the rate of the device a previous run
+     *  converged to. Must be called before start().
+     *
+     *  \param rate the period of the device over its nominal value.
+     */
+    void setClockRate(double rate);
+
+    /** Returns the period of the device estimated by the delay-locked loop
+     *  over its nominal value. Must not be called while running.
+     */
+    double clockRate() const;
+
+    /** Changes the target latency while running. The read position jumps
+     *  at the next period and crosses over from the old position within
+     *  that period. The jump is accounted in the timing state shared with the
+     *  network thread, so the clocks stay locked.
+     *
+     *  \param latency the target latency in periods.
+     *  \return false if the latency is 0 or exceeds the capacity of the circular buffer.
+     */
+    bool setLatency(unsigned int latency);
+
+    /** Returns the target latency in periods.
      */
-    void setSoftwareParameters();
+    unsigned int latency() const;
 
-    /** Tear down ALSA.
+    /** Returns the largest latency in periods setLatency() accepts.
+     */
+    unsigned int maxLatency() const;
+
+    /** Schedules the start of playback at a media timestamp. Frames before
+     *  it are played as silence, so receivers with synchronized clocks start
+     *  on the same sample. May be called while running.
+     *
+     *  \param sample the media timestamp of the first audible frame, 0 to play at once.
      */
-    void tearDownAlsa();
+    void scheduleStart(uint64_t sample);
 
+    /** Schedules the end of playback at a media timestamp. The frame at it
+     *  and all later frames are played as silence. May be called while running.
+     *
+     *  \param sample the media timestamp of the first silent frame, 0 to play forever.
+     */
+    void scheduleStop(uint64_t sample);
+
+    /** Schedules muting or unmuting at a media timestamp. May be called
+     *  while running.
+     *
+     *  \param mute true to mute, false to unmute.
+     *  \param sample the media timestamp of the first frame affected.
+     */
+    void scheduleMute(bool mute, uint64_t sample);
+
+    /** Registers the metrics of the audio thread. Must be called before start().
+     *
+     *  \param metrics the metrics segment.
+     */
+    void setMetrics(Metrics& metrics);
+
+private:
     /** Playback method.
      */
     int playback();
@@ -75,19 +161,93 @@ private:
      */
     int recover(int err);
 
-    const std::string deviceName_;      /**< The name of the ALSA audio device. */
+    /** Re-seeds the timing state after the device has been started.
+     */
+    void resynchronize();
+
+    /** Moves the read position to the target latency if it has changed.
+     *
+     *  \return the number of frames the read position moved forward.
+     */
+    int64_t changeLatency();
+
+    /** The frames scheduled to be audible.
+     */
+    struct Schedule {
+        uint64_t start;         /**< The first audible frame, 0 for any.            */
+        uint64_t stop;          /**< The first silent frame at the end, 0 for none. */
+        uint64_t muteFrom;      /**< The first muted frame, 0 if not muted.         */
+        uint64_t muteUntil;     /**< The first frame unmuted again, 0 for none.     */
+    };
+
+    /** Publishes nextSchedule_ to the audio thread. The fields are written
+     *  under a sequence lock, so the audio thread never combines fields of
+     *  different schedules. Must be called with scheduleMutex_ held.
+     */
+    void publishSchedule();
+
+    /** Takes the latest published schedule into schedule_. Keeps the previous
+     *  schedule instead of waiting if the schedule is being published. Runs on
+     *  the audio thread.
+     */
+    void readSchedule();
+
+    /** Replaces the frames of a read that are not scheduled to be played
+     *  with silence.
+     *
+     *  \param sample the media timestamp of the first frame.
+     *  \param output the frames.
+     *  \param frames the number of frames.
+     *  \return the number of frames scheduled to be played.
+     */
+    unsigned long applySchedule(uint64_t sample, int16_t* output, unsigned long frames);
+
+    AudioDevice& device_;               /**< The audio device.                  */
     const unsigned int sampleRate_;     /**< The sample rate.                   */
     const unsigned int periodTime_;     /**< The period time in microseconds.   */
     const unsigned int periodSize_;     /**< The period size in frames.         */
     const unsigned int channels_;       /**< The number of channels per period. */
-    const unsigned int latency_;        /**< The target latency in periods.     */
+    unsigned int latency_;              /**< The latency in periods, used by the audio thread only. */
+    std::atomic<unsigned int> targetLatency_;  /**< The target latency in periods. */
 
     CircularBuffer& buffer_;                               /**< The circular buffer.   */
     std::atomic<bool>& streaming_;                         /**< The streaming flag.    */
-    moodycamel::ReaderWriterQueue<double>& timeInfoQueue_; /**< The queues used to send time info to the network thread. */
-    snd_pcm_t* pcm_;                                       /**< ALSA handle.           */
+    SharedTimeInfo& timeInfo_;                             /**< The timing state shared with the network thread. */
+    ThreadSettings settings_;                              /**< The scheduling settings of the audio thread. */
     std::unique_ptr<std::thread> thread_;                  /**< The internal audio thread. */
     std::atomic<bool> running_;                            /**< True if the player is started, otherwise false. */
+    DelayLockedLoop dll_;                                  /**< The delay-locked loop for the audio thread.  */
+    bool first_;                                           /**< True if the device has to be started.        */
+    bool prefilling_;                                      /**< True while the stopped device is prefilled.  */
+    bool recovering_;                                      /**< True between an XRUN and the restart.        */
+    bool firstPeriod_;                                     /**< True before the first period is written.     */
+    uint64_t lastSample_;                                  /**< The media timestamp of the last period.      */
+    uint64_t nextSample_;                                  /**< The expected media timestamp of the next period. */
+    uint64_t framesPlayed_;                                /**< The number of frames written to the device.  */
+    uint32_t generation_;                                  /**< The number of resynchronizations.            */
+    double xrunTime_;                                      /**< The time the current XRUN was detected.      */
+    int64_t skipped_;                                      /**< The number of frames skipped by the last XRUN. */
+    std::mutex scheduleMutex_;                             /**< Serializes changes of the schedule.          */
+    Schedule nextSchedule_;                                /**< The schedule changed by the schedule calls.  */
+    std::atomic<uint64_t> scheduleSequence_;               /**< The sequence lock of the published schedule, odd while written. */
+    std::atomic<uint64_t> startSample_;                    /**< The published Schedule::start.               */
+    std::atomic<uint64_t> stopSample_;                     /**< The published Schedule::stop.                */
+    std::atomic<uint64_t> muteFrom_;                       /**< The published Schedule::muteFrom.            */
+    std::atomic<uint64_t> muteUntil_;                      /**< The published Schedule::muteUntil.           */
+    Schedule schedule_;                                    /**< The schedule in effect, used by the audio thread only. */
+    bool audible_;                                         /**< True if the last frame written was audible.  */
+    std::vector<int16_t> crossfade_;                       /**< The frames at the read position before a jump. */
+    std::atomic<uint64_t> xruns_;                          /**< The number of device under-runs.        */
+    std::atomic<uint64_t> underruns_;                      /**< The number of reads of missing frames.  */
+    std::atomic<int64_t> minHeadroom_;                     /**< The smallest headroom of a read.        */
+    std::atomic<uint64_t> recoveries_;                     /**< The number of resynchronizations.       */
+    std::atomic<double> maxRecoveryTime_;                  /**< The longest recovery time in seconds.   */
+    MetricCounter xrunsMetric_;                            /**< The number of device under-runs.        */
+    MetricCounter underrunsMetric_;                        /**< The number of reads of missing frames.  */
+    MetricCounter resyncsMetric_;                          /**< The number of resynchronizations.       */
+    MetricGauge headroomMetric_;                           /**< The headroom of the last read.          */
+    MetricGauge latencyMetric_;                            /**< The target latency in periods.          */
+    MetricHistogram processingTime_;                       /**< The time spent writing a period.        */
 };
 
 #endif  // __PLAYER_H
@@ -0,0 +1,165 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Reactor.h"
+#include "AudioDevice.h"
+#include "Receiver.h"
+#include "Player.h"
+#include "Log.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+static const uint32_t SocketIndex = 0xfffffffe;     // epoll index of the UDP socket
+static const uint32_t WakeupIndex = 0xffffffff;     // epoll index of the wakeup eventfd
+static const int MaxEvents = 8;
+
+Reactor::Reactor(Receiver& receiver, Player& player, AudioDevice& device)
+: receiver_(receiver)
+, player_(player)
+, device_(device)
+, settings_()
+, epoll_(-1)
+, wakeup_(-1)
+, fds_()
+, thread_()
+, running_(false) {
+}
+
+Reactor::~Reactor() {
+    stop();
+}
+
+void Reactor::start() {
+    stop();
+
+    receiver_.open();
+    player_.prepare();
+
+    fds_.clear();
+    device_.pollDescriptors(fds_);
+
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeup_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_ < 0 || wakeup_ < 0) {
+        const std::string error = strerror(errno);
+        close();
+        throw std::runtime_error("Failed to create event descriptors: " + error);
+    }
+
+    try {
+        add(wakeup_, EPOLLIN, WakeupIndex);
+        add(receiver_.socket(), EPOLLIN, SocketIndex);
+        if (receiver_.redundantSocket() != 0) {
+            add(receiver_.redundantSocket(), EPOLLIN, SocketIndex);
+        }
+        for (std::size_t i = 0; i < fds_.size(); ++i) {
+            add(fds_[i].fd, static_cast<uint16_t>(fds_[i].events), static_cast<uint32_t>(i));
+        }
+    } catch (...) {
+        close();
+        throw;
+    }
+
+    running_ = true;
+    thread_.reset(new std::thread([this] () {
+        applyThreadSettings("reactor", settings_);
+        run();
+    }));
+}
+
+void Reactor::stop() {
+    running_ = false;
+    if (thread_ && thread_->joinable()) {
+        const uint64_t value = 1;
+        if (write(wakeup_, &value, sizeof(value)) < 0) {
+            std::cerr << "Failed to wake up reactor: " << strerror(errno) << "\n";
+        }
+        thread_->join();
+    }
+    thread_.reset();
+    close();
+}
+
+void Reactor::setThreadSettings(const ThreadSettings& settings) {
+    settings_ = settings;
+}
+
+void Reactor::add(int fd, uint32_t events, uint32_t index) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u32 = index;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::runtime_error(std::string("Failed to register descriptor: ") + strerror(errno));
+    }
+}
+
+void Reactor::close() {
+    if (epoll_ >= 0) {
+        ::close(epoll_);
+        epoll_ = -1;
+    }
+    if (wakeup_ >= 0) {
+        ::close(wakeup_);
+        wakeup_ = -1;
+    }
+}
+
+int Reactor::run() {
+    int err = player_.process();
+    if (err < 0) {
+        return err;
+    }
+
+    struct epoll_event events[MaxEvents];
+    while (running_) {
+        const int n = epoll_wait(epoll_, events, MaxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Failed to wait for events: {}", LogErrno{errno});
+            return -errno;
+        }
+
+        bool device = false, socket = false;
+        for (auto& fd : fds_) {
+            fd.revents = 0;
+        }
+        for (int i = 0; i < n; ++i) {
+            const auto index = events[i].data.u32;
+            if (index == SocketIndex) {
+                socket = true;
+            } else if (index < fds_.size()) {
+                fds_[index].revents = static_cast<short>(events[i].events);
+                device = true;
+            }
+        }
+
+        // The device is served first, its deadline is tighter than the one of
+        // the circular buffer which the received packets are written to.
+        if (device) {
+            const int revents = device_.pollEvents(fds_.data(), static_cast<unsigned int>(fds_.size()));
+            if (revents < 0) {
+                log_error("Failed to get device events: {}", device_.errorString(revents));
+            } else if (revents > 0) {
+                err = player_.process();
+                if (err < 0) {
+                    return err;
+                }
+            }
+        }
+
+        if (socket && !receiver_.receivePending()) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __REACTOR_H
+#define __REACTOR_H
+
+#include "Realtime.h"
+
+#include <vector>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <poll.h>
+
+class AudioDevice;
+class Receiver;
+class Player;
+
+/** Runs reception, resampling and playback of the receiver in a single
+ *  thread. The thread waits with epoll for the UDP socket of the Receiver
+ *  and the poll descriptors of the audio device and handles both inline,
+ *  so no data or timing information has to cross threads.
+ */
+class Reactor {
+public:
+    /** Constructor
+     *
+     *  \param receiver the receiver, not started.
+     *  \param player the player, not started.
+     *  \param device the audio device of the player.
+     */
+    Reactor(Receiver& receiver, Player& player, AudioDevice& device);
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator =(const Reactor&) = delete;
+
+    /** Destructor.
+     */
+    ~Reactor();
+
+    /** Opens the receiver and the player and starts the thread. Throws a
+     *  std::runtime_error if the descriptors cannot be registered.
+     */
+    void start();
+
+    /** Stops the thread.
+     */
+    void stop();
+
+    /** Sets the scheduling settings of the thread. Takes effect with the next start().
+     *
+     *  \param settings the scheduling settings.
+     */
+    void setThreadSettings(const ThreadSettings& settings);
+
+private:
+    /** Runs the event loop.
+     */
+    int run();
+
+    /** Registers a descriptor with epoll.
+     *
+     *  \param fd the descriptor.
+     *  \param events the poll events to wait for.
+     *  \param index the index reported with the events.
+     */
+    void add(int fd, uint32_t events, uint32_t index);
+
+    /** Closes the epoll and wakeup descriptors.
+     */
+    void close();
+
+    Receiver& receiver_;                    /**< The receiver.                              */
+    Player& player_;                        /**< The player.                                */
+    AudioDevice& device_;                   /**< The audio device of the player.            */
+    ThreadSettings settings_;               /**< The scheduling settings of the thread.     */
+    int epoll_;                             /**< The epoll instance.                        */
+    int wakeup_;                            /**< The eventfd used to interrupt the loop.    */
+    std::vector<struct pollfd> fds_;        /**< The poll descriptors of the device.        */
+    std::unique_ptr<std::thread> thread_;   /**< The thread running the loop.               */
+    std::atomic<bool> running_;             /**< True if the loop is running.               */
+};
+
+#endif  // __REACTOR_H
@@ -0,0 +1,153 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Realtime.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if.h>
+
+static const std::size_t StackPrefaultSize = 128 * 1024;  // bytes of stack touched by each pipeline thread
+
+/** Touches the stack so that page faults happen now and not in the real-time loop.
+ */
+static void prefaultStack() {
+    unsigned char stack[StackPrefaultSize];
+    volatile unsigned char* page = stack;
+    for (std::size_t i = 0; i < StackPrefaultSize; i += 4096) {
+        page[i] = 0;
+    }
+}
+
+bool applyThreadSettings(const std::string& name, const ThreadSettings& settings) {
+    bool result = true;
+    std::ostringstream report;
+    report << name << " thread:";
+
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    if (settings.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = settings.priority;
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        report << " SCHED_FIFO priority " << settings.priority;
+        if (err != 0) {
+            report << " failed (" << strerror(err) << ")";
+            result = false;
+        }
+    } else {
+        report << " SCHED_OTHER";
+    }
+
+    if (settings.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(settings.cpu, &set);
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        report << ", CPU " << settings.cpu;
+        if (err != 0) {
+            report << " failed (" << strerror(err) << ")";
+            result = false;
+        }
+    } else {
+        report << ", any CPU";
+    }
+
+    prefaultStack();
+    log_register_thread();
+    trace_register_thread(name);
+
+    std::cout << report.str() << "\n";
+    return result;
+}
+
+bool applySocketSettings(const std::string& name, int socket, const SocketSettings& settings) {
+    if (settings.receiveBuffer <= 0 && settings.busyPoll <= 0 && settings.priority < 0 && settings.dscp < 0
+        && settings.interface.empty()) {
+        return true;
+    }
+
+    bool result = true;
+    std::ostringstream report;
+    report << name << " socket:";
+    const char* separator = " ";
+    // Returns the errno of a failed call or 0.
+    auto status = [] (int value) {
+        return value == 0 ? 0 : errno;
+    };
+    auto check = [&] (int err) {
+        if (err != 0) {
+            report << " failed (" << strerror(err) << ")";
+            result = false;
+        }
+        separator = ", ";
+    };
+
+    if (settings.receiveBuffer > 0) {
+        // Exceeding net.core.rmem_max requires CAP_NET_ADMIN.
+        int err = status(setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &settings.receiveBuffer,
+            sizeof(settings.receiveBuffer)));
+        if (err != 0) {
+            err = status(setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &settings.receiveBuffer, sizeof(settings.receiveBuffer)));
+        }
+        int size = 0;
+        socklen_t length = sizeof(size);
+        getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, &length);
+        report << separator << "receive buffer " << size << " bytes";
+        check(err);
+    }
+    if (settings.busyPoll > 0) {
+        report << separator << "busy poll " << settings.busyPoll << "us";
+        check(status(setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &settings.busyPoll, sizeof(settings.busyPoll))));
+    }
+    if (settings.priority >= 0) {
+        report << separator << "priority " << settings.priority;
+        check(status(setsockopt(socket, SOL_SOCKET, SO_PRIORITY, &settings.priority, sizeof(settings.priority))));
+    }
+    if (settings.dscp >= 0) {
+        const int tos = settings.dscp << 2;
+        report << separator << "DSCP " << settings.dscp;
+        check(status(setsockopt(socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos))));
+    }
+    if (!settings.interface.empty()) {
+        struct ip_mreqn mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_ifindex = static_cast<int>(if_nametoindex(settings.interface.c_str()));
+        report << separator << "interface " << settings.interface;
+        if (mreq.imr_ifindex == 0) {
+            check(ENODEV);
+        } else {
+            int err = status(setsockopt(socket, SOL_SOCKET, SO_BINDTODEVICE, settings.interface.c_str(),
+                static_cast<socklen_t>(settings.interface.size())));
+            if (err == 0) {
+                err = status(setsockopt(socket, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)));
+            }
+            check(err);
+        }
+    }
+
+    std::cout << report.str() << "\n";
+    return result;
+}
+
+bool lockMemory() {
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cout << "Failed to lock memory: " << strerror(errno) << "\n";
+        return false;
+    }
+    std::cout << "Memory locked\n";
+    return true;
+}
@@ -0,0 +1,74 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __REALTIME_H
+#define __REALTIME_H
+
+#include <string>
+
+/** Scheduling settings of a pipeline thread.
+ */
+struct ThreadSettings {
+    /** Constructor. The default settings leave the thread unchanged.
+     */
+    ThreadSettings()
+    : priority(0)
+    , cpu(-1) {
+    }
+
+    int priority;   /**< The SCHED_FIFO priority, 0 to keep SCHED_OTHER.   */
+    int cpu;        /**< The CPU to pin the thread to, -1 for any CPU.     */
+};
+
+/** Applies scheduling settings to the calling thread, names it and prefaults
+ *  its stack and registers it for logging. Prints a report of the settings
+ *  that took effect.
+ *
+ *  \param name the name of the thread.
+ *  \param settings the settings to apply.
+ *  \return true if all settings took effect.
+ */
+bool applyThreadSettings(const std::string& name, const ThreadSettings& settings);
+
+/** Low-latency settings of a UDP socket.
+ */
+struct SocketSettings {
+    static const int AutoBuffer = -1;   /**< Sizes the receive buffer from the latency of the stream. */
+
+    /** Constructor. The default settings leave the socket unchanged.
+     */
+    SocketSettings()
+    : receiveBuffer(0)
+    , busyPoll(0)
+    , priority(-1)
+    , dscp(-1)
+    , interface() {
+    }
+
+    int receiveBuffer;      /**< SO_RCVBUF in bytes, 0 for the kernel default or AutoBuffer.  */
+    int busyPoll;           /**< SO_BUSY_POLL in microseconds, 0 to sleep until a packet arrives. */
+    int priority;           /**< SO_PRIORITY of sent packets, -1 for the default.             */
+    int dscp;               /**< The DSCP of sent packets, -1 for the default.                */
+    std::string interface;  /**< The network interface to bind to, empty for any.           */
+};
+
+/** Applies low-latency settings to a UDP socket: the receive buffer size,
+ *  busy polling, the priority and DSCP of sent packets, and the interface
+ *  the socket is bound to and sends multicast on. Prints a report of the
+ *  settings that took effect, does nothing for default settings.
+ *
+ *  \param name the name of the socket in the report.
+ *  \param socket the socket.
+ *  \param settings the settings to apply, receiveBuffer must not be AutoBuffer.
+ *  \return true if all settings took effect.
+ */
+bool applySocketSettings(const std::string& name, int socket, const SocketSettings& settings);
+
+/** Locks all current and future pages of the process into memory and stops
+ *  malloc from returning memory to the system. Prints a report.
+ *
+ *  \return true if the memory is locked.
+ */
+bool lockMemory();
+
+#endif  // __REALTIME_H
@@ -5,19 +5,38 @@
 #include "CircularBuffer.h"
 #include "Resampler.h"
 #include "Packet.h"
+#include "TimeInfo.h"
 #include "Utils.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Uring.h"
+#include "ClockState.h"
 
 #include <iostream>
 #include <cassert>
 #include <cstring>
+#include <cmath>
 #include <unistd.h>
 #include <fcntl.h>
+#include <net/if.h>
+#include <poll.h>
 
-Receiver::Receiver(const std::string& mcastgroup, unsigned short port, unsigned int sampleRate,
+static const unsigned int UringEntries = 8;         // entries of the submission queue
+static const unsigned int UringBuffers = 64;        // provided buffers, a power of two
+static const uint16_t UringBufferGroup = 0;
+static const unsigned int BufferMarginPackets = 8;  // packets the receive buffer holds beyond twice the latency
+static const unsigned int SkbOverhead = 1024;       // bytes the kernel accounts per queued datagram besides its payload
+static const unsigned int HistorySize = 64;         // packets remembered to match the copies of both paths
+static const double SyncTolerance = 4;              // frames of delay error the clocks are considered locked within
+static const double SyncHold = 2;                   // seconds the delay error stays within the tolerance when locked
+
+Receiver::Receiver(const std::string& mcastgroup, unsigned short port, uint16_t streamId, unsigned int sampleRate,
     unsigned int periodTime, unsigned int periodSize, unsigned int channels, unsigned int latency,
-    CircularBuffer& buffer, ReaderWriterQueue<double>& queue, std::atomic<bool>& streaming)
+    CircularBuffer& buffer, const SharedTimeInfo& timeInfo, std::atomic<bool>& streaming)
 : mcastgroup_(mcastgroup)
 , port_(port)
+, streamId_(streamId)
+, sampleRate_(sampleRate)
 , periodTime_(periodTime)
 , periodSize_(periodSize)
 , channels_(channels)
@@ -26,119 +45,624 @@ Receiver::Receiver(const std::string& mcastgroup, unsigned short port, unsigned
 , addr_()
 , buffer_(buffer)
 , streaming_(streaming)
+, settings_()
 , thread_(nullptr)
+, epoch_(0)
 , sampleCount_(0)
 , ratio_(1.0)
-, tA1(0)
-, kA1(-periodSize_)
-, timeInfoQueue_(queue)
+, seed_(true)
+, generation_(0)
+, tA0(0), tA1(0)
+, kA0(0), kA1(0)
+, timeInfo_(timeInfo)
 , dll_(periodTime * 0.000001)
 , est_(periodSize_, sampleRate)
-, err_(0) {
+, err_(0)
+, jitter_(0)
+, packet_(new Packet(Packet::maxPeriods * channels * periodSize * static_cast<unsigned int>(sizeof(int16_t))))
+, useUring_(false)
+, uring_()
+, slab_()
+, socketSettings_()
+, running_(false)
+, redundantGroup_()
+, redundantPort_(0)
+, redundantInterface_()
+, redundantSocket_(0)
+, newest_(0)
+, expected_()
+, arrivals_(HistorySize)
+, syncStart_(0)
+, lockStart_(0)
+, synchronized_(false)
+, resampler_()
+, counter_(0)
+, periods_(1)
+, formatReported_(false)
+, firstWritten_(0)
+, latestWritten_(0)
+, writing_(false)
+, packets_()
+, invalidPackets_()
+, arrivalJitter_()
+, delayError_()
+, ratioGauge_()
+, bufferFill_()
+, processingTime_()
+, wakeupLatency_()
+, pathPackets_()
+, pathLost_()
+, duplicates_()
+, historyPackets_()
+, pathSkew_()
+, syncTime_() {
 }
 
 Receiver::~Receiver() {
     stop();
 }
 
-void Receiver::start() {
-    stop();
+void Receiver::open() {
+    socket_ = openSocket(mcastgroup_, port_, socketSettings_.interface);
+    if (!redundantGroup_.empty()) {
+        redundantSocket_ = openSocket(redundantGroup_, redundantPort_, redundantInterface_);
+    }
+    prepare();
+}
 
-    socket_ = socket(AF_INET, SOCK_DGRAM, 0);
-    assert(socket_ != -1);
+int Receiver::openSocket(const std::string& address, unsigned short port, const std::string& interface) {
+    const int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    assert(fd != -1);
 
     addr_.sin_family = AF_INET;
     addr_.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr_.sin_port = htons(port_);
+    addr_.sin_port = htons(port);
 
-    int result = 0, enable = 1;
-    result = setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, (int*)&enable, sizeof(enable));
+    int result = 0, enable = 1, disable = 0;
+    result = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (int*)&enable, sizeof(enable));
     assert(result == 0);
 
-    struct ip_mreq mreq;
-    mreq.imr_multiaddr.s_addr = inet_addr(mcastgroup_.c_str());
-    mreq.imr_interface.s_addr = htonl (INADDR_ANY);
-    result = setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    struct ip_mreqn mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr.s_addr = inet_addr(address.c_str());
+    mreq.imr_address.s_addr = htonl(INADDR_ANY);
+    mreq.imr_ifindex = static_cast<int>(if_nametoindex(interface.c_str()));
+    result = setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    assert(result == 0);
+
+    if (!redundantGroup_.empty()) {
+        // Each socket of the paths only gets the group it joined, even on the same port.
+        result = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &disable, sizeof(disable));
+        assert(result == 0);
+    }
+
+    result = bind(fd, (struct sockaddr*)&addr_, sizeof(addr_));
     assert(result == 0);
 
-    result = bind(socket_, (struct sockaddr*)&addr_, sizeof(addr_));
+    SocketSettings settings = socketSettings_;
+    settings.interface = interface;
+    if (settings.receiveBuffer == SocketSettings::AutoBuffer) {
+        settings.receiveBuffer = receiveBufferSize();
+    }
+    applySocketSettings(socket_ == 0 ? "receive" : "redundant", fd, settings);
+    // The kernel timestamps each packet on arrival, see receiveMessage().
+    result = setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
     assert(result == 0);
+    return fd;
+}
 
+void Receiver::prepare() {
+    resampler_.reset(new Resampler(periodSize_, channels_));
+    resampler_->setRatio(ratio_);
+    seed_ = true;
+    syncStart_ = 0;
+    lockStart_ = 0;
+    synchronized_ = false;
+    counter_ = 0;
+    newest_ = 0;
+    expected_[0] = expected_[1] = 0;
+    firstWritten_ = 0;
+    latestWritten_ = 0;
+    writing_ = false;
+}
+
+void Receiver::deliver(uint8_t* packet, std::size_t size, double arrival) {
+    if (size < Packet::headerSize) {
+        invalidPackets_.add();
+        return;
+    }
+    // Refers to the packet in place.
+    const Packet view(packet, static_cast<uint32_t>(size));
+    process(view, size, arrival, 0);
+}
+
+void Receiver::start() {
+    stop();
+    open();
+
+    if (useUring_ && !openUring()) {
+        std::cerr << "Receiving with recv()\n";
+    }
+
+    running_ = true;
     thread_.reset(new std::thread([this] () {
-        receive();
+        applyThreadSettings("receive", settings_);
+        if (uring_) {
+            receiveUring();
+        } else {
+            receive();
+        }
     }));
 }
 
 void Receiver::stop() {
+    running_ = false;
+    if (socket_ != 0) {
+        shutdown(socket_, SHUT_RDWR);
+    }
+    if (redundantSocket_ != 0) {
+        shutdown(redundantSocket_, SHUT_RDWR);
+    }
+    // A pending receive on the io_uring is not woken by the shutdown.
+    if (uring_) {
+        uring_->interrupt();
+    }
     if (thread_ && thread_->joinable()) {
-        if (socket_ != 0) {
-            shutdown(socket_, SHUT_RDWR);
-            socket_ = 0;
-        }
         thread_->join();
     }
     thread_.reset();
+    uring_.reset();
+    if (socket_ != 0) {
+        close(socket_);
+        socket_ = 0;
+    }
+    if (redundantSocket_ != 0) {
+        close(redundantSocket_);
+        redundantSocket_ = 0;
+    }
 }
 
-void Receiver::receive() {
-    Packet packet(channels_ * periodSize_ * sizeof(int16_t));
-
-    Resampler resampler(periodSize_, channels_);
+int Receiver::socket() const {
+    return socket_;
+}
 
-    dll_.reset(get_time());
-    tA1 = dll_.t1();
+int Receiver::redundantSocket() const {
+    return redundantSocket_;
+}
 
-    unsigned int counter = 0;
+bool Receiver::receivePending() {
+    return receivePending(socket_, 0) && (redundantSocket_ == 0 || receivePending(redundantSocket_, 1));
+}
 
-    while (1) {
-        const auto n = recv(socket_, packet.packet_, packet.packetSize_, 0);
+bool Receiver::receivePending(int socket, unsigned int path) {
+    while (true) {
+        double now = 0;
+        const auto n = receiveMessage(socket, MSG_DONTWAIT, now);
         if (n > 0) {
-            dll_.update(get_time());
+            process(*packet_, static_cast<std::size_t>(n), now, path);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else if (n == 0) {
+            return false;
+        } else {
+            log_error("Error: {}", LogErrno{errno});
+            return false;
+        }
+    }
+}
 
-            if (streaming_) {
-                const double tN = dll_.t0();
+void Receiver::setRedundantPath(const std::string& address, unsigned short port, const std::string& interface) {
+    redundantGroup_ = address;
+    redundantPort_ = port;
+    redundantInterface_ = interface;
+}
 
-                double t1;
-                if (timeInfoQueue_.try_dequeue(t1)) {
-                    tA0 = tA1;
-                    kA0 = kA1;
-                    tA1 = t1;
-                    kA1 += periodSize_;
-                }
+void Receiver::setIoUring(bool enable) {
+    useUring_ = enable;
+}
 
-                double tD = tN - tA0;
-                if (tD > 0) {
-                    unsigned int kN = sampleCount_ + periodSize_;
-                    double dA = (kA1 - kA0) * tD / (tA1 - tA0);
-                    double dN = kN - kA0;
-                    err_ = dN - dA - (latency_ * periodSize_);
-                    ratio_ = est_.estimateRatio(err_);
-                    if (ratio_ > 1.05) {
-                        ratio_ = 1.05;
-                    }
-                    if (ratio_ < 0.95) {
-                        ratio_ = 0.95;
-                    }
-                    resampler.setRatio(ratio_);
+bool Receiver::openUring() {
+    try {
+        uring_.reset(new Uring(UringEntries));
+        if (slab_.empty()) {
+            for (unsigned int i = 0; i < UringBuffers; ++i) {
+                slab_.emplace_back(new Packet(packet_->dataSize_));
+            }
+        }
+        std::vector<uint8_t*> buffers;
+        for (const auto& packet : slab_) {
+            buffers.push_back(packet->packet_);
+        }
+        uring_->registerBuffers(UringBufferGroup, buffers, packet_->packetSize_);
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << "\n";
+        uring_.reset();
+        return false;
+    }
+    return true;
+}
+
+void Receiver::receiveUring() {
+    const int sockets[Paths] = {socket_, redundantSocket_};
+    bool armed[Paths] = {false, redundantSocket_ == 0}, running = true;
+    while (running) {
+        for (unsigned int path = 0; path < Paths; ++path) {
+            if (armed[path]) {
+                continue;
+            }
+            // One request per path keeps receiving into the provided buffers
+            // until it runs out of buffers or fails.
+            auto entry = uring_->entry();
+            entry->opcode = IORING_OP_RECV;
+            entry->fd = sockets[path];
+            entry->ioprio = IORING_RECV_MULTISHOT;
+            entry->flags = IOSQE_BUFFER_SELECT;
+            entry->buf_group = UringBufferGroup;
+            entry->user_data = path;
+            armed[path] = true;
+        }
+        const int result = uring_->submit(1);
+        if (result < 0 && result != -EINTR) {
+            log_error("Error: {}", LogErrno{-result});
+            break;
+        }
+        uring_->complete([this, &armed, &running] (const struct io_uring_cqe& cqe) {
+            if (cqe.user_data == Uring::Interrupted) {
+                running = false;
+                return;
+            }
+            const auto path = static_cast<unsigned int>(cqe.user_data);
+            if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                armed[path] = false;
+            }
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                const auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (cqe.res > 0) {
+                    process(*slab_[id], static_cast<std::size_t>(cqe.res), get_time(), path);
                 }
+                uring_->provide(id);
+            }
+            if (cqe.res == 0) {
+                running = false;
+            } else if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+                log_error("Error: {}", LogErrno{-cqe.res});
+                running = false;
+            }
+        });
+    }
+}
 
-                resampler.convert(reinterpret_cast<int16_t*>(packet.data_));
-                sampleCount_ += resampler.getFramesGenerated();
+void Receiver::setThreadSettings(const ThreadSettings& settings) {
+    settings_ = settings;
+}
 
-                const auto sample = packet.getTimestamp();
-                buffer_.write(sample, resampler.getOutput(), resampler.getFramesGenerated());
+double Receiver::jitter() const {
+    return jitter_;
+}
 
-                if (counter % 1000 == 0) {
-                    std::cout << "Resampling ratio: " << ratio_ << ", delay error: " << err_ << ", " << buffer_.readWriteDiff() << "\n";
-                }
-                counter += 1;
+void Receiver::resetJitter() {
+    jitter_ = 0;
+}
+
+void Receiver::setClockState(const ClockState& state) {
+    ratio_ = state.ratio;
+    est_.setRatio(state.ratio);
+    dll_.setRate(state.networkRate);
+}
+
+void Receiver::getClockState(ClockState& state) const {
+    state.ratio = ratio_;
+    state.networkRate = dll_.rate();
+}
+
+bool Receiver::synchronized() const {
+    return synchronized_;
+}
+
+bool Receiver::writing() const {
+    return writing_;
+}
+
+void Receiver::setMetrics(Metrics& metrics) {
+    packets_ = metrics.counter("receiver_packets_total", "Packets of the stream processed.");
+    invalidPackets_ = metrics.counter("receiver_invalid_packets_total", "Packets discarded as invalid or of another stream.");
+    arrivalJitter_ = metrics.histogram("receiver_arrival_jitter_seconds",
+        "Deviation of packet arrivals from the delay-locked loop.", 0.00001, 2);
+    delayError_ = metrics.gauge("receiver_delay_error_frames", "Deviation of the latency from its target.");
+    ratioGauge_ = metrics.gauge("receiver_resampling_ratio", "Current resampling ratio.");
+    bufferFill_ = metrics.gauge("receiver_buffer_fill_frames", "Frames written to the circular buffer ahead of playback.");
+    processingTime_ = metrics.histogram("receiver_processing_seconds", "Time spent processing a packet.", 0.000001, 2);
+    wakeupLatency_ = metrics.histogram("receiver_wakeup_latency_seconds",
+        "Time from the arrival of a packet in the kernel to its reception by the network thread.", 0.000001, 2);
+    const char* paths[Paths] = {"primary", "redundant"};
+    for (unsigned int path = 0; path < Paths; ++path) {
+        const std::string labels = std::string("{path=\"") + paths[path] + "\"}";
+        pathPackets_[path] = metrics.counter("receiver_path_packets_total" + labels, "Packets of the stream received on a path.");
+        pathLost_[path] = metrics.counter("receiver_path_lost_total" + labels, "Packets of the stream missing on a path.");
+    }
+    duplicates_ = metrics.counter("receiver_duplicate_packets_total",
+        "Packets discarded as copies or behind newer packets.");
+    historyPackets_ = metrics.counter("receiver_history_packets_total",
+        "Packets older than the first packet played, e.g. the history sent on joining.");
+    pathSkew_ = metrics.gauge("receiver_path_skew_seconds", "Arrival of the redundant copy of a packet minus the primary copy.");
+    syncTime_ = metrics.gauge("receiver_sync_seconds", "Time from the first delay error until the clocks locked.");
+}
+
+void Receiver::receive() {
+    // With busy polling the thread never sleeps, it should have a CPU of its own.
+    const bool spin = socketSettings_.busyPoll > 0;
+    if (redundantSocket_ != 0) {
+        // Waits for either path and drains both.
+        struct pollfd fds[Paths];
+        fds[0].fd = socket_;
+        fds[1].fd = redundantSocket_;
+        fds[0].events = fds[1].events = POLLIN;
+        while (running_) {
+            if (!spin && poll(fds, Paths, -1) < 0 && errno != EINTR) {
+                log_error("Error: {}", LogErrno{errno});
+                break;
+            }
+            if (!receivePending()) {
+                break;
             }
+        }
+        return;
+    }
 
+    const int flags = spin ? MSG_DONTWAIT : 0;
+    while (running_) {
+        double now = 0;
+        const auto n = receiveMessage(socket_, flags, now);
+        if (n > 0) {
+            process(*packet_, static_cast<std::size_t>(n), now, 0);
         } else if (n == 0) {
             break;
-        } else {
-            std::cerr << "Error: " << strerror(static_cast<int>(n)) << "\n";
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            log_error("Error: {}", LogErrno{errno});
             break;
         }
     }
 }
+
+ssize_t Receiver::receiveMessage(int socket, int flags, double& now) {
+    struct iovec iov;
+    iov.iov_base = packet_->packet_;
+    iov.iov_len = packet_->packetSize_;
+    union {
+        struct cmsghdr header;
+        uint8_t data[CMSG_SPACE(sizeof(struct timespec))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control);
+
+    const auto n = recvmsg(socket, &msg, flags);
+    if (n <= 0) {
+        return n;
+    }
+    now = get_time();
+    const auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        const double arrival = static_cast<double>(static_cast<int64_t>(static_cast<uint64_t>(ts.tv_sec) - time_origin()))
+            + ts.tv_nsec * 0.000000001;
+        wakeupLatency_.observe(now - arrival);
+    }
+    return n;
+}
+
+int Receiver::receiveBufferSize() const {
+    // Twice the latency absorbs a stall of the thread, a larger buffer would
+    // only hold packets that are too late to be played.
+    const unsigned int packets = 2 * latency_ + BufferMarginPackets;
+    const unsigned int packetBytes = Packet::headerSize + periodSize_ * channels_ * static_cast<unsigned int>(sizeof(int16_t));
+    return static_cast<int>(packets * (packetBytes + SkbOverhead));
+}
+
+void Receiver::setSocketSettings(const SocketSettings& settings) {
+    socketSettings_ = settings;
+}
+
+void Receiver::updateSync(double now) {
+    if (syncStart_ <= 0) {
+        syncStart_ = now;
+    }
+    if (std::fabs(err_) > SyncTolerance) {
+        lockStart_ = 0;
+    } else if (lockStart_ <= 0) {
+        lockStart_ = now;
+    } else if (!synchronized_ && now - lockStart_ >= SyncHold) {
+        synchronized_ = true;
+        syncTime_.set(lockStart_ - syncStart_);
+        log_info("Locked to the stream after {} s", lockStart_ - syncStart_);
+    }
+}
+
+bool Receiver::merge(const Packet& packet, unsigned int path, double now) {
+    const auto timestamp = packet.getTimestamp();
+    const uint64_t frames = packet.getPeriods() * periodSize_;
+    if (packet.getEpoch() != epoch_ || timestamp + HistorySize * frames < newest_) {
+        // The stream restarted or the clock of the sender stepped back.
+        newest_ = 0;
+        expected_[0] = expected_[1] = 0;
+    }
+
+    // A gap in the timestamps of a path are packets lost on that path.
+    auto& expected = expected_[path];
+    if (expected != 0 && timestamp > expected) {
+        pathLost_[path].add(static_cast<double>((timestamp - expected) / frames));
+    }
+    if (timestamp >= expected) {
+        expected = timestamp + frames;
+    }
+    pathPackets_[path].add();
+
+    auto& arrival = arrivals_[(timestamp / frames) % HistorySize];
+    if (newest_ != 0 && timestamp <= newest_) {
+        // The resampler only moves forward, so a packet behind a processed
+        // one is discarded even if it is not a copy.
+        if (arrival.timestamp == timestamp && arrival.path != path) {
+            const double skew = now - arrival.time;
+            pathSkew_.set(path == 0 ? -skew : skew);
+        }
+        duplicates_.add();
+        return false;
+    }
+    arrival.timestamp = timestamp;
+    arrival.time = now;
+    arrival.path = path;
+    newest_ = timestamp;
+    return true;
+}
+
+void Receiver::process(const Packet& packet, std::size_t size, double now, unsigned int path) {
+    const std::size_t periodBytes = periodSize_ * channels_ * sizeof(int16_t);
+    const auto periods = packet.getPeriods();
+    if (!packet.isValid() || packet.getStreamId() != streamId_) {
+        invalidPackets_.add();
+        return;
+    }
+    if (packet.getSampleRate() != sampleRate_ || packet.getPeriodSize() != periodSize_
+        || packet.getChannels() != channels_ || packet.getFormat() != Packet::formatS16LE) {
+        if (!formatReported_) {
+            formatReported_ = true;
+            log_error("The stream is {} Hz, {} frames per period, {} channels and format {}, "
+                "use --discover or matching options", packet.getSampleRate(), packet.getPeriodSize(),
+                packet.getChannels(), static_cast<unsigned int>(packet.getFormat()));
+        }
+        invalidPackets_.add();
+        return;
+    }
+    if (periods == 0 || size != Packet::headerSize + periods * periodBytes) {
+        invalidPackets_.add();
+        return;
+    }
+    if (!redundantGroup_.empty() && !merge(packet, path, now)) {
+        return;
+    }
+    trace(TracePoint::ReceiveBegin, packet.getTimestamp());
+    if (packet.getEpoch() != epoch_) {
+        if (epoch_ != 0) {
+            log_info("Stream {} restarted with epoch {}", streamId_, packet.getEpoch());
+        }
+        epoch_ = packet.getEpoch();
+        seed_ = true;
+        firstWritten_ = 0;
+        latestWritten_ = 0;
+    }
+    if (firstWritten_ != 0 && packet.getTimestamp() <= latestWritten_) {
+        // The loop only follows packets as they are sent, older ones never
+        // reach it. Those before the first written packet fill the buffer.
+        if (packet.getTimestamp() < firstWritten_) {
+            fill(packet, periods);
+        } else {
+            duplicates_.add();
+        }
+        return;
+    }
+    if (periods != periods_) {
+        // The loop follows the arrivals, i.e. the packet time of the sender.
+        periods_ = periods;
+        dll_.setPeriodTime(periods_ * periodTime_ * 0.000001);
+        seed_ = true;
+    }
+
+    const double begin = get_time();
+    packets_.add();
+    if (seed_) {
+        // The loop is seeded with the first packet of a stream, seeding it
+        // earlier lets it start far behind the arrivals.
+        seed_ = false;
+        dll_.reset(now - periods_ * periodTime_ * 0.000001);
+    }
+    const double jitter = std::fabs(now - dll_.t1());
+    if (jitter > jitter_.load(std::memory_order_relaxed)) {
+        jitter_.store(jitter, std::memory_order_relaxed);
+    }
+    arrivalJitter_.observe(jitter);
+    dll_.update(now);
+
+    if (streaming_) {
+        const double tN = dll_.t0();
+
+        TimeInfo info;
+        bool resynchronized = false;
+        if (timeInfo_.read(info) != 0) {
+            tA0 = info.time - info.periodTime;
+            tA1 = info.time;
+            kA0 = info.sample - info.periodSize;
+            kA1 = info.sample;
+            // The audio thread re-seeded its timing after an XRUN, the ratio
+            // is held until the next snapshot of the settled loop.
+            resynchronized = info.generation != generation_;
+            generation_ = info.generation;
+            // The sample count of the snapshot already includes the jump of
+            // a latency change, so the delay error stays continuous.
+            if (info.latency != 0) {
+                latency_ = info.latency;
+            }
+        }
+
+        double tD = tN - tA0;
+        if (tD > 0 && tA1 > tA0 && !resynchronized) {
+            const uint64_t kN = sampleCount_ + periods * periodSize_;
+            double dA = static_cast<double>(kA1 - kA0) * tD / (tA1 - tA0);
+            double dN = static_cast<double>(static_cast<int64_t>(kN - kA0));
+            err_ = dN - dA - (latency_ * periodSize_);
+            // The estimator advances once per period, so its bandwidth does
+            // not depend on the number of periods per packet.
+            for (unsigned int i = 0; i < periods; ++i) {
+                ratio_ = est_.estimateRatio(err_);
+            }
+            if (ratio_ > 1.05) {
+                ratio_ = 1.05;
+            }
+            if (ratio_ < 0.95) {
+                ratio_ = 0.95;
+            }
+            resampler_->setRatio(ratio_);
+            delayError_.set(err_);
+            ratioGauge_.set(ratio_);
+            updateSync(now);
+        }
+
+        const auto sample = packet.getTimestamp();
+        for (unsigned int i = 0; i < periods; ++i) {
+            resampler_->convert(reinterpret_cast<int16_t*>(packet.data_) + i * periodSize_ * channels_);
+            sampleCount_ += resampler_->getFramesGenerated();
+            buffer_.write(sample + i * periodSize_, resampler_->getOutput(), resampler_->getFramesGenerated());
+        }
+        if (firstWritten_ == 0) {
+            firstWritten_ = sample;
+            writing_ = true;
+        }
+        latestWritten_ = sample;
+
+        bufferFill_.set(static_cast<double>(buffer_.readWriteDiff()));
+        processingTime_.observe(get_time() - begin);
+        trace(TracePoint::ReceiveEnd, sample);
+
+        if (counter_ % 1000 == 0) {
+            log_info("Resampling ratio: {}, delay error: {}, {}", ratio_, err_, buffer_.readWriteDiff());
+        }
+        counter_ += 1;
+    }
+}
+
+void Receiver::fill(const Packet& packet, unsigned int periods) {
+    historyPackets_.add();
+    // The player reads the period at the media time minus the latency.
+    const auto played = media_timestamp(get_time(), sampleRate_) - latency_ * periodSize_ + periodSize_;
+    for (unsigned int i = 0; i < periods; ++i) {
+        const auto sample = packet.getTimestamp() + i * periodSize_;
+        if (sample >= played && sample < firstWritten_) {
+            // Written without resampling, the frames count towards the delay like resampled ones.
+            buffer_.write(sample, reinterpret_cast<const int16_t*>(packet.data_) + i * periodSize_ * channels_, periodSize_);
+            sampleCount_ += periodSize_;
+        }
+    }
+}
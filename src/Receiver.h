@@ -6,23 +6,43 @@
 
 #include "DelayLockedLoop.h"
 #include "ResampleRatioEstimator.h"
+#include "Realtime.h"
+#include "Metrics.h"
 
-#include <readerwriterqueue.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <thread>
 #include <string>
 #include <memory>
-
-using namespace moodycamel;
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
 
 class CircularBuffer;
+class Packet;
+class Resampler;
 class Filter;
+class SharedTimeInfo;
+class Uring;
+struct ClockState;
 
 /** A class to manage the reception of audio data. This class executes the 
  *  adaptive resampling algorithm as described by Fons Adriaensen in his
- *  paper "Controlling Adaptive Resampling" from 2012.
+ *  paper "Controlling Adaptive Resampling" from 2012. Packets carrying
+ *  several periods are processed in one pass, the delay-locked loop then
+ *  follows the packet time of the sender.
+ *
+ *  The network thread receives with recv() by default, or alternatively
+ *  with a multishot receive on an io_uring that places the packets in a
+ *  ring of provided buffers. Packets received by another component, such as
+ *  a PacketRing shared by many streams, are handed over with deliver().
+ *
+ *  Optionally the stream is received on a second, redundant network path
+ *  as well. The copies of both paths are merged by their timestamps before
+ *  resampling: the first copy of a packet is processed, later copies and
+ *  packets older than the newest processed packet are discarded.
  *
  *  http://kokkinizita.linuxaudio.org/papers/adapt-resamp.pdf
  */
@@ -32,18 +52,19 @@ public:
      *
      *  \param address the multicast group address.
      *  \param port the UDP port.
+     *  \param streamId the ID of the stream to receive, packets of other streams are ignored.
      *  \param sampleRate the expected sample rate.
      *  \param periodTime the period time in microseconds.
      *  \param periodSize the period size in frames.
      *  \param channel the number of channels per frame.
      *  \param latency the target latency in number of periods.
      *  \param buffer the circular buffer used to write the audio data to.
-     *  \param queue the queue used to retrieve time information from the audio thread from.
+     *  \param timeInfo the timing state published by the audio thread.
      *  \param streaming a flag used to synchronize startup.
      */
-    Receiver(const std::string& address, unsigned short port, unsigned int sampleRate,
+    Receiver(const std::string& address, unsigned short port, uint16_t streamId, unsigned int sampleRate,
         unsigned int periodTime, unsigned int periodSize, unsigned int channels, unsigned int latency,
-        CircularBuffer& buffer, ReaderWriterQueue<double>& queue, std::atomic<bool>& streaming);
+        CircularBuffer& buffer, const SharedTimeInfo& timeInfo, std::atomic<bool>& streaming);
 
     /** Destructor.
      */
@@ -53,36 +74,270 @@ public:
      */
     void start();
 
+    /** Opens the socket and resets the reception state without starting the
+     *  internal thread. Used when the caller polls socket() itself.
+     */
+    void open();
+
+    /** Returns the UDP socket.
+     */
+    int socket() const;
+
+    /** Resets the reception state without opening a socket. Used when the
+     *  packets are received elsewhere and handed over with deliver().
+     */
+    void prepare();
+
+    /** Processes a packet received elsewhere, e.g. by a PacketRing. Must be
+     *  called from one thread at a time.
+     *
+     *  \param packet the packet, processed in place.
+     *  \param size the size of the packet in bytes.
+     *  \param arrival the arrival time of the packet as returned by get_time().
+     */
+    void deliver(uint8_t* packet, std::size_t size, double arrival);
+
+    /** Receives and processes all pending packets without blocking.
+     *
+     *  \return false if the socket was closed or failed.
+     */
+    bool receivePending();
+
     /** Stops the reception.
      */
     void stop();
 
+    /** Sets the scheduling settings of the network thread. Takes effect with the next start().
+     *
+     *  \param settings the scheduling settings.
+     */
+    void setThreadSettings(const ThreadSettings& settings);
+
+    /** Sets the low-latency settings of the socket. A receive buffer of
+     *  SocketSettings::AutoBuffer is sized from the latency and the packet
+     *  size, with busy polling the network thread spins on the socket instead
+     *  of sleeping. Takes effect with the next open() or start().
+     *
+     *  \param settings the socket settings.
+     */
+    void setSocketSettings(const SocketSettings& settings);
+
+    /** Receives the stream on a redundant path as well and merges the
+     *  copies of both paths. Takes effect with the next open() or start().
+     *
+     *  \param address the multicast group address of the redundant path.
+     *  \param port the UDP port of the redundant path.
+     *  \param interface the network interface of the redundant path, empty for any.
+     */
+    void setRedundantPath(const std::string& address, unsigned short port, const std::string& interface);
+
+    /** Returns the UDP socket of the redundant path, 0 without a redundant path.
+     */
+    int redundantSocket() const;
+
+    /** Receives through an io_uring instead of recv(). Falls back to recv()
+     *  if io_uring is not available. Takes effect with the next start() and
+     *  does not apply to receivePending().
+     *
+     *  \param enable true to use io_uring.
+     */
+    void setIoUring(bool enable);
+
+    /** Returns the largest deviation of a packet arrival from the time
+     *  predicted by the delay-locked loop since the last reset in seconds.
+     */
+    double jitter() const;
+
+    /** Resets the jitter measurement.
+     */
+    void resetJitter();
+
+    /** Starts the resampling ratio and the delay-locked loop from the state
+     *  a previous run converged to. Must be called before start().
+     *
+     *  \param state the clock state.
+     */
+    void setClockState(const ClockState& state);
+
+    /** Sets the resampling ratio and the rate of the delay-locked loop of a
+     *  clock state to the current values. Must not be called while running.
+     *
+     *  \param state the clock state to update.
+     */
+    void getClockState(ClockState& state) const;
+
+    /** Returns true once the delay error has stayed within the tolerance for
+     *  the hold time, i.e. the clocks are locked. Must not be called while running.
+     */
+    bool synchronized() const;
+
+    /** Returns true once packets are written to the buffer for playback.
+     *  From then on, packets older than the first one written, e.g. the
+     *  history requested from the sender on joining, fill the buffer ahead
+     *  of playback.
+     */
+    bool writing() const;
+
+    /** Registers the metrics of the network thread. Must be called before start().
+     *
+     *  \param metrics the metrics segment.
+     */
+    void setMetrics(Metrics& metrics);
+
 private:
     /** Runs the receive loop.
      */
     void receive();
 
+    /** Receives and processes the pending packets of a path without blocking.
+     *
+     *  \param socket the socket of the path.
+     *  \param path the index of the path.
+     *  \return false if the socket was closed or failed.
+     */
+    bool receivePending(int socket, unsigned int path);
+
+    /** Receives a packet into packet_ and records the wakeup latency from
+     *  the kernel timestamp of the packet.
+     *
+     *  \param socket the socket to receive from.
+     *  \param flags the flags passed to recvmsg().
+     *  \param now set to the time of reception as returned by get_time().
+     *  \return the result of recvmsg().
+     */
+    ssize_t receiveMessage(int socket, int flags, double& now);
+
+    /** Opens a socket that joins a multicast group and applies the socket settings.
+     *
+     *  \param address the multicast group address.
+     *  \param port the UDP port.
+     *  \param interface the network interface, empty for any.
+     *  \return the socket.
+     */
+    int openSocket(const std::string& address, unsigned short port, const std::string& interface);
+
+    /** Returns the receive buffer size in bytes for SocketSettings::AutoBuffer.
+     */
+    int receiveBufferSize() const;
+
+    /** Runs the receive loop on the io_uring.
+     */
+    void receiveUring();
+
+    /** Sets up the io_uring and its provided buffers.
+     *
+     *  \return false if io_uring is not available.
+     */
+    bool openUring();
+
+    /** Processes a received packet.
+     *
+     *  \param packet the packet.
+     *  \param size the size of the received packet in bytes.
+     *  \param now the arrival time of the packet as returned by get_time().
+     *  \param path the index of the path the packet was received on.
+     */
+    void process(const Packet& packet, std::size_t size, double now, unsigned int path);
+
+    /** Accounts a packet to its path and decides whether it is the first
+     *  copy of the packet.
+     *
+     *  \param packet the packet.
+     *  \param path the index of the path the packet was received on.
+     *  \param now the arrival time of the packet as returned by get_time().
+     *  \return true if the packet is to be processed.
+     */
+    bool merge(const Packet& packet, unsigned int path, double now);
+
+    /** Tracks whether the delay error has settled within the tolerance.
+     *
+     *  \param now the arrival time of the current packet.
+     */
+    void updateSync(double now);
+
+    /** Writes the periods of a packet older than the first packet written
+     *  to the buffer as they are, if they have not been played yet.
+     *
+     *  \param packet the packet.
+     *  \param periods the number of periods of the packet.
+     */
+    void fill(const Packet& packet, unsigned int periods);
+
+    static const unsigned int Paths = 2;    /**< The primary and the redundant path. */
+
+    /** The arrival of a packet processed by the merge.
+     */
+    struct Arrival {
+        uint64_t timestamp;     /**< The timestamp of the packet.         */
+        double time;            /**< The arrival time of the packet.      */
+        unsigned int path;      /**< The path the packet arrived on.      */
+    };
+
     const std::string mcastgroup_;          /**< The multicast group address.       */
     const unsigned short port_;             /**< The UDP port.                      */
+    const uint16_t streamId_;               /**< The ID of the stream to receive.   */
+    const unsigned int sampleRate_;         /**< The sample rate.                   */
     const unsigned int periodTime_;         /**< The period time in microseconds.   */
     const unsigned int periodSize_;         /**< The period size in frames.         */
     const unsigned int channels_;           /**< The number of periods per frame.   */
-    const unsigned int latency_;            /**< The target latency in periods.     */
+    unsigned int latency_;                  /**< The target latency in periods, as played.  */
 
     int socket_;                            /**< The UDP socket.                                    */
     struct sockaddr_in addr_;               /**< The socket address information.                    */
     CircularBuffer& buffer_;                /**< The circular buffer used to store the audio data.  */
     std::atomic<bool>& streaming_;          /**< A flag used to synchronize startup.                */
+    ThreadSettings settings_;               /**< The scheduling settings of the network thread.     */
     std::unique_ptr<std::thread> thread_;   /**< The internal network thread.                       */
 
-    unsigned int sampleCount_;              /**< The current count of received samples.             */
+    uint32_t epoch_;                        /**< The epoch of the stream currently received.        */
+    uint64_t sampleCount_;                  /**< The current count of received samples.             */
     double ratio_;                          /**< The current resampling ratio.                      */
+    bool seed_;                             /**< True if the DLL has to be seeded with the next packet.     */
+    uint32_t generation_;                   /**< The generation of the timing state of the audio thread.    */
     double tA0, tA1;                        /**< The last and the next timestamps from the audio thread.    */
-    unsigned int kA0, kA1;                  /**< The last and the next sample count from the audio thread.  */
-    ReaderWriterQueue<double>& timeInfoQueue_;    /**< The time info queue used to retrieve timestamps from the audio thread. */
+    uint64_t kA0, kA1;                      /**< The last and the next sample count from the audio thread.  */
+    const SharedTimeInfo& timeInfo_;        /**< The timing state published by the audio thread.    */
     DelayLockedLoop dll_;                   /**< The delay-locked loop for the network thread.      */
     ResampleRatioEstimator est_;            /**< The estimator for the resampling ratio.            */
     double err_;                            /**< The current delay error.                           */
+    std::atomic<double> jitter_;            /**< The largest arrival jitter since the last reset.   */
+    std::unique_ptr<Packet> packet_;        /**< The packet received into.                          */
+    bool useUring_;                         /**< True to receive through an io_uring.               */
+    std::unique_ptr<Uring> uring_;          /**< The io_uring of the network thread, or null.       */
+    std::vector<std::unique_ptr<Packet>> slab_;     /**< The packets provided to the io_uring.      */
+    SocketSettings socketSettings_;         /**< The low-latency settings of the socket.            */
+    std::atomic<bool> running_;             /**< False to stop the receive loop.                    */
+    std::string redundantGroup_;            /**< The multicast group of the redundant path, empty for none. */
+    unsigned short redundantPort_;          /**< The UDP port of the redundant path.                */
+    std::string redundantInterface_;        /**< The network interface of the redundant path.       */
+    int redundantSocket_;                   /**< The UDP socket of the redundant path.              */
+    uint64_t newest_;                       /**< The timestamp of the newest processed packet, 0 for none.  */
+    uint64_t expected_[Paths];              /**< The next timestamp expected on each path, 0 for any.       */
+    std::vector<Arrival> arrivals_;         /**< The recently processed packets by timestamp.       */
+    double syncStart_;                      /**< The time of the first delay error, 0 before.       */
+    double lockStart_;                      /**< The time the delay error entered the tolerance, 0 if outside. */
+    bool synchronized_;                     /**< True once the clocks are locked.                   */
+    std::unique_ptr<Resampler> resampler_;  /**< The resampler.                                     */
+    unsigned int counter_;                  /**< The number of processed packets.                   */
+    unsigned int periods_;                  /**< The number of periods per packet of the stream.    */
+    bool formatReported_;                   /**< True once a format mismatch has been logged.       */
+    uint64_t firstWritten_;                 /**< The timestamp of the first packet written, 0 before.       */
+    uint64_t latestWritten_;                /**< The timestamp of the newest packet written.        */
+    std::atomic<bool> writing_;             /**< True once packets are written to the buffer.       */
+    MetricCounter packets_;                 /**< The number of processed packets.                   */
+    MetricCounter invalidPackets_;          /**< The number of discarded packets.                   */
+    MetricHistogram arrivalJitter_;         /**< The deviation of the arrivals from the DLL.        */
+    MetricGauge delayError_;                /**< The delay error in frames.                         */
+    MetricGauge ratioGauge_;                /**< The resampling ratio.                              */
+    MetricGauge bufferFill_;                /**< The received frames ahead of playback.             */
+    MetricHistogram processingTime_;        /**< The time spent processing a packet.                */
+    MetricHistogram wakeupLatency_;         /**< The time from kernel arrival to reception.         */
+    MetricCounter pathPackets_[Paths];      /**< The packets received on each path.                 */
+    MetricCounter pathLost_[Paths];         /**< The packets missing on each path.                  */
+    MetricCounter duplicates_;              /**< The packets discarded as copies or behind newer ones.      */
+    MetricCounter historyPackets_;          /**< The packets older than the first packet written.   */
+    MetricGauge pathSkew_;                  /**< The arrival of the redundant copy minus the primary copy.  */
+    MetricGauge syncTime_;                  /**< The time from the first delay error to the lock.   */
 };
 
 #endif  // __RECEIVER_H
@@ -2,38 +2,59 @@
 // Distributed under the BSD license.
 
 #include "Recorder.h"
+#include "AudioDevice.h"
 #include "Transmitter.h"
 #include "Packet.h"
 #include "PacketPool.h"
 #include "Utils.h"
 #include "DelayLockedLoop.h"
+#include "Log.h"
+#include "Trace.h"
 
-#include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
-Recorder::Recorder(const std::string& deviceName, unsigned int sampleRate, unsigned int periodTime, unsigned int channels, Mode mode, Transmitter& transmitter, PacketPool& pool)
-: deviceName_(deviceName)
+Recorder::Recorder(AudioDevice& device, unsigned int sampleRate, unsigned int periodTime, unsigned int channels, Mode mode,
+    const std::vector<Stream>& streams, Transmitter& transmitter, PacketPool& pool, unsigned int periodsPerPacket)
+: device_(device)
 , sampleRate_(sampleRate)
 , periodTime_(periodTime)
 , periodSize_(static_cast<unsigned int>(std::round(sampleRate_ * 0.000001 * periodTime_)))
 , channels_(channels)
 , mode_(mode)
+, streams_(streams)
+, periodsPerPacket_(periodsPerPacket)
+, epoch_(0)
 , transmitter_(transmitter)
 , pool_(pool)
-, pcm_(nullptr)
+, queue_(transmitter.addQueue())
+, packets_(streams.size(), nullptr)
+, filled_(0)
+, timestamp_(0)
+, settings_()
 , thread_()
-, running_(false) {
+, running_(false)
+, xruns_()
+, poolExhausted_()
+, queueFull_()
+, processingTime_() {
 }
 
 Recorder::~Recorder() {
     stop();
+    device_.close();
 }
 
 void Recorder::start() {
     stop();
-    setUpAlsa();
+    device_.open();
+    epoch_ = static_cast<uint32_t>(time(nullptr));
     running_ = true;
-    thread_.reset(new std::thread([this] () { capture(); }));    
+    thread_.reset(new std::thread([this] () {
+        applyThreadSettings("capture", settings_);
+        capture();
+    }));
 }
 
 void Recorder::stop() {
@@ -42,157 +63,18 @@ void Recorder::stop() {
         thread_->join();
     }
     thread_.reset();
+    releasePackets();
 }
 
-void Recorder::setUpAlsa() {
-    tearDownAlsa();
-
-    int err = 0;
-    err = snd_pcm_open(&pcm_, deviceName_.c_str(), SND_PCM_STREAM_CAPTURE, 0);
-    if (err < 0) {
-        std::cerr << "Failed to open device: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    snd_config_update_free_global();
-
-    setHardwareParameters();
-    setSoftwareParameters();
-
-    snd_output_t* output;
-    err = snd_output_stdio_attach(&output, stdout, 0);
-    if (err < 0) {
-        std::cerr << "Failed to attach stdout: " << snd_strerror(err) << "\n";
-    }
-
-    snd_pcm_dump(pcm_, output);
+void Recorder::setThreadSettings(const ThreadSettings& settings) {
+    settings_ = settings;
 }
 
-void Recorder::setHardwareParameters() {
-    int err = 0;
-
-    snd_pcm_hw_params_t* params = nullptr;
-    err = snd_pcm_hw_params_malloc(&params);
-    if (err < 0) {
-        std::cerr << "Failed to allocate snd_pcm_hw_params_t: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_any(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to fill hardware params with configuration space for a PCM: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_access(pcm_, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
-    if (err < 0) {
-        std::cerr << "Failed to set access type to SND_PCM_ACCESS_MMAP_INTERLEAVED: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_format(pcm_, params, SND_PCM_FORMAT_S16_LE);
-    if (err < 0) {
-        std::cerr << "Failed to set format to SND_PCM_FORMAT_S16_LE: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_rate(pcm_, params, sampleRate_, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set sample rate to " << sampleRate_ << ": " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_channels(pcm_, params, channels_);
-    if (err < 0) {
-        std::cerr << "Failed to set number of channels to " << channels_ << " : " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_period_size(pcm_, params, periodSize_, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set period size to " << periodSize_ << " : " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params_set_periods(pcm_, params, 2, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set periods to 2: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    const auto bufferSize = periodSize_ * 2;
-    err = snd_pcm_hw_params_set_buffer_size(pcm_, params, bufferSize);
-    if (err < 0) {
-        std::cerr << "Failed to set buffer size to " << bufferSize << ": " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_hw_params(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to install hardware configuration for PCM: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    snd_pcm_hw_params_free(params);
-}
-
-void Recorder::setSoftwareParameters() {
-    int err = 0;
-
-    snd_pcm_sw_params_t* params = nullptr;
-    err = snd_pcm_sw_params_malloc(&params);
-    if (err < 0) {
-        std::cerr << "Failed to allocate snd_pcm_sw_params_t: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_current(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to get current software configuration: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_avail_min(pcm_, params, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set avail min: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_start_threshold(pcm_, params, 0);
-    if (err < 0) {
-        std::cerr << "Failed to set start threshold: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_tstamp_mode(pcm_, params, SND_PCM_TSTAMP_ENABLE);
-    if (err < 0) {
-        std::cerr << "Failed to set tstamp mode to SND_PCM_TSTAMP_ENABLE: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params_set_tstamp_type(pcm_, params, SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY);
-    if (err < 0) {
-        std::cerr << "Failed to set tstamp type to SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    err = snd_pcm_sw_params(pcm_, params);
-    if (err < 0) {
-        std::cerr << "Failed to install software configuration for PCM: " << snd_strerror(err) << "\n";
-        exit(EXIT_FAILURE);
-    }
-
-    snd_pcm_sw_params_free(params);
-}
-
-void Recorder::tearDownAlsa() {
-    if (pcm_) {
-        int err = snd_pcm_close(pcm_);
-        if (err < 0) {
-            std::cerr << "Failed to close PCM: " << snd_strerror(err) << "\n";
-        }
-        pcm_ = nullptr;
-    }
+void Recorder::setMetrics(Metrics& metrics, const std::string& labels) {
+    xruns_ = metrics.counter("recorder_xruns_total" + labels, "Buffer over-runs of the capture device.");
+    poolExhausted_ = metrics.counter("recorder_pool_exhausted_total" + labels, "Packets dropped because the packet pool was empty.");
+    queueFull_ = metrics.counter("recorder_queue_full_total" + labels, "Packets dropped because the queue to the network thread was full.");
+    processingTime_ = metrics.histogram("recorder_processing_seconds" + labels, "Time spent reading a period.", 0.000001, 2);
 }
 
 int Recorder::capture() {
@@ -203,66 +85,57 @@ int Recorder::capture() {
 
     int err = 0, first = 1;
 
-    snd_pcm_status_t *status = nullptr;
-    snd_pcm_status_malloc(&status);
-
-    snd_pcm_audio_tstamp_config_t audio_tstamp_config;
-    audio_tstamp_config.type_requested = 0;
-    audio_tstamp_config.report_delay = 1;
-    snd_pcm_status_set_audio_htstamp_config(status, &audio_tstamp_config);
-
     DelayLockedLoop dll(periodTime_ * 0.000001);
     dll.reset(get_time());
 
     bool firstPeriod = true;
-    uint32_t lastSample = 0, nextSample = 0;
+    uint64_t lastSample = 0, nextSample = 0;
 
     while (running_) {
-        auto state = snd_pcm_state(pcm_);
-        if (state == SND_PCM_STATE_XRUN) {
-            std::cerr << "XRUN\n";
+        auto state = device_.state();
+        if (state == AudioDevice::State::Xrun) {
+            log_error("XRUN");
             err = recover(-EPIPE);
             if (err < 0) {
-                std::cerr << "Failed to recover from XRUN: " << snd_strerror(err) << "\n";
+                log_error("Failed to recover from XRUN: {}", device_.errorString(err));
                 return err;
             }            
             first = 1;
-        } else if (state == SND_PCM_STATE_SUSPENDED) {
-            std::cerr << "SUSPENDED\n";
+        } else if (state == AudioDevice::State::Suspended) {
+            log_error("SUSPENDED");
             err = recover(-ESTRPIPE);
             if (err < 0) {
-                std::cerr << "Failed to recover from SUSPEND: " << snd_strerror(err) << "\n";
+                log_error("Failed to recover from SUSPEND: {}", device_.errorString(err));
                 return err;
             }            
         }
 
-        err = snd_pcm_status(pcm_, status);
-        if (err < 0) {
-            std::cerr << "snd_pcm_status failed\n";
-            err = recover(static_cast<int>(err));
+        const long avail = device_.avail();
+        if (avail < 0) {
+            log_error("Failed to query avail");
+            err = recover(static_cast<int>(avail));
             if (err < 0) {
-                std::cerr << "Failed to update avail: " << snd_strerror(err) << "\n";
+                log_error("Failed to update avail: {}", device_.errorString(err));
                 return err;
             }            
             first = 1;
             continue;
         }
 
-        snd_pcm_sframes_t avail = snd_pcm_status_get_avail(status);
-        if (avail < static_cast<snd_pcm_sframes_t>(periodSize_)) {
+        if (avail < static_cast<long>(periodSize_)) {
             if (first) {
                 first = 0;
-                err = snd_pcm_start(pcm_);
+                err = device_.start();
                 if (err < 0) {
-                    std::cerr << "Failed to start: " << snd_strerror(err) << "\n";
+                    log_error("Failed to start: {}", device_.errorString(err));
                     return err;
                 }
             } else {
-                err = snd_pcm_wait(pcm_, -1);
+                err = device_.wait(-1);
                 if (err < 0) {
-                    std::cerr << "snd_pcm_wait failed\n";
+                    log_error("Failed to wait for device");
                     if ((err = recover(err)) < 0) {
-                        std::cerr << "Failed to wait for PCM: " << snd_strerror(err) << "\n";
+                        log_error("Failed to wait for PCM: {}", device_.errorString(err));
                         return err;
                     }                    
                     first = 1;
@@ -271,98 +144,161 @@ int Recorder::capture() {
             continue;
         }
 
-        dll.update(get_time());
-        uint32_t sample = static_cast<uint32_t>(static_cast<int64_t>(
-                std::floor(dll.t0() * sampleRate_ + 0.5)
-            ) % 4294967296);
+        const double begin = get_time();
+        dll.update(begin);
+        uint64_t sample = media_timestamp(dll.t0(), sampleRate_);
 
         int32_t error = 0;
         if (firstPeriod == false) {
-            auto diff = sample - lastSample;
+            const auto diff = static_cast<int64_t>(sample - lastSample);
             if (diff != periodSize_) {
-                error = periodSize_ - diff;
+                error = static_cast<int32_t>(periodSize_ - diff);
             }
             if (nextSample - error != sample) {
-                std::cout << sample << " " << nextSample << "\n";
+                log_info("{} {}", sample, nextSample);
             }
         }
         firstPeriod = false;
         lastSample = sample;
+        trace(TracePoint::CaptureBegin, sample + error);
 
-        snd_pcm_uframes_t size = periodSize_;
+        unsigned long size = periodSize_;
         while (size > 0) {
-            snd_pcm_uframes_t offset = 0, frames = size;
-            const snd_pcm_channel_area_t* channel_area = nullptr;
-            err = snd_pcm_mmap_begin(pcm_, &channel_area, &offset, &frames);
+            unsigned long offset = 0, frames = size;
+            int16_t* input = nullptr;
+            err = device_.begin(input, offset, frames);
             if (err < 0) {
-                std::cerr << "snd_pcm_mmap_begin failed\n";
+                log_error("Failed to begin transfer");
                 if ((err = recover(err)) < 0) {
-                    std::cerr << "Failed MMAP begin: " << snd_strerror(err) << "\n";
+                    log_error("Failed MMAP begin: {}", device_.errorString(err));
                     return err;
                 }                
                 first = 1;
+                break;
             }
 
-            Packet* packet = pool_.pop();
-            if (packet != nullptr) {
-                packet->setTimestamp(sample + error);
-                auto data = reinterpret_cast<int16_t*>(packet->data_);
-                if (mode_ == Mode::Click) {
-                    for (unsigned int frame = 0; frame < frames; frame++) {
-                        int16_t value = 0;
-                        if ((sample + frame) % sampleRate_ < 1000) {
-                            value = static_cast<int16_t>(sin(phase) * (.5 * 0x8000));
-                            phase += step;
-                            if (phase >= max_phase) {
-                                phase -= max_phase;
-                            }
-                        } else {
-                            phase = 0;
+            // A packet only holds periods with consecutive timestamps.
+            if (filled_ > 0 && timestamp_ + filled_ * periodSize_ != sample + error) {
+                sendPackets();
+            }
+            if (filled_ == 0) {
+                timestamp_ = sample + error;
+                for (std::size_t i = 0; i < streams_.size(); ++i) {
+                    Packet* packet = pool_.pop();
+                    packets_[i] = packet;
+                    if (packet != nullptr) {
+                        packet->setStream(streams_[i].id, epoch_);
+                        packet->setFormat(sampleRate_, static_cast<uint16_t>(periodSize_),
+                            static_cast<uint8_t>(streams_[i].channels));
+                        packet->setTimestamp(timestamp_);
+                    } else {
+                        poolExhausted_.add();
+                        log_error("out of buffers");
+                    }
+                }
+            }
+            const auto base = filled_ * periodSize_;
+            const bool sent = std::any_of(packets_.begin(), packets_.end(), [] (Packet* packet) { return packet != nullptr; });
+
+            if (mode_ == Mode::Click) {
+                for (unsigned int frame = 0; frame < frames; frame++) {
+                    int16_t value = 0;
+                    if ((sample + frame) % sampleRate_ < 1000) {
+                        value = static_cast<int16_t>(sin(phase) * (.5 * 0x8000));
+                        phase += step;
+                        if (phase >= max_phase) {
+                            phase -= max_phase;
                         }
-                        for (unsigned int channel = 0; channel < channels_; channel++) {
-                            *data = value;
-                            data += 1;
+                    } else {
+                        phase = 0;
+                    }
+                    for (std::size_t i = 0; i < streams_.size(); ++i) {
+                        if (packets_[i] != nullptr) {
+                            auto data = reinterpret_cast<int16_t*>(packets_[i]->data_) + (base + frame) * streams_[i].channels;
+                            std::fill(data, data + streams_[i].channels, value);
                         }
                     }
-                } else if (mode_ == Mode::Capture) {
-                    for (unsigned int frame = 0; frame < frames; frame++) {
-                        for (unsigned int channel = 0; channel < channels_; channel++) {
-                            auto sampleAddress = (int16_t*)channel_area[channel].addr;
-                            sampleAddress += (channel_area[channel].first + (frame + offset) * channel_area[channel].step) / 16;
-                            *data = *sampleAddress;
-                            data += 1;
+                }
+            } else if (mode_ == Mode::Capture) {
+                for (std::size_t i = 0; i < streams_.size(); ++i) {
+                    if (packets_[i] == nullptr) {
+                        continue;
+                    }
+                    auto data = reinterpret_cast<int16_t*>(packets_[i]->data_) + base * streams_[i].channels;
+                    const auto& stream = streams_[i];
+                    if (stream.channels == channels_) {
+                        memcpy(data, input, frames * channels_ * sizeof(int16_t));
+                    } else {
+                        for (unsigned int frame = 0; frame < frames; frame++) {
+                            memcpy(data + frame * stream.channels, input + frame * channels_ + stream.firstChannel,
+                                stream.channels * sizeof(int16_t));
                         }
                     }
                 }
+            }
 
+            if (sent) {
                 nextSample = sample + periodSize_;
-
-                transmitter_.send(packet);
-            } else {
-                std::cerr << "out of buffers\n";
+            }
+            filled_ += 1;
+            if (filled_ == periodsPerPacket_) {
+                sendPackets();
             }
 
-            snd_pcm_sframes_t commit_result = snd_pcm_mmap_commit(pcm_, offset, frames);
-            if (commit_result < 0 || (snd_pcm_uframes_t)commit_result != frames) {
-                std::cerr << "snd_pcm_mmap_commit failed\n";
+            const long commit_result = device_.commit(offset, frames);
+            if (commit_result < 0 || static_cast<unsigned long>(commit_result) != frames) {
+                log_error("Failed to commit transfer");
                 if ((err = recover(commit_result >= 0 ? -EPIPE : static_cast<int>(commit_result))) < 0) {
-                    std::cerr << "Failed MMAP commit: " << snd_strerror(err) << "\n";
+                    log_error("Failed MMAP commit: {}", device_.errorString(err));
                     return err;
                 }                
                 first = 1;
             }
 
-            sample += static_cast<uint32_t>(frames);
+            sample += frames;
 
             size -= frames;
         }
+        trace(TracePoint::CaptureEnd, lastSample + error);
+        processingTime_.observe(get_time() - begin);
     }
 
-    snd_pcm_status_free(status);
-
     return 0;
 }
 
+void Recorder::sendPackets() {
+    bool sent = false;
+    for (std::size_t i = 0; i < streams_.size(); ++i) {
+        if (packets_[i] != nullptr) {
+            packets_[i]->setPeriods(filled_, periodSize_ * streams_[i].channels * static_cast<uint32_t>(sizeof(int16_t)));
+            if (transmitter_.send(packets_[i], queue_)) {
+                sent = true;
+            } else {
+                pool_.push(packets_[i]);
+                queueFull_.add();
+            }
+            packets_[i] = nullptr;
+        }
+    }
+    if (sent) {
+        trace(TracePoint::SendQueued, timestamp_);
+    }
+    filled_ = 0;
+}
+
+void Recorder::releasePackets() {
+    for (auto& packet : packets_) {
+        if (packet != nullptr) {
+            pool_.push(packet);
+            packet = nullptr;
+        }
+    }
+    filled_ = 0;
+}
+
 int Recorder::recover(int err) {
-    return snd_pcm_recover(pcm_, err, 1);
+    if (err == -EPIPE) {
+        xruns_.add();
+    }
+    return device_.recover(err);
 }
@@ -4,16 +4,26 @@
 #ifndef __RECORDER_H
 #define __RECORDER_H
 
+#include "Realtime.h"
+#include "Metrics.h"
+
 #include <thread>
 #include <memory>
+#include <string>
 #include <atomic>
-#include <alsa/asoundlib.h>
+#include <vector>
+#include <cstdint>
 #include <cstddef>
 
+class AudioDevice;
 class Transmitter;
 class PacketPool;
+class Packet;
 
-/** A class used to capture real-time audio data from ALSA.
+/** A class used to capture real-time audio data from an audio device. The
+ *  channels of the device can be split into several streams, each sent in
+ *  its own packets. Several consecutive periods can be sent in one packet to
+ *  reduce the packet rate at small period times.
  */
 class Recorder {
 public:
@@ -24,18 +34,29 @@ public:
         Click
     };
 
+    /** A stream made of consecutive channels of the device.
+     */
+    struct Stream {
+        uint16_t id;                /**< The ID of the stream written to the packet header. */
+        unsigned int firstChannel;  /**< The first channel of the device in the stream.     */
+        unsigned int channels;      /**< The number of channels of the stream.              */
+    };
+
     /** Constructor.
      *
-     *  \param deviceName the name of the ALSA device.
+     *  \param device the audio device used for capture.
      *  \param sampleRate the sample rate.
      *  \param periodTime the period time in microseconds.
-     *  \param channel the number of channels.
+     *  \param channel the number of channels of the device.
      *  \param mode the mode (either Capture or Click).
+     *  \param streams the streams the channels are sent in.
      *  \param transmitter a reference to the transmitter.
-     *  \param poll a pool of packets.
+     *  \param poll a pool of packets large enough for the payload of every stream.
+     *  \param periodsPerPacket the number of periods sent in one packet.
      */
-    Recorder(const std::string& deviceName, unsigned int sampleRate, unsigned int periodTime, 
-        unsigned int channels, Mode mode, Transmitter& transmitter, PacketPool& pool);
+    Recorder(AudioDevice& device, unsigned int sampleRate, unsigned int periodTime,
+        unsigned int channels, Mode mode, const std::vector<Stream>& streams, Transmitter& transmitter, PacketPool& pool,
+        unsigned int periodsPerPacket);
 
     Recorder(const Recorder&) = delete;
     Recorder& operator =(const Recorder&) = delete;
@@ -52,23 +73,20 @@ public:
      */
     void stop();
 
-private:
-    /** Setup ALSA.
-     */
-    void setUpAlsa();
-
-    /** Set ALSA hardware parameters.
-     */
-    void setHardwareParameters();
-
-    /** Set ALSA software parameters.
+    /** Sets the scheduling settings of the audio thread. Takes effect with the next start().
+     *
+     *  \param settings the scheduling settings.
      */
-    void setSoftwareParameters();
+    void setThreadSettings(const ThreadSettings& settings);
 
-    /** Tear down ALSA.
+    /** Registers the metrics of the audio thread. Must be called before start().
+     *
+     *  \param metrics the metrics segment.
+     *  \param labels the Prometheus labels distinguishing the metrics of this recorder.
      */
-    void tearDownAlsa();
+    void setMetrics(Metrics& metrics, const std::string& labels);
 
+private:
     /** Capture method.
      */
     int capture();
@@ -79,18 +97,37 @@ private:
      */
     int recover(int err);
 
-    const std::string deviceName_;      /**< The name of the ALSA audio device.     */
+    /** Sends the packets of the current periods.
+     */
+    void sendPackets();
+
+    /** Returns the packets of the current periods to the pool without sending them.
+     */
+    void releasePackets();
+
+    AudioDevice& device_;               /**< The audio device.                      */
     const unsigned int sampleRate_;     /**< The sample rate.                       */
     const unsigned int periodTime_;     /**< The period time in microseconds.       */
     const unsigned int periodSize_;     /**< The period size in frames.             */
     const unsigned int channels_;       /**< The number of channels per period.     */
     const Mode mode_;                   /**< The mode used to generate audio data.  */
+    const std::vector<Stream> streams_; /**< The streams.                           */
+    const unsigned int periodsPerPacket_;   /**< The number of periods sent in one packet.   */
+    uint32_t epoch_;                    /**< The start time of the stream in seconds since the Unix epoch. */
 
     Transmitter& transmitter_;          /**< The transmitter used to send the packets.       */
     PacketPool& pool_;                  /**< A pool of packets.                              */
-    snd_pcm_t* pcm_;                    /**< ALSA handle.                                    */
+    const std::size_t queue_;           /**< The queue of the thread in the transmitter.     */
+    std::vector<Packet*> packets_;      /**< The packets of the current periods, one per stream. */
+    unsigned int filled_;               /**< The number of periods in the current packets.   */
+    uint64_t timestamp_;                /**< The timestamp of the current packets.           */
+    ThreadSettings settings_;           /**< The scheduling settings of the audio thread.    */
     std::unique_ptr<std::thread> thread_;   /**< The internal audio thread.                  */
     std::atomic<bool> running_;         /**< True if the player is started, otherwise false. */
+    MetricCounter xruns_;               /**< The number of device over-runs.                 */
+    MetricCounter poolExhausted_;       /**< The number of periods dropped for lack of packets. */
+    MetricCounter queueFull_;           /**< The number of packets dropped because the queue was full. */
+    MetricHistogram processingTime_;    /**< The time spent reading a period.                */
 };
 
 #endif  // __RECORDER_H
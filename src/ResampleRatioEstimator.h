@@ -30,6 +30,17 @@ public:
         w2_ = omega / 1.5;
     }
 
+    /** Starts the loop at a resampling ratio, e.g. the one a previous run
+     *  converged to, instead of 1.
+     *
+     *  \param ratio the resampling ratio.
+     */
+    void setRatio(double ratio) {
+        z1_ = 0;
+        z2_ = 0;
+        z3_ = 1.0 - ratio;
+    }
+
     /** Estimates the current resampling ratio.
      *
      *  \param err the current delay error.
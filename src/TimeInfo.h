@@ -0,0 +1,94 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __TIMEINFO_H
+#define __TIMEINFO_H
+
+#include <atomic>
+#include <cstdint>
+
+/** A snapshot of the timing state of the audio thread.
+ */
+struct TimeInfo {
+    double time;            /**< The estimated time of the next cycle in seconds.                 */
+    double periodTime;      /**< The estimated duration of the current period in seconds.         */
+    uint64_t sample;        /**< The number of frames consumed by the audio thread at time.      */
+    uint32_t periodSize;    /**< The number of frames consumed during the current period.        */
+    uint32_t generation;    /**< Incremented each time the audio thread resynchronizes after an XRUN. */
+    uint32_t latency;       /**< The target latency in periods the sample count refers to.       */
+};
+
+/** Timing state shared between the audio thread and the network thread.
+ *
+ *  The audio thread publishes a complete TimeInfo once per period and the
+ *  network thread reads the latest consistent snapshot at any time. The
+ *  implementation is a sequence lock: the writer never blocks and never
+ *  fails, the reader retries in the rare case it overlaps with a write.
+ *  There must be only one writer.
+ */
+class SharedTimeInfo {
+public:
+    /** Constructor
+     */
+    SharedTimeInfo()
+    : sequence_(0)
+    , time_(0)
+    , periodTime_(0)
+    , sample_(0)
+    , periodSize_(0)
+    , generation_(0)
+    , latency_(0) {
+    }
+
+    SharedTimeInfo(const SharedTimeInfo&) = delete;
+    SharedTimeInfo& operator =(const SharedTimeInfo&) = delete;
+
+    /** Publishes a new snapshot. Must only be called from the audio thread.
+     *
+     *  \param info the timing state to publish.
+     */
+    void publish(const TimeInfo& info) {
+        const auto sequence = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        time_.store(info.time, std::memory_order_relaxed);
+        periodTime_.store(info.periodTime, std::memory_order_relaxed);
+        sample_.store(info.sample, std::memory_order_relaxed);
+        periodSize_.store(info.periodSize, std::memory_order_relaxed);
+        generation_.store(info.generation, std::memory_order_relaxed);
+        latency_.store(info.latency, std::memory_order_relaxed);
+        sequence_.store(sequence + 2, std::memory_order_release);
+    }
+
+    /** Reads the latest snapshot.
+     *
+     *  \param info the snapshot is written to this reference.
+     *  \return the sequence number of the snapshot, 0 if nothing has been published yet.
+     */
+    uint64_t read(TimeInfo& info) const {
+        uint64_t before = 0, after = 0;
+        do {
+            before = sequence_.load(std::memory_order_acquire);
+            info.time = time_.load(std::memory_order_relaxed);
+            info.periodTime = periodTime_.load(std::memory_order_relaxed);
+            info.sample = sample_.load(std::memory_order_relaxed);
+            info.periodSize = periodSize_.load(std::memory_order_relaxed);
+            info.generation = generation_.load(std::memory_order_relaxed);
+            info.latency = latency_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence_.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return before;
+    }
+
+private:
+    std::atomic<uint64_t> sequence_;        /**< The sequence counter, odd while a write is in progress. */
+    std::atomic<double> time_;              /**< The published time.            */
+    std::atomic<double> periodTime_;        /**< The published period time.     */
+    std::atomic<uint64_t> sample_;          /**< The published sample count.    */
+    std::atomic<uint32_t> periodSize_;      /**< The published period size.     */
+    std::atomic<uint32_t> generation_;      /**< The published generation.      */
+    std::atomic<uint32_t> latency_;         /**< The published latency.         */
+};
+
+#endif  // __TIMEINFO_H
@@ -0,0 +1,125 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Trace.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+thread_local TraceRing* trace_ring = nullptr;
+
+/** The ring of a thread together with its storage.
+ */
+struct TraceBuffer {
+    std::string name;                   /**< The name of the thread.        */
+    int32_t tid;                        /**< The kernel ID of the thread.   */
+    std::vector<TraceEvent> events;     /**< The storage of the ring.       */
+    TraceRing ring;                     /**< The ring.                      */
+};
+
+/** The state of the tracer, rings are kept after their threads exit.
+ */
+static struct {
+    std::mutex mutex;                                   /**< Guards the buffers.                */
+    bool enabled;                                       /**< True if tracing is enabled.        */
+    std::string program;                                /**< The name of the traced program.    */
+    std::size_t events;                                 /**< The capacity of each ring.         */
+    uint64_t tsc0;                                      /**< trace_clock() at trace_enable().   */
+    uint64_t monotonic0;                                /**< CLOCK_MONOTONIC_RAW at trace_enable(). */
+    uint64_t realtime0;                                 /**< CLOCK_REALTIME at trace_enable().  */
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;  /**< The rings of all threads.          */
+} tracer;
+
+/** Returns the value of a clock in nanoseconds.
+ */
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/** Copies a name into a fixed size field, padded with zeros.
+ */
+static void copy_name(char (&destination)[16], const std::string& source) {
+    memset(destination, 0, sizeof(destination));
+    memcpy(destination, source.data(), std::min(sizeof(destination) - 1, source.size()));
+}
+
+void trace_enable(const std::string& program, std::size_t events) {
+    std::lock_guard<std::mutex> lock(tracer.mutex);
+    std::size_t capacity = 1;
+    while (capacity < events) {
+        capacity <<= 1;
+    }
+    tracer.enabled = true;
+    tracer.program = program;
+    tracer.events = capacity;
+    tracer.realtime0 = clock_ns(CLOCK_REALTIME);
+    tracer.monotonic0 = clock_ns(CLOCK_MONOTONIC_RAW);
+    tracer.tsc0 = trace_clock();
+}
+
+void trace_register_thread(const std::string& name) {
+    std::lock_guard<std::mutex> lock(tracer.mutex);
+    if (!tracer.enabled || trace_ring) {
+        return;
+    }
+    std::unique_ptr<TraceBuffer> buffer(new TraceBuffer());
+    buffer->name = name;
+    buffer->tid = static_cast<int32_t>(syscall(SYS_gettid));
+    // Value-initializing the storage touches every page before the real-time loop.
+    buffer->events.resize(tracer.events);
+    buffer->ring.events = buffer->events.data();
+    buffer->ring.mask = tracer.events - 1;
+    buffer->ring.head = 0;
+    trace_ring = &buffer->ring;
+    tracer.buffers.push_back(std::move(buffer));
+}
+
+void trace_dump(const std::string& path) {
+    std::lock_guard<std::mutex> lock(tracer.mutex);
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TraceMagic;
+    header.version = TraceVersion;
+    header.pid = static_cast<int32_t>(getpid());
+    header.threads = static_cast<uint32_t>(tracer.buffers.size());
+    copy_name(header.name, tracer.program);
+    header.tsc0 = tracer.tsc0;
+    header.monotonic0 = tracer.monotonic0;
+    header.realtime0 = tracer.realtime0;
+    header.monotonic1 = clock_ns(CLOCK_MONOTONIC_RAW);
+    header.tsc1 = trace_clock();
+
+    std::unique_ptr<FILE, int (*)(FILE*)> file(fopen(path.c_str(), "wb"), fclose);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file.get()) == 1;
+    for (const auto& buffer : tracer.buffers) {
+        const auto& ring = buffer->ring;
+        const uint64_t count = std::min<uint64_t>(ring.head, ring.mask + 1);
+        TraceThread thread;
+        memset(&thread, 0, sizeof(thread));
+        copy_name(thread.name, buffer->name);
+        thread.tid = buffer->tid;
+        thread.events = count;
+        ok = ok && fwrite(&thread, sizeof(thread), 1, file.get()) == 1;
+        // Oldest first: the ring wraps at head once it has been filled.
+        for (uint64_t i = ring.head - count; ok && i < ring.head; ++i) {
+            ok = fwrite(&ring.events[i & ring.mask], sizeof(TraceEvent), 1, file.get()) == 1;
+        }
+    }
+    if (!ok) {
+        throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
+    }
+}
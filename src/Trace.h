@@ -0,0 +1,132 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/** The stages of the pipeline recorded by tracepoints. The ID recorded with
+ *  an event is the media timestamp of the period or packet concerned.
+ */
+enum class TracePoint : uint32_t {
+    CaptureBegin,       /**< The capture thread starts to read a period.             */
+    CaptureEnd,         /**< The capture thread has read and queued a period.        */
+    SendQueued,         /**< A packet is handed to the transmitter.                  */
+    SendComplete,       /**< The network thread has sent a packet.                   */
+    ReceiveBegin,       /**< The network thread starts to process a packet.          */
+    ReceiveEnd,         /**< A packet is resampled and written to the circular buffer. */
+    PlaybackBegin,      /**< The playback thread starts to write a period.           */
+    PlaybackRead,       /**< A period is read from the circular buffer.              */
+    PlaybackEnd         /**< The playback thread has written a period.               */
+};
+
+/** An event in a trace ring and in a trace file.
+ */
+struct TraceEvent {
+    uint64_t tsc;       /**< The value of trace_clock().    */
+    uint64_t id;        /**< The media timestamp.           */
+    uint32_t point;     /**< The TracePoint.                */
+    uint32_t reserved;  /**< Always zero.                   */
+};
+
+/** The header of a trace file, followed by a TraceThread and its events for
+ *  every thread. All fields are in host byte order.
+ */
+struct TraceHeader {
+    uint32_t magic;         /**< TraceMagic.                                            */
+    uint32_t version;       /**< The version of the file layout.                        */
+    int32_t pid;            /**< The ID of the traced process.                          */
+    uint32_t threads;       /**< The number of threads in the file.                     */
+    char name[16];          /**< The name of the traced program.                        */
+    uint64_t tsc0;          /**< trace_clock() when tracing was enabled.                */
+    uint64_t tsc1;          /**< trace_clock() when the trace was dumped.               */
+    uint64_t monotonic0;    /**< CLOCK_MONOTONIC_RAW in ns when tracing was enabled.    */
+    uint64_t monotonic1;    /**< CLOCK_MONOTONIC_RAW in ns when the trace was dumped.   */
+    uint64_t realtime0;     /**< CLOCK_REALTIME in ns when tracing was enabled.         */
+};
+
+/** The description of a thread in a trace file.
+ */
+struct TraceThread {
+    char name[16];          /**< The name of the thread.            */
+    int32_t tid;            /**< The kernel ID of the thread.       */
+    uint32_t reserved;      /**< Always zero.                       */
+    uint64_t events;        /**< The number of events that follow.  */
+};
+
+static const uint32_t TraceMagic = 0x43525453;  // "STRC"
+static const uint32_t TraceVersion = 1;
+
+/** The trace ring of a thread. Once full the oldest events are overwritten,
+ *  so a dump holds the most recent history of every thread.
+ */
+struct TraceRing {
+    TraceEvent* events;     /**< The events, a power of two of them.    */
+    uint64_t mask;          /**< The number of events minus one.        */
+    uint64_t head;          /**< The number of events recorded.         */
+};
+
+/** The ring of the calling thread, nullptr if the thread is not traced.
+ */
+extern thread_local TraceRing* trace_ring;
+
+/** Returns a cheap monotonic timestamp, the TSC on x86 and nanoseconds elsewhere.
+ */
+inline uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+/** Records an event in the ring of the calling thread. Does nothing if
+ *  tracing is disabled or the thread is not registered.
+ *
+ *  \param point the tracepoint.
+ *  \param id the media timestamp of the period or packet.
+ */
+inline void trace(TracePoint point, uint64_t id) {
+    TraceRing* ring = trace_ring;
+    if (ring) {
+        TraceEvent& event = ring->events[ring->head & ring->mask];
+        event.tsc = trace_clock();
+        event.id = id;
+        event.point = static_cast<uint32_t>(point);
+        event.reserved = 0;
+        ring->head += 1;
+    }
+}
+
+/** Enables tracing for threads registered afterwards.
+ *
+ *  \param program the name of the traced program.
+ *  \param events the capacity of each thread ring, rounded up to a power of two.
+ */
+void trace_enable(const std::string& program, std::size_t events);
+
+/** Allocates the trace ring of the calling thread if tracing is enabled.
+ *  Called by threads before entering their real-time loop.
+ *
+ *  \param name the name of the thread.
+ */
+void trace_register_thread(const std::string& name);
+
+/** Writes the rings of all threads registered so far to a file. Must be
+ *  called after the traced threads have stopped. Throws a std::runtime_error
+ *  if the file cannot be written.
+ *
+ *  \param path the path of the file.
+ */
+void trace_dump(const std::string& path);
+
+#endif  // __TRACE_H
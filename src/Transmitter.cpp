@@ -4,17 +4,75 @@
 #include "Transmitter.h"
 #include "PacketPool.h"
 #include "Packet.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Uring.h"
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <linux/net_tstamp.h>
+#include <net/if.h>
+
+static const std::size_t MaxBatch = 32;         // packets per sendmmsg() call
+static const std::size_t QueueCapacity = 1024;  // packets per queue of a thread
+static const std::size_t MaxQueues = 64;        // threads handing over packets
+static const int64_t LateMargin = 100000;       // lead in ns given to late packets paced by the kernel
+static const unsigned int UringEntries = 256;   // sendmsg requests per submission
+
+/** Returns the current time of the given clock in nanoseconds.
+ */
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
 
 Transmitter::Transmitter(const char* address, unsigned short port, PacketPool& pool)
-: endpoint_(boost::asio::ip::address::from_string(address), port)
+: Transmitter(std::vector<boost::asio::ip::udp::endpoint>(1,
+    boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string(address), port)), pool) {
+}
+
+Transmitter::Transmitter(const std::vector<boost::asio::ip::udp::endpoint>& endpoints, PacketPool& pool)
+: endpoints_(endpoints)
+, interfaces_()
+, destinations_()
 , pool_(pool)
+, queues_(MaxQueues)
+, queueCount_(0)
+, nextQueue_(0)
+, scheduled_(false)
+, batch_()
+, payloads_(MaxBatch)
+, messages_(MaxBatch * std::max<std::size_t>(endpoints.size(), 1))
+, names_(messages_.size())
+, ends_(MaxBatch)
+, messageCount_(0)
+, next_(0)
+, released_(0)
+, pacing_(Pacing::Off)
+, clock_(CLOCK_MONOTONIC)
+, sampleRate_(0)
+, offset_(0)
+, lastDeparture_(0)
+, departures_(MaxBatch)
+, controls_(messages_.size())
+, uring_()
+, historySize_(0)
+, history_()
 , service_()
 , work_(service_)
 , socket_(service_, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), 0))
+, timer_(service_)
+, packets_()
+, sendErrors_()
+, latePackets_()
+, historyPackets_()
 , thread_(new std::thread([this] () { service_.run(); })) {
     socket_.non_blocking(true);
+    batch_.reserve(MaxBatch);
 }
 
 Transmitter::~Transmitter() {
@@ -25,18 +83,430 @@ Transmitter::~Transmitter() {
     }
     thread_.reset();
     service_.reset();
+    for (std::size_t i = released_; i < batch_.size(); ++i) {
+        pool_.push(batch_[i]);
+    }
+    Packet* packet = nullptr;
+    for (std::size_t i = 0; i < queueCount_; ++i) {
+        while (queues_[i]->try_dequeue(packet)) {
+            pool_.push(packet);
+        }
+    }
+}
+
+bool Transmitter::setIoUring() {
+    std::shared_ptr<Uring> uring;
+    try {
+        uring = std::make_shared<Uring>(UringEntries);
+    } catch (const std::exception& ex) {
+        std::cerr << ex.what() << ", using sendmmsg()\n";
+        return false;
+    }
+    service_.post([this, uring] () { uring_ = uring; });
+    return true;
+}
+
+bool Transmitter::setRedundantPath(const std::vector<boost::asio::ip::udp::endpoint>& endpoints,
+    const std::string& primary, const std::string& redundant) {
+    const int primaryIndex = primary.empty() ? 0 : static_cast<int>(if_nametoindex(primary.c_str()));
+    const int redundantIndex = redundant.empty() ? 0 : static_cast<int>(if_nametoindex(redundant.c_str()));
+    if ((!primary.empty() && primaryIndex == 0) || (!redundant.empty() && redundantIndex == 0)) {
+        return false;
+    }
+    service_.post([this, endpoints, primaryIndex, redundantIndex] () {
+        interfaces_.assign(endpoints_.size(), primaryIndex);
+        interfaces_.insert(interfaces_.end(), endpoints.size(), redundantIndex);
+        endpoints_.insert(endpoints_.end(), endpoints.begin(), endpoints.end());
+    });
+    return true;
+}
+
+void Transmitter::setThreadSettings(const ThreadSettings& settings) {
+    service_.post([settings] () { applyThreadSettings("network", settings); });
+}
+
+bool Transmitter::setSocketSettings(const SocketSettings& settings) {
+    return applySocketSettings("network", socket_.native_handle(), settings);
+}
+
+void Transmitter::setMetrics(Metrics& metrics) {
+    const auto packets = metrics.counter("transmitter_packets_total", "Packets sent.");
+    const auto sendErrors = metrics.counter("transmitter_send_errors_total", "Packets that failed to send.");
+    const auto latePackets = metrics.counter("transmitter_late_packets_total",
+        "Paced packets handed over after their departure time.");
+    const auto historyPackets = metrics.counter("transmitter_history_packets_total",
+        "Recent packets sent again to receivers joining late.");
+    service_.post([this, packets, sendErrors, latePackets, historyPackets] () {
+        packets_ = packets;
+        sendErrors_ = sendErrors;
+        latePackets_ = latePackets;
+        historyPackets_ = historyPackets;
+    });
 }
 
-void Transmitter::send(Packet* packet) {
-    auto buffer = boost::asio::buffer(packet->packet_, packet->packetSize_);
-    socket_.async_send_to(buffer, endpoint_,
-        [this, packet] (const boost::system::error_code& ec, 
-            std::size_t bytes_transferred) {
-            if (ec) {
-                std::cerr << "Failed to send packet: " << ec.message() << "\n";
-            } else {
-                assert(bytes_transferred == packet->packetSize_);
+Transmitter::Pacing Transmitter::setPacing(Pacing pacing, unsigned int sampleRate, unsigned int offset) {
+    clockid_t clock = CLOCK_MONOTONIC;
+    if (pacing == Pacing::Fq || pacing == Pacing::Etf) {
+        struct sock_txtime config;
+        config.clockid = pacing == Pacing::Etf ? CLOCK_TAI : CLOCK_MONOTONIC;
+        config.flags = 0;
+        if (setsockopt(socket_.native_handle(), SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0) {
+            clock = config.clockid;
+        } else {
+            log_error("Failed to enable SO_TXTIME, pacing in user space: {}", LogErrno{errno});
+            pacing = Pacing::User;
+        }
+    }
+    service_.post([this, pacing, clock, sampleRate, offset] () {
+        pacing_ = pacing;
+        clock_ = clock;
+        sampleRate_ = sampleRate;
+        offset_ = static_cast<int64_t>(offset) * 1000;
+        lastDeparture_ = 0;
+    });
+    return pacing;
+}
+
+std::size_t Transmitter::addQueue() {
+    const auto index = queueCount_.load(std::memory_order_relaxed);
+    if (index >= MaxQueues) {
+        throw std::runtime_error("Too many threads sending packets");
+    }
+    queues_[index].reset(new moodycamel::ReaderWriterQueue<Packet*>(QueueCapacity));
+    queueCount_.store(index + 1, std::memory_order_release);
+    return index;
+}
+
+bool Transmitter::send(Packet* packet, std::size_t queue) {
+    // try_enqueue() never allocates, a full queue is left to the caller.
+    if (!queues_[queue]->try_enqueue(packet)) {
+        return false;
+    }
+    if (!scheduled_.exchange(true)) {
+        service_.post([this] () { flush(); });
+    }
+    return true;
+}
+
+void Transmitter::addDestination(uint16_t streamId, const boost::asio::ip::udp::endpoint& endpoint) {
+    service_.post([this, streamId, endpoint] () {
+        auto& endpoints = destinations_[streamId];
+        if (std::find(endpoints.begin(), endpoints.end(), endpoint) == endpoints.end()) {
+            endpoints.push_back(endpoint);
+        }
+    });
+}
+
+void Transmitter::removeDestination(uint16_t streamId, const boost::asio::ip::udp::endpoint& endpoint) {
+    service_.post([this, streamId, endpoint] () {
+        auto it = destinations_.find(streamId);
+        if (it != destinations_.end()) {
+            it->second.erase(std::remove(it->second.begin(), it->second.end(), endpoint), it->second.end());
+            if (it->second.empty()) {
+                destinations_.erase(it);
+            }
+        }
+    });
+}
+
+void Transmitter::setHistory(unsigned int packets) {
+    service_.post([this, packets] () {
+        historySize_ = packets;
+        history_.clear();
+    });
+}
+
+void Transmitter::sendHistory(uint16_t streamId, const boost::asio::ip::udp::endpoint& endpoint, unsigned int time) {
+    service_.post([this, streamId, endpoint, time] () {
+        const auto it = history_.find(streamId);
+        if (it == history_.end()) {
+            return;
+        }
+        auto& history = it->second;
+        const auto count = history.packets.size();
+        auto& last = history.packets[(history.next + count - 1) % count];
+        const Packet newest(last.data(), static_cast<uint32_t>(last.size()));
+        const uint64_t frames = static_cast<uint64_t>(time) * newest.getSampleRate() / 1000000;
+        const uint64_t first = newest.getTimestamp() > frames ? newest.getTimestamp() - frames : 0;
+        // With SO_TXTIME enabled, a message without a departure time departs
+        // at time 0 and the etf qdisc drops it, so the burst departs now.
+        MessageControl control;
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_name = const_cast<struct sockaddr*>(endpoint.data());
+        header.msg_namelen = static_cast<socklen_t>(endpoint.size());
+        if (pacing_ == Pacing::Fq || pacing_ == Pacing::Etf) {
+            auto cmsg = reinterpret_cast<struct cmsghdr*>(control.buffer);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_TXTIME;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            const auto departure = static_cast<uint64_t>(clock_ns(clock_) + std::max(offset_, LateMargin));
+            memcpy(CMSG_DATA(cmsg), &departure, sizeof(departure));
+            header.msg_control = control.buffer;
+            header.msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+        }
+        unsigned int sent = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            auto& bytes = history.packets[(history.next + i) % count];
+            const Packet packet(bytes.data(), static_cast<uint32_t>(bytes.size()));
+            if (packet.getEpoch() != newest.getEpoch() || packet.getTimestamp() < first) {
+                continue;
+            }
+            struct iovec payload;
+            payload.iov_base = bytes.data();
+            payload.iov_len = bytes.size();
+            header.msg_iov = &payload;
+            header.msg_iovlen = 1;
+            if (sendmsg(socket_.native_handle(), &header, MSG_DONTWAIT) < 0) {
+                sendErrors_.add();
+                log_error("Failed to send history: {}", LogErrno{errno});
+                break;
+            }
+            historyPackets_.add();
+            sent += 1;
+        }
+        log_info("Sent {} recent packets of stream {}", sent, static_cast<unsigned int>(streamId));
+    });
+}
+
+void Transmitter::remember(const Packet& packet) {
+    auto& history = history_[packet.getStreamId()];
+    if (history.packets.size() < historySize_) {
+        history.packets.emplace_back(packet.packet_, packet.packet_ + packet.length_);
+        return;
+    }
+    // Reuses the capacity of the oldest slot, packets of a stream have the same size.
+    history.packets[history.next].assign(packet.packet_, packet.packet_ + packet.length_);
+    history.next = (history.next + 1) % history.packets.size();
+}
+
+void Transmitter::prepareBatch() {
+    // The messages are ordered by packet, then destination. The addresses
+    // are copied, so destinations may change while the batch is sent. The
+    // arrays only grow when destinations are added.
+    std::size_t total = 0;
+    for (const auto packet : batch_) {
+        const auto it = destinations_.find(packet->getStreamId());
+        total += endpoints_.size() + (it != destinations_.end() ? it->second.size() : 0);
+    }
+    if (messages_.size() < total) {
+        messages_.resize(total);
+        names_.resize(total);
+        controls_.resize(total);
+    }
+    scheduleBatch();
+    const bool txtime = pacing_ == Pacing::Fq || pacing_ == Pacing::Etf;
+
+    messageCount_ = 0;
+    for (std::size_t i = 0; i < batch_.size(); ++i) {
+        payloads_[i].iov_base = batch_[i]->packet_;
+        payloads_[i].iov_len = batch_[i]->length_;
+
+        const auto it = destinations_.find(batch_[i]->getStreamId());
+        const auto count = endpoints_.size() + (it != destinations_.end() ? it->second.size() : 0);
+        for (std::size_t j = 0; j < count; ++j) {
+            const auto& endpoint = j < endpoints_.size() ? endpoints_[j] : it->second[j - endpoints_.size()];
+            memcpy(&names_[messageCount_], endpoint.data(), endpoint.size());
+            auto& header = messages_[messageCount_].msg_hdr;
+            header.msg_name = &names_[messageCount_];
+            header.msg_namelen = static_cast<socklen_t>(endpoint.size());
+            header.msg_iov = &payloads_[i];
+            header.msg_iovlen = 1;
+            char* buffer = controls_[messageCount_].buffer;
+            std::size_t length = 0;
+            if (txtime) {
+                auto control = reinterpret_cast<struct cmsghdr*>(buffer);
+                control->cmsg_level = SOL_SOCKET;
+                control->cmsg_type = SCM_TXTIME;
+                control->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                const auto departure = static_cast<uint64_t>(departures_[i]);
+                memcpy(CMSG_DATA(control), &departure, sizeof(departure));
+                length += CMSG_SPACE(sizeof(uint64_t));
+            }
+            const int ifindex = j < interfaces_.size() ? interfaces_[j] : 0;
+            if (ifindex != 0) {
+                // Selects the outgoing interface of this message, also for multicast.
+                auto control = reinterpret_cast<struct cmsghdr*>(buffer + length);
+                control->cmsg_level = IPPROTO_IP;
+                control->cmsg_type = IP_PKTINFO;
+                control->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+                struct in_pktinfo info;
+                memset(&info, 0, sizeof(info));
+                info.ipi_ifindex = ifindex;
+                memcpy(CMSG_DATA(control), &info, sizeof(info));
+                length += CMSG_SPACE(sizeof(struct in_pktinfo));
+            }
+            header.msg_control = length > 0 ? buffer : nullptr;
+            header.msg_controllen = length;
+            messageCount_ += 1;
+        }
+        ends_[i] = messageCount_;
+    }
+    if (messageCount_ == 0) {
+        // No packet has a destination, e.g. before a receiver has joined.
+        release();
+    }
+}
+
+void Transmitter::release() {
+    while (released_ < batch_.size() && next_ >= ends_[released_]) {
+        Packet* packet = batch_[released_++];
+        packets_.add();
+        trace(TracePoint::SendComplete, packet->getTimestamp());
+        if (historySize_ > 0) {
+            remember(*packet);
+        }
+        pool_.push(packet);
+    }
+}
+
+void Transmitter::scheduleBatch() {
+    if (pacing_ == Pacing::Off) {
+        return;
+    }
+    // The media timestamps count samples of CLOCK_REALTIME. A packet is held
+    // at most for the offset, even if its timestamp runs ahead of the clock.
+    // The departure times are kept in order, the etf qdisc drops packets
+    // scheduled before their predecessors.
+    const auto now = clock_ns(clock_);
+    const auto shift = now - clock_ns(CLOCK_REALTIME);
+    const auto lead = pacing_ == Pacing::User ? 0 : LateMargin;
+    for (std::size_t i = 0; i < batch_.size(); ++i) {
+        const auto timestamp = batch_[i]->getTimestamp();
+        const auto seconds = static_cast<int64_t>(timestamp / sampleRate_);
+        const auto fraction = static_cast<int64_t>(timestamp % sampleRate_) * 1000000000LL / sampleRate_;
+        int64_t departure = seconds * 1000000000LL + fraction + shift + offset_;
+        if (departure < now + lead) {
+            latePackets_.add();
+            departure = now + lead;
+        }
+        departure = std::min(departure, now + std::max(offset_, lead));
+        departures_[i] = std::max(departure, lastDeparture_);
+        lastDeparture_ = departures_[i];
+    }
+}
+
+std::size_t Transmitter::dueMessages(int64_t now, int64_t& next) const {
+    for (std::size_t i = released_; i < batch_.size(); ++i) {
+        if (departures_[i] > now) {
+            next = departures_[i];
+            return i == 0 ? 0 : ends_[i - 1];
+        }
+    }
+    return messageCount_;
+}
+
+int Transmitter::sendUring(std::size_t end) {
+    // Without MSG_DONTWAIT the ring waits for a full socket buffer to drain
+    // instead of failing, the completions arrive in order of submission.
+    const auto count = static_cast<unsigned int>(std::min<std::size_t>(end - next_, uring_->space()));
+    for (unsigned int i = 0; i < count; ++i) {
+        auto entry = uring_->entry();
+        entry->opcode = IORING_OP_SENDMSG;
+        entry->fd = socket_.native_handle();
+        entry->addr = reinterpret_cast<uint64_t>(&messages_[next_ + i].msg_hdr);
+        entry->len = 1;
+        entry->user_data = next_ + i;
+    }
+    unsigned int submitted = 0, completed = 0;
+    int result = uring_->submit(count);
+    while (result >= 0 || result == -EINTR || result == -EAGAIN || result == -EBUSY) {
+        submitted += result > 0 ? static_cast<unsigned int>(result) : 0;
+        completed += uring_->complete([this] (const struct io_uring_cqe& cqe) {
+            if (cqe.res < 0) {
+                sendErrors_.add();
+                log_error("Failed to send packet: {}", LogErrno{-cqe.res});
             }
-            pool_.push(packet);
         });
+        if (completed == count) {
+            return static_cast<int>(count);
+        }
+        if (result <= 0 && completed == submitted) {
+            // Nothing is in flight and the kernel takes no more entries.
+            break;
+        }
+        // Submits the entries the kernel has not taken yet and waits for the others.
+        result = uring_->submit(count - completed);
+    }
+    // The entries not taken are discarded with the ring, the messages are sent
+    // again with sendmmsg(). Entries still in flight complete when the ring is closed.
+    log_error("Failed to submit {} of {} messages to io_uring, using sendmmsg(): {}", count - submitted, count,
+        LogErrno{result < 0 ? -result : EAGAIN});
+    uring_.reset();
+    return static_cast<int>(submitted);
+}
+
+void Transmitter::flush() {
+    scheduled_ = false;
+    while (true) {
+        if (released_ == batch_.size()) {
+            batch_.clear();
+            next_ = 0;
+            released_ = 0;
+            // Takes the packets round-robin from the queues until all are empty.
+            const auto queues = queueCount_.load(std::memory_order_acquire);
+            Packet* packet = nullptr;
+            std::size_t empty = 0;
+            while (batch_.size() < MaxBatch && empty < queues) {
+                if (queues_[nextQueue_ % queues]->try_dequeue(packet)) {
+                    batch_.push_back(packet);
+                    empty = 0;
+                } else {
+                    empty += 1;
+                }
+                nextQueue_ = (nextQueue_ + 1) % queues;
+            }
+            if (batch_.empty()) {
+                return;
+            }
+            prepareBatch();
+            if (released_ == batch_.size()) {
+                continue;
+            }
+        }
+
+        auto end = messageCount_;
+        if (pacing_ == Pacing::User) {
+            int64_t departure = 0;
+            end = dueMessages(clock_ns(CLOCK_MONOTONIC), departure);
+            // Waits only for a later departure, packets without messages
+            // left to send are released first.
+            if (next_ >= end && departure != 0 && next_ < ends_[released_]) {
+                // The steady clock of libstdc++ is CLOCK_MONOTONIC.
+                timer_.expires_at(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(departure)));
+                timer_.async_wait([this] (const boost::system::error_code& ec) {
+                    if (!ec) {
+                        flush();
+                    }
+                });
+                return;
+            }
+        }
+
+        int sent = 0;
+        if (next_ < end && uring_) {
+            sent = sendUring(end);
+        } else if (next_ < end) {
+            sent = sendmmsg(socket_.native_handle(), &messages_[next_],
+                static_cast<unsigned int>(end - next_), MSG_DONTWAIT);
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Continues with the same message once the socket is writable again.
+            socket_.async_send(boost::asio::null_buffers(), [this] (const boost::system::error_code& ec, std::size_t) {
+                if (!ec) {
+                    flush();
+                }
+            });
+            return;
+        } else if (sent < 0) {
+            // Only the first message failed, the others are retried.
+            sendErrors_.add();
+            log_error("Failed to send packet: {}", LogErrno{errno});
+            next_ += 1;
+        } else {
+            next_ += static_cast<std::size_t>(sent);
+        }
+
+        release();
+    }
 }
@@ -4,16 +4,58 @@
 #ifndef __TRANSMITTER_H
 #define __TRANSMITTER_H
 
+#include "Realtime.h"
+#include "Metrics.h"
+
+#include <readerwriterqueue.h>
 #include <boost/asio.hpp>
 #include <thread>
+#include <memory>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
 
 class Packet;
 class PacketPool;
+class Uring;
 
-/** A class used to transmit packets of audio data.
+/** A class used to transmit packets of audio data. Packets handed over by any
+ *  number of capture threads, each through a lock-free queue of its own, are
+ *  collected by the service thread and sent in
+ *  batches with a single sendmmsg() call to one (multicast) or several
+ *  unicast destinations. Besides the fixed destinations of all streams,
+ *  destinations can be added to and removed from single streams at runtime.
+ *  The messages of a packet all reference the same payload. A packet is
+ *  returned to the pool once it has been sent to all destinations. For
+ *  seamless protection switching, the packets can also be sent to the
+ *  destinations of a redundant path on another interface. The service thread
+ *  can keep a copy of the most recent packets of each stream and send them
+ *  to a receiver joining late, so its buffer is filled at once.
+ *
+ *  Optionally the departure of each packet is paced by its media timestamp,
+ *  either by the kernel with SO_TXTIME or by the service thread itself, so
+ *  the spacing of packets on the wire does not depend on the wakeups of the
+ *  capture threads.
+ *
+ *  The messages are sent with sendmmsg() by default, or alternatively as a
+ *  batch of sendmsg requests submitted to an io_uring with a single system
+ *  call.
  */
 class Transmitter {
 public:
+    /** The ways of pacing the departure of packets.
+     */
+    enum class Pacing {
+        Off,        /**< Packets are sent as soon as they are handed over.                        */
+        Fq,         /**< The fq qdisc releases packets at their departure time on CLOCK_MONOTONIC. */
+        Etf,        /**< The etf qdisc releases packets at their departure time on CLOCK_TAI.      */
+        User        /**< The service thread sends each packet at its departure time.              */
+    };
+
     /** Constructor.
      *
      *  \param address the destination address.
@@ -22,20 +64,217 @@ public:
      */
     Transmitter(const char* address, unsigned short port, PacketPool& pool);
 
+    /** Constructor.
+     *
+     *  \param endpoints the destinations of all streams, may be empty.
+     *  \param pool a pool of packets.
+     */
+    Transmitter(const std::vector<boost::asio::ip::udp::endpoint>& endpoints, PacketPool& pool);
+
     /** Destructor.
      */
     ~Transmitter();
 
-    /** Sends a packet.
+    /** Adds a queue for a thread handing over packets. Every thread sending
+     *  packets needs a queue of its own. Must be called during setup, not
+     *  concurrently with itself. Throws a std::runtime_error if there are too
+     *  many queues.
+     *
+     *  \return the queue to pass to send().
+     */
+    std::size_t addQueue();
+
+    /** Sends a packet. Neither locks nor allocates, so it can be called from
+     *  a real-time thread. Only the thread owning the queue may call it.
+     *
+     *  \param packet the packet.
+     *  \param queue the queue of the calling thread, see addQueue().
+     *  \return false if the queue is full, the packet is not taken then.
+     */
+    bool send(Packet* packet, std::size_t queue);
+
+    /** Adds a destination of a stream. Takes effect asynchronously.
+     *
+     *  \param streamId the ID of the stream.
+     *  \param endpoint the destination.
+     */
+    void addDestination(uint16_t streamId, const boost::asio::ip::udp::endpoint& endpoint);
+
+    /** Removes a destination added with addDestination(). Takes effect asynchronously.
+     *
+     *  \param streamId the ID of the stream.
+     *  \param endpoint the destination.
+     */
+    void removeDestination(uint16_t streamId, const boost::asio::ip::udp::endpoint& endpoint);
+
+    /** Keeps a copy of the most recent packets of each stream after they
+     *  have been sent. Takes effect asynchronously.
+     *
+     *  \param packets the number of packets kept per stream, 0 to keep none.
+     */
+    void setHistory(unsigned int packets);
+
+    /** Sends the recent packets of a stream to a destination, oldest first.
+     *  Takes effect asynchronously, before the next packets are sent.
+     *
+     *  \param streamId the ID of the stream.
+     *  \param endpoint the destination.
+     *  \param time the time of audio in microseconds up to the newest packet to send.
+     */
+    void sendHistory(uint16_t streamId, const boost::asio::ip::udp::endpoint& endpoint, unsigned int time);
+
+    /** Paces the departure of packets. A packet departs at its media
+     *  timestamp plus the offset, but is never held longer than the offset.
+     *  Late packets depart immediately. Kernel
+     *  pacing needs the matching qdisc on the outgoing interface. If the
+     *  socket does not support SO_TXTIME, the service thread paces the
+     *  packets instead. Takes effect asynchronously.
+     *
+     *  \param pacing the way of pacing.
+     *  \param sampleRate the sample rate of the media timestamps.
+     *  \param offset the time in microseconds from the media timestamp to the departure.
+     *  \return the way of pacing in effect.
+     */
+    Pacing setPacing(Pacing pacing, unsigned int sampleRate, unsigned int offset);
+
+    /** Sends every packet a second time to the destinations of a redundant
+     *  network path, e.g. another multicast group on a second interface, so
+     *  receivers can merge both copies and ride out the failure of one path.
+     *  The interface of each message is selected with IP_PKTINFO, so the
+     *  socket must not be bound to an interface. Takes effect asynchronously.
+     *
+     *  \param endpoints the destinations of the redundant path.
+     *  \param primary the interface of the destinations of all streams, empty to follow the routing table.
+     *  \param redundant the interface of the redundant path, empty to follow the routing table.
+     *  \return false if an interface does not exist.
+     */
+    bool setRedundantPath(const std::vector<boost::asio::ip::udp::endpoint>& endpoints,
+        const std::string& primary, const std::string& redundant);
+
+    /** Sends the messages through an io_uring instead of sendmmsg(). Takes
+     *  effect asynchronously.
+     *
+     *  \return false if io_uring is not available, sendmmsg() is used then.
+     */
+    bool setIoUring();
+
+    /** Applies scheduling settings to the thread of the service. The settings
+     *  are applied asynchronously by the service thread itself.
+     *
+     *  \param settings the scheduling settings.
+     */
+    void setThreadSettings(const ThreadSettings& settings);
+
+    /** Applies low-latency settings to the socket, e.g. the priority and
+     *  DSCP of the packets and the interface multicast is sent on.
+     *
+     *  \param settings the socket settings.
+     *  \return true if all settings took effect.
+     */
+    bool setSocketSettings(const SocketSettings& settings);
+
+    /** Registers the metrics of the service thread. The handles are handed
+     *  to the service thread asynchronously.
+     *
+     *  \param metrics the metrics segment.
      */
-    void send(Packet* packet);
+    void setMetrics(Metrics& metrics);
 
 private:
-    const boost::asio::ip::udp::endpoint endpoint_;     /**< The destination endpoint.      */
+    /** Sends the queued packets in batches until the queue is empty or the
+     *  socket would block. Runs on the service thread.
+     */
+    void flush();
+
+    /** Builds the messages of the current batch. Runs on the service thread.
+     */
+    void prepareBatch();
+
+    /** Computes the departure time of each packet of the current batch.
+     *  Runs on the service thread.
+     */
+    void scheduleBatch();
+
+    /** Returns the number of messages of the current batch due at the given
+     *  time and sets the time the next packet is due. Runs on the service thread.
+     *
+     *  \param now the current time on CLOCK_MONOTONIC in nanoseconds.
+     *  \param next set to the departure time of the first packet not due, unchanged if all are due.
+     */
+    std::size_t dueMessages(int64_t now, int64_t& next) const;
+
+    /** Returns the packets of the current batch whose messages have all been
+     *  sent to the pool, including packets without destinations. Runs on the
+     *  service thread.
+     */
+    void release();
+
+    /** Sends messages of the current batch through the io_uring and waits
+     *  for their completion. Runs on the service thread.
+     *
+     *  \param end the index after the last message to send.
+     *  \return the number of messages sent or failed.
+     */
+    int sendUring(std::size_t end);
+
+    /** Copies a sent packet into the history of its stream. Runs on the
+     *  service thread.
+     *
+     *  \param packet the packet.
+     */
+    void remember(const Packet& packet);
+
+    /** The recent packets of a stream, used by the service thread only.
+     */
+    struct History {
+        std::vector<std::vector<uint8_t>> packets;  /**< The bytes of the packets, one slot per packet.  */
+        std::size_t next;                           /**< The slot of the next packet, the oldest one.    */
+    };
+
+    /** The control messages of a message, carrying its departure time and
+     *  its outgoing interface.
+     */
+    union MessageControl {
+        char buffer[CMSG_SPACE(sizeof(uint64_t)) + CMSG_SPACE(sizeof(struct in_pktinfo))];  /**< The control messages. */
+        struct cmsghdr align;                       /**< Aligns the buffer for a cmsghdr.    */
+    };
+
+    typedef std::vector<boost::asio::ip::udp::endpoint> Endpoints;
+
+    Endpoints endpoints_;                               /**< The destinations of all streams, used by the service thread only. */
+    std::vector<int> interfaces_;                       /**< The interface index of each destination of all streams, empty for none. */
+    std::map<uint16_t, Endpoints> destinations_;        /**< The destinations of single streams, used by the service thread only. */
     PacketPool& pool_;                                  /**< The pool of packets.           */
+    std::vector<std::unique_ptr<moodycamel::ReaderWriterQueue<Packet*>>> queues_;  /**< The packets handed over, one queue per thread. */
+    std::atomic<std::size_t> queueCount_;               /**< The number of queues added.    */
+    std::size_t nextQueue_;                             /**< The queue the service thread takes the next packet from. */
+    std::atomic<bool> scheduled_;                       /**< True if a flush is posted to the service. */
+    std::vector<Packet*> batch_;                        /**< The packets currently sent.    */
+    std::vector<struct iovec> payloads_;                /**< The payload of each packet of the batch. */
+    std::vector<struct mmsghdr> messages_;              /**< One message per packet of the batch and destination. */
+    std::vector<struct sockaddr_storage> names_;        /**< The destination address of each message. */
+    std::vector<std::size_t> ends_;                     /**< The index after the last message of each packet. */
+    std::size_t messageCount_;                          /**< The number of messages of the batch. */
+    std::size_t next_;                                  /**< The next message of the batch to send. */
+    std::size_t released_;                              /**< The number of packets of the batch returned to the pool. */
+    Pacing pacing_;                                     /**< The way of pacing, used by the service thread only. */
+    clockid_t clock_;                                   /**< The clock of the departure times.  */
+    unsigned int sampleRate_;                           /**< The sample rate of the media timestamps. */
+    int64_t offset_;                                    /**< The time from the media timestamp to the departure in ns. */
+    int64_t lastDeparture_;                             /**< The departure time of the last packet. */
+    std::vector<int64_t> departures_;                   /**< The departure time of each packet of the batch. */
+    std::vector<MessageControl> controls_;              /**< The control messages of each message. */
+    std::shared_ptr<Uring> uring_;                      /**< The io_uring, used by the service thread only, or null. */
+    std::size_t historySize_;                           /**< The number of packets kept per stream, used by the service thread only. */
+    std::map<uint16_t, History> history_;               /**< The recent packets of each stream. */
     boost::asio::io_service service_;                   /**< The ASIO service object.       */
     boost::asio::io_service::work work_;                /**< Fake work for the service.     */
     boost::asio::ip::udp::socket socket_;               /**< The UDP socket.                */
+    boost::asio::steady_timer timer_;                   /**< Waits for departure times when pacing in user space. */
+    MetricCounter packets_;                             /**< The number of sent packets.    */
+    MetricCounter sendErrors_;                          /**< The number of failed sends.    */
+    MetricCounter latePackets_;                         /**< The number of packets handed over after their departure time. */
+    MetricCounter historyPackets_;                      /**< The number of packets sent from the history. */
     std::unique_ptr<std::thread> thread_;               /**< The thread for the service.    */
 };
 
@@ -0,0 +1,203 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Uring.h"
+
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+/** Maps a region of the io_uring file descriptor.
+ */
+static void* map(int fd, std::size_t size, off_t offset) {
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error(std::string("Failed to map io_uring: ") + strerror(errno));
+    }
+    return address;
+}
+
+Uring::Uring(unsigned int entries)
+: fd_(-1)
+, event_(-1)
+, sqRing_(nullptr)
+, sqRingSize_(0)
+, cqRing_(nullptr)
+, cqRingSize_(0)
+, sqes_(nullptr)
+, sqesSize_(0)
+, sqHead_(nullptr)
+, sqTail_(nullptr)
+, sqArray_(nullptr)
+, sqMask_(0)
+, sqEntries_(0)
+, sqLocalTail_(0)
+, cqHead_(nullptr)
+, cqTail_(nullptr)
+, cqMask_(0)
+, cqes_(nullptr)
+, bufferRing_(nullptr)
+, bufferRingSize_(0)
+, buffers_()
+, bufferSize_(0)
+, bufferTail_(0) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+        throw std::runtime_error(std::string("Failed to set up io_uring: ") + strerror(errno));
+    }
+
+    try {
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+        sqRing_ = map(fd_, sqRingSize_, IORING_OFF_SQ_RING);
+        cqRing_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing_ : map(fd_, cqRingSize_, IORING_OFF_CQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(map(fd_, sqesSize_, IORING_OFF_SQES));
+    } catch (...) {
+        release();
+        throw;
+    }
+
+    auto sq = static_cast<uint8_t*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    sqArray_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    sqMask_ = *reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    sqLocalTail_ = *sqTail_;
+
+    auto cq = static_cast<uint8_t*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    event_ = eventfd(0, EFD_CLOEXEC);
+    if (event_ < 0) {
+        const std::string error = strerror(errno);
+        release();
+        throw std::runtime_error("Failed to create eventfd: " + error);
+    }
+    // Submitted with the first submit().
+    auto poll = entry();
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = event_;
+    poll->poll32_events = POLLIN;
+    poll->user_data = Interrupted;
+}
+
+Uring::~Uring() {
+    release();
+}
+
+void Uring::release() {
+    if (bufferRing_) {
+        munmap(bufferRing_, bufferRingSize_);
+        bufferRing_ = nullptr;
+    }
+    if (sqes_) {
+        munmap(sqes_, sqesSize_);
+        sqes_ = nullptr;
+    }
+    if (cqRing_ && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    cqRing_ = nullptr;
+    if (sqRing_) {
+        munmap(sqRing_, sqRingSize_);
+        sqRing_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    if (event_ >= 0) {
+        close(event_);
+        event_ = -1;
+    }
+}
+
+unsigned int Uring::space() const {
+    return sqEntries_ - (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE));
+}
+
+struct io_uring_sqe* Uring::entry() {
+    if (space() == 0) {
+        return nullptr;
+    }
+    const auto index = sqLocalTail_ & sqMask_;
+    sqArray_[index] = index;
+    sqLocalTail_ += 1;
+    memset(&sqes_[index], 0, sizeof(struct io_uring_sqe));
+    return &sqes_[index];
+}
+
+int Uring::submit(unsigned int wait) {
+    // The kernel advances the head past the entries it has taken, so the
+    // entries left over by a partial submission are counted as well.
+    const auto pending = sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    const auto result = syscall(__NR_io_uring_enter, fd_, pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0,
+        nullptr, 0);
+    return result < 0 ? -errno : static_cast<int>(result);
+}
+
+void Uring::registerBuffers(uint16_t group, const std::vector<uint8_t*>& buffers, unsigned int size) {
+    if (buffers.empty() || (buffers.size() & (buffers.size() - 1)) != 0 || buffers.size() > 32768) {
+        throw std::runtime_error("The number of provided buffers must be a power of two");
+    }
+    bufferRingSize_ = buffers.size() * sizeof(struct io_uring_buf);
+    void* ring = mmap(nullptr, bufferRingSize_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        throw std::runtime_error(std::string("Failed to allocate buffer ring: ") + strerror(errno));
+    }
+    bufferRing_ = static_cast<struct io_uring_buf*>(ring);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = static_cast<uint32_t>(buffers.size());
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        const std::string error = strerror(errno);
+        munmap(bufferRing_, bufferRingSize_);
+        bufferRing_ = nullptr;
+        throw std::runtime_error("Failed to register buffer ring: " + error);
+    }
+
+    buffers_ = buffers;
+    bufferSize_ = size;
+    bufferTail_ = 0;
+    for (std::size_t i = 0; i < buffers_.size(); ++i) {
+        provide(static_cast<uint16_t>(i));
+    }
+}
+
+void Uring::provide(uint16_t id) {
+    // The ring is indexed as an array of io_uring_buf. In C++ the flexible
+    // array member io_uring_buf_ring::bufs is preceded by an empty struct of
+    // size one and does not start at the beginning of the ring.
+    auto& buffer = bufferRing_[bufferTail_ & (buffers_.size() - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(buffers_[id]);
+    buffer.len = bufferSize_;
+    buffer.bid = id;
+    bufferTail_ += 1;
+    __atomic_store_n(&reinterpret_cast<struct io_uring_buf_ring*>(bufferRing_)->tail, bufferTail_, __ATOMIC_RELEASE);
+}
+
+bool Uring::interrupt() {
+    const uint64_t value = 1;
+    return write(event_, &value, sizeof(value)) == sizeof(value);
+}
@@ -0,0 +1,124 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#ifndef __URING_H
+#define __URING_H
+
+#include <linux/io_uring.h>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/** A minimal io_uring instance using the raw system calls. Submission and
+ *  completion queue are used by a single thread. Optionally a ring of
+ *  provided buffers is registered, from which the kernel selects the buffer
+ *  of a receive. Other threads can only interrupt().
+ */
+class Uring {
+public:
+    static const uint64_t Interrupted = ~0ULL;  /**< The user data of the completion of interrupt(). */
+
+    /** Constructor. Throws a std::runtime_error if io_uring is not available.
+     *
+     *  \param entries the number of entries of the submission queue.
+     */
+    explicit Uring(unsigned int entries);
+
+    Uring(const Uring&) = delete;
+    Uring& operator =(const Uring&) = delete;
+
+    /** Destructor.
+     */
+    ~Uring();
+
+    /** Returns a cleared submission queue entry, nullptr if the queue is full.
+     *  The entry is submitted with the next submit().
+     */
+    struct io_uring_sqe* entry();
+
+    /** Returns the number of free entries of the submission queue.
+     */
+    unsigned int space() const;
+
+    /** Submits the queued entries and waits for completions. Entries the
+     *  kernel did not take in a previous call are submitted again. The
+     *  kernel does not wait if it takes fewer entries than queued.
+     *
+     *  \param wait the number of completions to wait for.
+     *  \return the number of submitted entries or a negative error code.
+     */
+    int submit(unsigned int wait);
+
+    /** Calls a function for each available completion and consumes them.
+     *
+     *  \param handler the function called with each const io_uring_cqe&.
+     *  \return the number of completions.
+     */
+    template<typename Handler>
+    unsigned int complete(Handler handler) {
+        unsigned int head = *cqHead_;
+        const unsigned int tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        unsigned int count = 0;
+        while (head != tail) {
+            handler(cqes_[head & cqMask_]);
+            head += 1;
+            count += 1;
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    /** Registers a ring of provided buffers. A buffer selected by the kernel
+     *  is reported in the flags of the completion and must be returned with
+     *  provide() once it has been processed. Throws a std::runtime_error on failure.
+     *
+     *  \param group the ID of the buffer group.
+     *  \param buffers the buffers, the number must be a power of two.
+     *  \param size the size of each buffer in bytes.
+     */
+    void registerBuffers(uint16_t group, const std::vector<uint8_t*>& buffers, unsigned int size);
+
+    /** Returns a buffer to the ring of provided buffers.
+     *
+     *  \param id the index of the buffer.
+     */
+    void provide(uint16_t id);
+
+    /** Posts a completion with the user data Interrupted, which wakes a
+     *  thread waiting in submit(). Can be called from any thread.
+     *
+     *  \return false if the eventfd could not be written.
+     */
+    bool interrupt();
+
+private:
+    /** Unmaps the rings and closes the file descriptor.
+     */
+    void release();
+
+    int fd_;                            /**< The io_uring file descriptor.                      */
+    int event_;                         /**< The eventfd polled for interrupt().                */
+    void* sqRing_;                      /**< The mapping of the submission queue.               */
+    std::size_t sqRingSize_;            /**< The size of the submission queue mapping.          */
+    void* cqRing_;                      /**< The mapping of the completion queue.               */
+    std::size_t cqRingSize_;            /**< The size of the completion queue mapping.          */
+    struct io_uring_sqe* sqes_;         /**< The submission queue entries.                      */
+    std::size_t sqesSize_;              /**< The size of the entries mapping.                   */
+    unsigned int* sqHead_;              /**< The head of the submission queue, kernel owned.    */
+    unsigned int* sqTail_;              /**< The tail of the submission queue.                  */
+    unsigned int* sqArray_;             /**< The index array of the submission queue.           */
+    unsigned int sqMask_;               /**< The mask of submission queue indices.              */
+    unsigned int sqEntries_;            /**< The number of submission queue entries.            */
+    unsigned int sqLocalTail_;          /**< The tail including entries not yet submitted.      */
+    unsigned int* cqHead_;              /**< The head of the completion queue.                  */
+    unsigned int* cqTail_;              /**< The tail of the completion queue, kernel owned.    */
+    unsigned int cqMask_;               /**< The mask of completion queue indices.              */
+    struct io_uring_cqe* cqes_;         /**< The completion queue entries.                      */
+    struct io_uring_buf* bufferRing_;   /**< The ring of provided buffers, nullptr if none.     */
+    std::size_t bufferRingSize_;        /**< The size of the buffer ring mapping.               */
+    std::vector<uint8_t*> buffers_;     /**< The provided buffers.                              */
+    unsigned int bufferSize_;           /**< The size of each provided buffer.                  */
+    uint16_t bufferTail_;               /**< The tail of the buffer ring.                       */
+};
+
+#endif  // __URING_H
@@ -16,10 +16,25 @@ uint64_t read_clock(clockid_t clock) {
     return timespec_us(&realtime);
 }
 
+uint64_t time_origin() {
+    static const uint64_t origin = [] () {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec);
+    }();
+    return origin;
+}
+
 double get_time() {
+    const auto origin = time_origin();
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
-    double u = ts.tv_sec % 86400;
+    double u = static_cast<double>(static_cast<int64_t>(ts.tv_sec - origin));
     u += ts.tv_nsec / 1000000000.0;
     return u;
 }
+
+uint64_t media_timestamp(double t, unsigned int sampleRate) {
+    const auto offset = static_cast<int64_t>(std::floor(t * sampleRate + 0.5));
+    return time_origin() * sampleRate + offset;
+}
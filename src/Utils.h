@@ -12,8 +12,22 @@
  */
 uint64_t read_clock(clockid_t clock);
 
-/** Returns the current real-time in microseconds.
+/** Returns the current real-time in seconds relative to time_origin().
  */
 double get_time();
 
+/** Returns the origin of get_time() in whole seconds since the Unix epoch.
+ *  The origin is fixed on first use and never changes during the lifetime of the process.
+ */
+uint64_t time_origin();
+
+/** Converts a time returned by get_time() to a media timestamp, i.e. the index of
+ *  the sample at that time counted from the Unix epoch. The result does not depend
+ *  on the process specific time origin and does not wrap in practice.
+ *
+ *  \param t the time in seconds relative to time_origin().
+ *  \param sampleRate the sample rate.
+ */
+uint64_t media_timestamp(double t, unsigned int sampleRate);
+
 #endif  // __UTILS_H
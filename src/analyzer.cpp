@@ -0,0 +1,243 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "AudioFile.h"
+#include "Fft.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <complex>
+#include <cmath>
+#include <cstdlib>
+
+using namespace boost::program_options;
+
+static const unsigned int DefaultLeft = 0;
+static const unsigned int DefaultRight = 1;
+static const double DefaultWindow = 1.0;    // window length in seconds, one click per second
+
+/** Returns the delay of the right channel relative to the left channel in the
+ *  window starting at the given frame, like finddelay() in MATLAB: the lag with
+ *  the largest absolute normalized cross-correlation, the smaller lag on ties.
+ *
+ *  \param file the recording.
+ *  \param start the first frame of the window.
+ *  \param length the number of frames in the window.
+ *  \param maxLag the maximum lag in frames.
+ *  \param left the index of the reference channel.
+ *  \param right the index of the delayed channel.
+ *  \param fft the transform, at least twice as large as the window.
+ *  \param data scratch memory with fft.size() elements.
+ */
+static int findDelay(const AudioFile& file, std::size_t start, std::size_t length, int maxLag,
+    unsigned int left, unsigned int right, const Fft& fft, std::vector<std::complex<double>>& data) {
+    const std::size_t n = fft.size();
+    double energyLeft = 0, energyRight = 0;
+    for (std::size_t i = 0; i < length; ++i) {
+        const double x = file.sample(start + i, left);
+        const double y = file.sample(start + i, right);
+        energyLeft += x * x;
+        energyRight += y * y;
+        data[i] = std::complex<double>(x, y);
+    }
+    std::fill(data.begin() + static_cast<std::ptrdiff_t>(length), data.end(), std::complex<double>(0, 0));
+
+    const double norm = std::sqrt(energyLeft * energyRight);
+    if (norm <= 0) {
+        return 0;
+    }
+
+    // Both real channels are transformed at once as x + iy, split into X and Y and
+    // multiplied to Y * conj(X), whose inverse transform is the cross-correlation.
+    fft.forward(data);
+    std::vector<std::complex<double>>& spectrum = data;
+    for (std::size_t k = 0; k <= n / 2; ++k) {
+        const std::size_t m = (n - k) & (n - 1);
+        const auto zk = spectrum[k];
+        const auto zm = spectrum[m];
+        const double xr = 0.5 * (zk.real() + zm.real()), xi = 0.5 * (zk.imag() - zm.imag());
+        const double yr = 0.5 * (zk.imag() + zm.imag()), yi = -0.5 * (zk.real() - zm.real());
+        const std::complex<double> pk(yr * xr + yi * xi, yi * xr - yr * xi);
+        spectrum[k] = pk;
+        spectrum[m] = std::conj(pk);
+    }
+    fft.inverse(spectrum);
+
+    int best = 0;
+    double bestValue = -1;
+    for (int lag = 0; lag <= maxLag; ++lag) {
+        for (int sign = 1; sign >= -1; sign -= 2) {
+            if (lag == 0 && sign < 0) {
+                continue;
+            }
+            const int candidate = lag * sign;
+            const std::size_t index = candidate >= 0 ? static_cast<std::size_t>(candidate) : n - static_cast<std::size_t>(-candidate);
+            const double value = std::abs(data[index].real()) / norm;
+            if (value > bestValue + 1e-12) {
+                bestValue = value;
+                best = candidate;
+            }
+        }
+    }
+    return best;
+}
+
+/** Prints mean, jitter and drift of a series of delays.
+ *
+ *  \param delays the delays in samples, one per window.
+ *  \param windowTime the length of a window in seconds.
+ *  \param sampleRate the sample rate, 0 if unknown.
+ */
+static void printStatistics(const std::vector<int>& delays, double windowTime, unsigned int sampleRate) {
+    const auto count = delays.size();
+    if (count == 0) {
+        std::cerr << "No clicks\n";
+        return;
+    }
+    double sum = 0, sumSquares = 0, sumX = 0, sumXX = 0, sumXY = 0;
+    int minimum = delays[0], maximum = delays[0];
+    for (std::size_t i = 0; i < count; ++i) {
+        const double d = delays[i];
+        const double x = static_cast<double>(i) * windowTime;
+        sum += d;
+        sumSquares += d * d;
+        sumX += x;
+        sumXX += x * x;
+        sumXY += x * d;
+        minimum = std::min(minimum, delays[i]);
+        maximum = std::max(maximum, delays[i]);
+    }
+    const double n = static_cast<double>(count);
+    const double mean = sum / n;
+    const double jitter = std::sqrt(std::max(0.0, sumSquares / n - mean * mean));
+    const double denominator = n * sumXX - sumX * sumX;
+    const double slope = denominator > 0 ? (n * sumXY - sumX * sum) / denominator : 0;
+
+    std::cerr << "clicks: " << count << "\n";
+    std::cerr << "mean: " << mean << " samples\n";
+    std::cerr << "jitter: " << jitter << " samples\n";
+    std::cerr << "min: " << minimum << ", max: " << maximum << " samples\n";
+    std::cerr << "drift: " << slope * 3600 << " samples/hour";
+    if (sampleRate != 0) {
+        std::cerr << " (" << slope * 3600 * 1000000.0 / sampleRate << " us/hour)";
+    }
+    std::cerr << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string input, output, log;
+    unsigned int left = DefaultLeft, right = DefaultRight;
+    unsigned int sampleRate = 0, channels = 0, threads = 0;
+    double window = DefaultWindow;
+    int maxLag = -1;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("input", value<std::string>(&input), "recording to analyze (WAV, or raw S16_LE with --samplerate and --channels)")
+        ("output,o", value<std::string>(&output), "write the delays to this file instead of stdout")
+        ("log", value<std::string>(&log), "compute the statistics of an existing click log instead of a recording")
+        ("samplerate,s", value<unsigned int>(&sampleRate), "sample rate of a raw recording")
+        ("channels,c", value<unsigned int>(&channels), "number of channels of a raw recording")
+        ("left,l", value<unsigned int>(&left)->default_value(DefaultLeft), "index of the reference channel")
+        ("right,r", value<unsigned int>(&right)->default_value(DefaultRight), "index of the delayed channel")
+        ("window,w", value<double>(&window)->default_value(DefaultWindow), "analysis window in seconds, one click per window")
+        ("maxlag,m", value<int>(&maxLag), "maximum delay in samples (default: window length)")
+        ("threads,j", value<unsigned int>(&threads), "number of worker threads (default: all cores)")
+        ("help,h", "produce help message");
+
+    positional_options_description positional;
+    positional.add("input", 1);
+
+    try {
+        variables_map vm;
+        store(command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        notify(vm);
+        if (vm.count("help") || (input.empty() && log.empty())) {
+            std::cout << "Usage: analyzer [options] recording\n" << desc << "\n";
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+
+    try {
+        if (!log.empty()) {
+            std::ifstream stream(log);
+            if (!stream) {
+                std::cerr << "Failed to open " << log << "\n";
+                return -1;
+            }
+            std::vector<int> delays;
+            int delay = 0;
+            while (stream >> delay) {
+                delays.push_back(delay);
+            }
+            printStatistics(delays, window, sampleRate);
+            return 0;
+        }
+
+        AudioFile file(input, sampleRate, channels);
+        if (left >= file.channels() || right >= file.channels()) {
+            std::cerr << "Recording has only " << file.channels() << " channels\n";
+            return -1;
+        }
+
+        const auto length = static_cast<std::size_t>(std::round(window * file.sampleRate()));
+        if (length == 0) {
+            std::cerr << "Window is empty\n";
+            return -1;
+        }
+        if (maxLag < 0 || static_cast<std::size_t>(maxLag) >= length) {
+            maxLag = static_cast<int>(length - 1);
+        }
+        std::size_t fftSize = 1;
+        while (fftSize < 2 * length) {
+            fftSize <<= 1;
+        }
+        const Fft fft(fftSize);
+
+        const std::size_t clicks = file.frames() / length;
+        std::vector<int> delays(clicks, 0);
+        std::atomic<std::size_t> next(0);
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < threads; ++i) {
+            workers.emplace_back([&] () {
+                std::vector<std::complex<double>> data(fft.size());
+                for (auto click = next++; click < clicks; click = next++) {
+                    delays[click] = findDelay(file, click * length, length, maxLag, left, right, fft, data);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        std::ofstream stream;
+        if (!output.empty()) {
+            stream.open(output);
+            if (!stream) {
+                std::cerr << "Failed to open " << output << "\n";
+                return -1;
+            }
+        }
+        std::ostream& out = output.empty() ? std::cout : stream;
+        for (const auto delay : delays) {
+            out << delay << "\n";
+        }
+
+        printStatistics(delays, window, file.sampleRate());
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << "\n";
+        return -1;
+    }
+}
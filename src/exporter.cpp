@@ -0,0 +1,136 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Metrics.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace boost::program_options;
+
+static const std::string DefaultAddress = "127.0.0.1";
+static const unsigned short DefaultPort = 9464;
+
+/** Writes a complete buffer to a socket.
+ */
+static bool write_all(int fd, const std::string& data) {
+    std::size_t offset = 0;
+    while (offset < data.size()) {
+        const auto n = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        offset += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+/** Answers a single HTTP request with the current metrics. Every request is
+ *  answered the same regardless of its path.
+ */
+static void serve(int client, const std::vector<std::string>& names) {
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        const auto n = recv(client, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        request.append(buffer, static_cast<std::size_t>(n));
+    }
+
+    const std::string body = format_metrics(names.empty() ? list_metrics() : names);
+    write_all(client, "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body);
+}
+
+int main(int argc, char* argv[]) {
+    std::string address = DefaultAddress;
+    unsigned short port = DefaultPort;
+    std::vector<std::string> names;
+    bool once = false;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("address,a", value<std::string>(&address)->default_value(DefaultAddress), "address the HTTP endpoint listens on")
+        ("port,p", value<unsigned short>(&port)->default_value(DefaultPort), "port the HTTP endpoint listens on")
+        ("once", "print the metrics to stdout and exit")
+        ("names", value<std::vector<std::string>>(&names), "names of the metrics segments, all running processes if omitted")
+        ("help,h", "produce help message");
+    positional_options_description positional;
+    positional.add("names", -1);
+
+    try {
+        variables_map vm;
+        store(command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        notify(vm);
+        if (vm.count("help")) {
+            std::cout << "Usage: " << argv[0] << " [options] [name...]\n" << desc << "\n";
+            return 1;
+        }
+        once = vm.count("once") > 0;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+
+    if (once) {
+        std::cout << format_metrics(names.empty() ? list_metrics() : names);
+        return 0;
+    }
+
+    const int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) {
+        std::cerr << "Failed to create socket: " << strerror(errno) << "\n";
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid address " << address << "\n";
+        return -1;
+    }
+    if (bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server, 16) != 0) {
+        std::cerr << "Failed to listen on " << address << ":" << port << ": " << strerror(errno) << "\n";
+        return -1;
+    }
+
+    std::cout << "Serving metrics on http://" << address << ":" << port << "/metrics\n";
+    while (true) {
+        const int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Failed to accept: " << strerror(errno) << "\n";
+            break;
+        }
+        serve(client, names);
+        close(client);
+    }
+    close(server);
+    return 0;
+}
@@ -0,0 +1,229 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Transmitter.h"
+#include "PacketPool.h"
+#include "Packet.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace boost::program_options;
+
+static const std::string DefaultDestinations = "1,2,4,8,16,32,64";
+static const std::string DefaultPeriodTimes = "1000,250";
+static const unsigned int DefaultSampleRate = 48000;
+static const unsigned int DefaultChannels = 2;
+static const unsigned int DefaultDuration = 5;      // seconds per measurement
+static const unsigned int PoolSize = 5;             // packets, as in the sender
+static const int SinkBufferSize = 4096;             // bytes, keeps the sinks dropping cheaply
+
+/** The result of a measurement.
+ */
+struct Result {
+    uint64_t packets;   /**< The number of packets handed to the transmitter.     */
+    uint64_t dropped;   /**< The number of periods without a free packet.         */
+    double cpu;         /**< The CPU time of the process in seconds.              */
+    double elapsed;     /**< The wall-clock time in seconds.                      */
+};
+
+/** Parses a comma separated list of numbers.
+ */
+static std::vector<unsigned int> parseList(const std::string& text) {
+    std::vector<unsigned int> values;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(static_cast<unsigned int>(std::stoul(item)));
+    }
+    return values;
+}
+
+/** Returns the value of a clock in seconds.
+ */
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 0.000000001;
+}
+
+/** Sleeps until the next period boundary.
+ */
+static void waitPeriod(struct timespec& next, unsigned int periodTime) {
+    next.tv_nsec += static_cast<long>(periodTime) * 1000;
+    while (next.tv_nsec >= 1000000000L) {
+        next.tv_nsec -= 1000000000L;
+        next.tv_sec += 1;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR) {
+    }
+}
+
+/** Measures the Transmitter fanning out one packet per period.
+ */
+static Result measureFanout(const std::vector<boost::asio::ip::udp::endpoint>& endpoints,
+    unsigned int periodTime, unsigned int payloadSize, unsigned int duration) {
+    PacketPool pool;
+    std::vector<std::unique_ptr<Packet>> packets;
+    for (unsigned int i = 0; i < PoolSize; ++i) {
+        packets.emplace_back(new Packet(payloadSize));
+        pool.push(packets.back().get());
+    }
+
+    Result result = { 0, 0, 0, 0 };
+    const uint64_t periods = static_cast<uint64_t>(duration) * 1000000 / periodTime;
+    {
+        Transmitter transmitter(endpoints, pool);
+        const auto queue = transmitter.addQueue();
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+        const double start = seconds(CLOCK_MONOTONIC);
+        for (uint64_t period = 0; period < periods; ++period) {
+            Packet* packet = pool.pop();
+            if (packet) {
+                packet->setTimestamp(period);
+                if (transmitter.send(packet, queue)) {
+                    result.packets += 1;
+                } else {
+                    pool.push(packet);
+                    result.dropped += 1;
+                }
+            } else {
+                result.dropped += 1;
+            }
+            waitPeriod(next, periodTime);
+        }
+        result.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+        result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    }
+    return result;
+}
+
+/** Measures one sendto() per destination as a baseline.
+ */
+static Result measureSendto(const std::vector<boost::asio::ip::udp::endpoint>& endpoints,
+    unsigned int periodTime, unsigned int payloadSize, unsigned int duration) {
+    Packet packet(payloadSize);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    Result result = { 0, 0, 0, 0 };
+    const uint64_t periods = static_cast<uint64_t>(duration) * 1000000 / periodTime;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+    const double start = seconds(CLOCK_MONOTONIC);
+    for (uint64_t period = 0; period < periods; ++period) {
+        packet.setTimestamp(period);
+        for (const auto& endpoint : endpoints) {
+            sendto(fd, packet.packet_, packet.packetSize_, MSG_DONTWAIT, endpoint.data(), static_cast<socklen_t>(endpoint.size()));
+        }
+        result.packets += 1;
+        waitPeriod(next, periodTime);
+    }
+    result.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    close(fd);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    std::string destinationList = DefaultDestinations;
+    std::string periodTimeList = DefaultPeriodTimes;
+    unsigned int sampleRate = DefaultSampleRate;
+    unsigned int channels = DefaultChannels;
+    unsigned int duration = DefaultDuration;
+    bool baseline = false;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("destinations", value<std::string>(&destinationList)->default_value(DefaultDestinations), "comma separated numbers of unicast destinations")
+        ("periodtimes", value<std::string>(&periodTimeList)->default_value(DefaultPeriodTimes), "comma separated period times in microseconds")
+        ("samplerate,s", value<unsigned int>(&sampleRate)->default_value(DefaultSampleRate), "sample rate in sample per second")
+        ("channels,c", value<unsigned int>(&channels)->default_value(DefaultChannels), "number of channels")
+        ("duration", value<unsigned int>(&duration)->default_value(DefaultDuration), "measurement time per configuration in seconds")
+        ("baseline", "also measure one sendto() per destination")
+        ("help,h", "produce help message");
+
+    std::vector<unsigned int> counts, periodTimes;
+    try {
+        variables_map vm;
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 1;
+        }
+        baseline = vm.count("baseline") > 0;
+        counts = parseList(destinationList);
+        periodTimes = parseList(periodTimeList);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+
+    // The destinations are local sockets that are never read, the kernel
+    // drops the packets once their small receive buffers are full. The
+    // measured CPU time includes the loopback delivery.
+    unsigned int maxCount = 0;
+    for (const auto count : counts) {
+        maxCount = std::max(maxCount, count);
+    }
+    std::vector<int> sinks;
+    std::vector<boost::asio::ip::udp::endpoint> endpoints;
+    for (unsigned int i = 0; i < maxCount; ++i) {
+        const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SinkBufferSize, sizeof(SinkBufferSize));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+            || getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0) {
+            std::cerr << "Failed to create sink: " << strerror(errno) << "\n";
+            return -1;
+        }
+        sinks.push_back(fd);
+        endpoints.push_back(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), ntohs(addr.sin_port)));
+    }
+
+    std::cout << std::setw(12) << "destinations" << std::setw(10) << "period" << std::setw(10) << "mode"
+              << std::setw(10) << "cpu %" << std::setw(14) << "us/packet" << std::setw(16) << "us/destination"
+              << std::setw(10) << "dropped" << "\n";
+    for (const auto periodTime : periodTimes) {
+        const auto periodSize = static_cast<unsigned int>(std::round(sampleRate * 0.000001 * periodTime));
+        const unsigned int payloadSize = periodSize * channels * static_cast<unsigned int>(sizeof(int16_t));
+        for (const auto count : counts) {
+            const std::vector<boost::asio::ip::udp::endpoint> selected(endpoints.begin(), endpoints.begin() + count);
+            for (int mode = 0; mode < (baseline ? 2 : 1); ++mode) {
+                const auto result = mode == 0 ? measureFanout(selected, periodTime, payloadSize, duration)
+                    : measureSendto(selected, periodTime, payloadSize, duration);
+                const double perPacket = result.packets > 0 ? result.cpu * 1000000.0 / static_cast<double>(result.packets) : 0;
+                std::cout << std::fixed << std::setprecision(2)
+                          << std::setw(12) << count << std::setw(10) << periodTime << std::setw(10) << (mode == 0 ? "sendmmsg" : "sendto")
+                          << std::setw(10) << result.cpu * 100.0 / result.elapsed << std::setw(14) << perPacket
+                          << std::setw(16) << perPacket / count << std::setw(10) << result.dropped << "\n";
+            }
+        }
+    }
+
+    for (const auto fd : sinks) {
+        close(fd);
+    }
+    return 0;
+}
@@ -2,55 +2,273 @@
 // Distributed under the BSD license.
 
 #include "Player.h"
+#include "AudioDevice.h"
 #include "Receiver.h"
 #include "CircularBuffer.h"
+#include "TimeInfo.h"
 #include "Utils.h"
+#include "Realtime.h"
+#include "Calibration.h"
+#include "ClockState.h"
+#include "Reactor.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "ControlClient.h"
+#include "PacketRing.h"
+#include "Announcement.h"
 
-#include <readerwriterqueue.h>
 #include <boost/program_options.hpp>
 #include <iostream>
 #include <atomic>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+#include <poll.h>
 #include <unistd.h>
 #include <signal.h>
 
 using namespace boost::program_options;
-using namespace moodycamel;
 
 static const std::string DefaultDeviceName = "default";
+static const double DefaultDrift = 0;   // drift of a headless device in ppm
 static const unsigned int DefaultSampleRate = 48000;
 static const unsigned int DefaultPeriodTime = 1000; // in microseconds
 static const unsigned int DefaultChannels = 2;
 static const unsigned int DefaultLatency = 10;
+static const unsigned int DefaultPeriods = 2;  // periods in the buffer of the audio device
+static const std::string DefaultCalibrationFile = "receiver.calibration";
+static const unsigned int DefaultCalibrationTime = 10;    // measurement time per trial in seconds
+static const unsigned int CalibrationWarmup = 3;           // settling time per trial in seconds
+static const unsigned int MaxCalibrationPeriods = 4;
+static const std::string DefaultClockStateFile = "receiver.clock";
 static const std::string DefaultAddress = "224.1.2.3";
 static const unsigned int DefaultPort = 23776;
+static const unsigned short DefaultStreamId = 0;
+static const int DefaultPriority = 0;   // SCHED_OTHER
+static const int DefaultCpu = -1;       // no CPU affinity
+static const std::size_t DefaultTraceEvents = 262144;  // events per thread
+static const int StdinPollTimeout = 200;    // milliseconds between checks for SIGINT
+static const unsigned int DiscoveryTimeout = 10000;    // milliseconds to wait for an announcement
+static const int CatchUpTimeout = 1000;     // milliseconds to wait for playback before requesting the history
+
+static volatile sig_atomic_t interrupted = 0;
 
 static void signalHandler(int) {
     static unsigned int count = 0;
+    interrupted = 1;
     count++;
     if (count > 1) {
         exit(EXIT_FAILURE);
     }
 }
 
+/** Reads a line of stdin. Unlike std::getline(), reads nothing beyond the
+ *  line, so poll() sees the lines that follow.
+ *
+ *  \param line the line without the newline.
+ *  \return false at the end of stdin.
+ */
+static bool readLine(std::string& line) {
+    line.clear();
+    char c = 0;
+    ssize_t n = 0;
+    while ((n = read(STDIN_FILENO, &c, 1)) == 1 && c != '\n') {
+        line.push_back(c);
+    }
+    return n == 1 || !line.empty();
+}
+
+/** Converts a time to a media timestamp. Receivers given the same time
+ *  schedule the same sample.
+ *
+ *  \param time seconds since the Unix epoch, or +seconds from now.
+ *  \param sampleRate the sample rate.
+ */
+static uint64_t parseTime(const std::string& time, unsigned int sampleRate) {
+    std::size_t end = 0;
+    double seconds = -1;
+    try {
+        seconds = std::stod(time, &end);
+    } catch (const std::exception&) {
+    }
+    if (end != time.size() || seconds < 0) {
+        throw std::runtime_error("Invalid time " + time);
+    }
+    if (time[0] == '+') {
+        return media_timestamp(get_time() + seconds, sampleRate);
+    }
+    return static_cast<uint64_t>(std::llround(seconds * sampleRate));
+}
+
+/** Schedules the playback of a player as given by a command, one of
+ *  "start", "stop", "mute" and "unmute" followed by a time, see parseTime().
+ *
+ *  \param command the command.
+ *  \param player the player.
+ *  \param sampleRate the sample rate.
+ *  \return false if the line is not a command.
+ */
+static bool schedule(const std::string& command, Player& player, unsigned int sampleRate) {
+    std::istringstream stream(command);
+    std::string action, time;
+    if (!(stream >> action >> time)) {
+        return false;
+    }
+    uint64_t sample = 0;
+    try {
+        sample = parseTime(time, sampleRate);
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (action == "start") {
+        player.scheduleStart(sample);
+    } else if (action == "stop") {
+        player.scheduleStop(sample);
+    } else if (action == "mute" || action == "unmute") {
+        player.scheduleMute(action == "mute", sample);
+    } else {
+        return false;
+    }
+    std::cout << "Scheduled " << action << " at sample " << sample << "\n";
+    return true;
+}
+
+/** Changes the latency of a player as given by a command "latency"
+ *  followed by the number of periods.
+ *
+ *  \param command the command.
+ *  \param player the player.
+ *  \return false if the line is not a command.
+ */
+static bool changeLatency(const std::string& command, Player& player) {
+    std::istringstream stream(command);
+    std::string action;
+    unsigned int latency = 0;
+    if (!(stream >> action >> latency) || action != "latency") {
+        return false;
+    }
+    if (!player.setLatency(latency)) {
+        std::cerr << "The latency must be between 1 and " << player.maxLatency() << " periods\n";
+    } else {
+        std::cout << "Latency set to " << latency << " periods\n";
+    }
+    return true;
+}
+
+/** Waits for SIGINT or the ID of another stream on a line of stdin. Lines
+ *  with commands schedule the playback or change the latency in between,
+ *  see schedule() and changeLatency().
+ *
+ *  \param current the ID of the current stream.
+ *  \param switching true if the stream can be switched.
+ *  \param player the player of the stream.
+ *  \param sampleRate the sample rate of the stream.
+ *  \return the ID of the next stream, the current ID after SIGINT.
+ */
+static unsigned short waitForStream(unsigned short current, bool switching, Player& player, unsigned int sampleRate) {
+    std::string line;
+    while (!interrupted) {
+        struct pollfd fd;
+        fd.fd = STDIN_FILENO;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        if (poll(&fd, 1, StdinPollTimeout) <= 0) {
+            continue;
+        }
+        if (!readLine(line)) {
+            // Without stdin only SIGINT ends the stream.
+            while (!interrupted) {
+                pause();
+            }
+            break;
+        }
+        if (schedule(line, player, sampleRate) || changeLatency(line, player)) {
+            continue;
+        }
+        try {
+            const auto value = std::stoul(line);
+            if (switching && value <= 65535 && value != current) {
+                return static_cast<unsigned short>(value);
+            }
+        } catch (const std::exception&) {
+        }
+        std::cerr << (switching ? "Expected the ID of another stream or a command\n" : "Expected a command\n");
+    }
+    return current;
+}
+
 int main(int argc, char* argv[]) {
     std::string deviceName = DefaultDeviceName;
+    double drift = DefaultDrift;
     unsigned int sampleRate = DefaultSampleRate;
     unsigned int periodTime = DefaultPeriodTime;
     unsigned int channels = DefaultChannels;
     unsigned int latency = DefaultLatency;
+    unsigned int periods = DefaultPeriods;
+    unsigned int maxLatency = 0;
+    std::string calibrationFile = DefaultCalibrationFile;
+    unsigned int calibrationTime = DefaultCalibrationTime;
+    std::string clockStateFile = DefaultClockStateFile;
     std::string address = DefaultAddress;
     unsigned short port = DefaultPort;
-    bool verbose = false;
+    unsigned short streamId = DefaultStreamId;
+    std::string senderAddress;
+    std::string redundantAddress, redundantInterface;
+    unsigned short redundantPort = 0;
+    std::string metricsName;
+    std::string ringInterface;
+    std::string traceFile;
+    std::size_t traceEvents = DefaultTraceEvents;
+    ThreadSettings audioSettings, networkSettings;
+    SocketSettings socketSettings;
+    bool verbose = false, mlock = false, calibrate = false, tuned = true, reactor = false, ioUring = false, discover = false;
+    bool catchUp = true;
+    std::string discoverAddress;
+    std::string startAt, stopAt;
 
     options_description desc("Options");
     desc.add_options()
-        ("device,d", value<std::string>(&deviceName)->default_value(DefaultDeviceName), "device name of the audio hardware")
+        ("device,d", value<std::string>(&deviceName)->default_value(DefaultDeviceName), "device name of the audio hardware, \"null\" or \"file:<path>\" for a headless device")
+        ("drift", value<double>(&drift)->default_value(DefaultDrift), "sample rate deviation of a headless device in ppm")
         ("samplerate,s", value<unsigned int>(&sampleRate)->default_value(DefaultSampleRate), "sample rate in sample per second")
         ("periodtime,t", value<unsigned int>(&periodTime)->default_value(DefaultPeriodTime), "period time in microseconds (125, 250, 333, 1000)")
         ("channels,c", value<unsigned int>(&channels)->default_value(DefaultChannels), "number of channels")
         ("latency,l", value<unsigned int>(&latency)->default_value(DefaultLatency), "the fixed latency in milliseconds")
+        ("max-latency", value<unsigned int>(&maxLatency)->default_value(0), "the largest latency in periods a \"latency <periods>\" line on stdin can set while running, 0 for twice the latency")
+        ("periods", value<unsigned int>(&periods)->default_value(DefaultPeriods), "number of periods in the buffer of the audio device")
+        ("calibrate", "search the lowest stable latency and number of device periods up to the given values and store the result")
+        ("calibration-file", value<std::string>(&calibrationFile)->default_value(DefaultCalibrationFile), "file storing the calibration, used when latency and periods are not given")
+        ("calibration-time", value<unsigned int>(&calibrationTime)->default_value(DefaultCalibrationTime), "measurement time of each calibration trial in seconds")
+        ("clock-state-file", value<std::string>(&clockStateFile)->default_value(DefaultClockStateFile), "file storing the locked clock state per stream and device to start from, empty to always start from nominal rates")
         ("address,a", value<std::string>(&address)->default_value(DefaultAddress), "destination address for the stream")
         ("port,p", value<unsigned short>(&port)->default_value(DefaultPort), "destination port for the stream")
+        ("stream,i", value<unsigned short>(&streamId)->default_value(DefaultStreamId), "ID of the stream to play")
+        ("discover", "wait for the SAP announcement of the stream and take its address, port and format from it, of the given address only if one is given")
+        ("sender", value<std::string>(&senderAddress), "join the stream at the control port address:port of the sender and take its format from the sender, read the IDs of further streams to switch to from stdin")
+        ("no-catch-up", "do not request the recent packets of a joined stream to fill the buffer at once")
+        ("start-at", value<std::string>(&startAt), "play silence until the given time in seconds since the Unix epoch, the same on all receivers, or +seconds from now")
+        ("stop-at", value<std::string>(&stopAt), "play silence from the given time on, see --start-at")
+        ("playback-priority", value<int>(&audioSettings.priority)->default_value(DefaultPriority), "SCHED_FIFO priority of the playback thread, 0 for SCHED_OTHER")
+        ("playback-cpu", value<int>(&audioSettings.cpu)->default_value(DefaultCpu), "CPU the playback thread is pinned to, -1 for any CPU")
+        ("receive-priority", value<int>(&networkSettings.priority)->default_value(DefaultPriority), "SCHED_FIFO priority of the receive thread, 0 for SCHED_OTHER")
+        ("receive-cpu", value<int>(&networkSettings.cpu)->default_value(DefaultCpu), "CPU the receive thread is pinned to, -1 for any CPU")
+        ("low-latency", "size the socket receive buffer from the latency instead of the system default")
+        ("busy-poll", value<int>(&socketSettings.busyPoll), "busy poll the socket for the given microseconds per receive, the receive thread spins and should have a CPU of its own")
+        ("interface", value<std::string>(&socketSettings.interface), "network interface to receive from and join the multicast group on")
+        ("redundant", value<std::string>(&redundantAddress), "also receive the stream from the multicast group address[:port] of a redundant path and merge both paths")
+        ("redundant-interface", value<std::string>(&redundantInterface), "network interface of the redundant path")
+        ("io-uring", "receive through an io_uring instead of recv(), falls back to recv() if io_uring is not available")
+        ("packet-ring", value<std::string>(&ringInterface), "receive from the given network interface through a memory-mapped AF_PACKET ring, requires CAP_NET_RAW")
+        ("mlock", "lock all memory pages of the process into RAM")
+        ("metrics", value<std::string>(&metricsName), "publish metrics to the shared-memory segment /streaming-<name>")
+        ("trace", value<std::string>(&traceFile), "record the pipeline stages and write them to the given file on exit")
+        ("trace-events", value<std::size_t>(&traceEvents)->default_value(DefaultTraceEvents), "number of most recent events kept per thread")
+        ("reactor", "receive, resample and play back in a single thread using the playback thread settings")
         ("verbose,v", "verbose output")
         ("help,h", "produce help message");
 
@@ -63,37 +281,297 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         verbose = vm.count("verbose") > 0;
+        mlock = vm.count("mlock") > 0;
+        calibrate = vm.count("calibrate") > 0;
+        reactor = vm.count("reactor") > 0;
+        ioUring = vm.count("io-uring") > 0;
+        discover = vm.count("discover") > 0;
+        catchUp = vm.count("no-catch-up") == 0;
+        for (const auto& time : {startAt, stopAt}) {
+            if (!time.empty()) {
+                parseTime(time, sampleRate);
+            }
+        }
+        if (discover && !vm["address"].defaulted()) {
+            discoverAddress = address;
+        }
+        if (discover && !senderAddress.empty()) {
+            throw std::runtime_error("--discover cannot be combined with --sender");
+        }
+        if (vm.count("low-latency")) {
+            socketSettings.receiveBuffer = SocketSettings::AutoBuffer;
+        }
+        tuned = !vm["latency"].defaulted() || !vm["periods"].defaulted();
+        redundantPort = port;
+        const auto colon = redundantAddress.rfind(':');
+        if (colon != std::string::npos) {
+            const auto value = std::stoul(redundantAddress.substr(colon + 1));
+            if (value == 0 || value > 65535) {
+                throw std::runtime_error("Invalid port in " + redundantAddress);
+            }
+            redundantPort = static_cast<unsigned short>(value);
+            redundantAddress = redundantAddress.substr(0, colon);
+        }
+        if (!redundantAddress.empty() && (!senderAddress.empty() || !ringInterface.empty())) {
+            throw std::runtime_error("--redundant cannot be combined with --sender or --packet-ring");
+        }
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << "\n";
         std::cout << desc << "\n";
         return -1;
     }
 
+    if (discover) {
+        try {
+            StreamAnnouncement announcement;
+            if (!waitForAnnouncement(streamId, discoverAddress, DiscoveryTimeout, socketSettings.interface, announcement)) {
+                throw std::runtime_error("No announcement of stream " + std::to_string(streamId) + " within "
+                    + std::to_string(DiscoveryTimeout / 1000) + "s");
+            }
+            address = announcement.address;
+            port = announcement.port;
+            sampleRate = announcement.sampleRate;
+            periodTime = announcement.periodTime;
+            channels = announcement.channels;
+            std::cout << "Discovered stream " << streamId << " at " << address << ":" << port << " with "
+                      << sampleRate << "Hz, " << periodTime << "us per period, " << channels << " channels\n";
+        } catch (const std::exception& ex) {
+            std::cerr << "Error: " << ex.what() << "\n";
+            return -1;
+        }
+    }
+
     if (verbose) {
         std::cout << "Receiving stream from " << address << ":" << port << "\n";
+        if (!redundantAddress.empty()) {
+            std::cout << "Receiving redundant copies from " << redundantAddress << ":" << redundantPort << "\n";
+        }
+    }
+
+    if (mlock) {
+        lockMemory();
+    }
+
+    if (!traceFile.empty()) {
+        trace_enable("receiver", traceEvents);
     }
 
     try {
-        const auto periodSize = static_cast<unsigned int>(std::ceil(sampleRate * 0.000001 * periodTime));
+        std::unique_ptr<Metrics> metrics;
+        if (!metricsName.empty()) {
+            metrics.reset(new Metrics(metricsName));
+        }
+
+        // Builds the pipeline, runs the body while the pipeline is running and stops it again.
+        auto run = [&] (unsigned int bufferLatency, unsigned int devicePeriods,
+            const std::function<void (Receiver&, Player&)>& body) {
+            // Rounded like the sender, the packet header carries its period size.
+            const auto periodSize = static_cast<unsigned int>(std::round(sampleRate * 0.000001 * periodTime));
+            std::atomic<bool> streaming(false);
+            SharedTimeInfo timeInfo;
+            // The buffer is allocated once for the largest latency set at runtime.
+            CircularBuffer buffer(periodSize, channels, std::max(bufferLatency, maxLatency != 0 ? maxLatency : 2 * bufferLatency));
+
+            Receiver receiver(address, port, streamId, sampleRate, periodTime, periodSize,
+                channels, bufferLatency, buffer, timeInfo, streaming);
+            auto device = createAudioDevice(deviceName, AudioDevice::Direction::Playback, sampleRate, periodSize,
+                devicePeriods, channels, drift);
+            Player player(*device, sampleRate, periodTime, channels, bufferLatency,
+                buffer, timeInfo, streaming);
+
+            if (metrics) {
+                receiver.setMetrics(*metrics);
+                player.setMetrics(*metrics);
+            }
+            receiver.setSocketSettings(socketSettings);
+            if (!startAt.empty()) {
+                player.scheduleStart(parseTime(startAt, sampleRate));
+            }
+            if (!stopAt.empty()) {
+                player.scheduleStop(parseTime(stopAt, sampleRate));
+            }
+
+            // The clocks of the same sender and device drift at an almost constant rate.
+            ClockState clock((senderAddress.empty() ? address + ":" + std::to_string(port) : senderAddress)
+                + "/" + std::to_string(streamId), deviceName);
+            if (!clockStateFile.empty() && clock.load(clockStateFile)) {
+                receiver.setClockState(clock);
+                player.setClockRate(clock.deviceRate);
+                if (verbose) {
+                    std::cout << "Starting from resampling ratio " << clock.ratio << " of " << clockStateFile << "\n";
+                }
+            }
+            if (!redundantAddress.empty()) {
+                receiver.setRedundantPath(redundantAddress, redundantPort, redundantInterface);
+            }
+
+            if (reactor) {
+                Reactor loop(receiver, player, *device);
+                loop.setThreadSettings(audioSettings);
+                loop.start();
+                body(receiver, player);
+                loop.stop();
+            } else if (!ringInterface.empty()) {
+                PacketRing ring(ringInterface);
+                ring.subscribe(address, port, streamId, [&receiver] (uint8_t* packet, std::size_t size, double arrival) {
+                    receiver.deliver(packet, size, arrival);
+                });
+                ring.setThreadSettings(networkSettings);
+                if (metrics) {
+                    ring.setMetrics(*metrics);
+                }
+                player.setThreadSettings(audioSettings);
+
+                receiver.prepare();
+                ring.start();
+                player.start();
 
-        std::atomic<bool> streaming(false);
-        ReaderWriterQueue<double> timeinfoQueue(10);
-        CircularBuffer buffer(periodSize, channels, latency);
+                body(receiver, player);
+                ring.stop();
+            } else {
+                receiver.setThreadSettings(networkSettings);
+                receiver.setIoUring(ioUring);
+                player.setThreadSettings(audioSettings);
 
-        Receiver receiver(address, port, sampleRate, periodTime, periodSize, 
-            channels, latency, buffer, timeinfoQueue, streaming);
-        Player player(deviceName, sampleRate, periodTime, channels, latency,
-            buffer, timeinfoQueue, streaming);
+                receiver.start();
+                player.start();
 
-        receiver.start();
-        player.start();
+                body(receiver, player);
+            }
+
+            player.stop();
+            receiver.stop();
+
+            if (!clockStateFile.empty() && receiver.synchronized()) {
+                receiver.getClockState(clock);
+                clock.deviceRate = player.clockRate();
+                try {
+                    clock.save(clockStateFile);
+                } catch (const std::exception& ex) {
+                    std::cerr << "Failed to save the clock state: " << ex.what() << "\n";
+                }
+            }
+        };
 
         signal(SIGINT, signalHandler);
-        pause();
 
-        player.stop();
-        receiver.stop();
+        if (calibrate) {
+            // Searches the configuration with the lowest total latency that
+            // runs without dropouts. A trial is skipped if it cannot beat
+            // the best stable configuration found so far.
+            Calibration result;
+            bool found = false;
+            const auto maxPeriods = std::max(periods, MaxCalibrationPeriods);
+            for (unsigned int devicePeriods = 2; devicePeriods <= maxPeriods; ++devicePeriods) {
+                for (unsigned int bufferLatency = 1; bufferLatency <= latency; ++bufferLatency) {
+                    if (found && bufferLatency + devicePeriods >= result.latency + result.periods) {
+                        break;
+                    }
+
+                    CalibrationTrial trial;
+                    trial.latency = bufferLatency;
+                    trial.periods = devicePeriods;
+                    run(bufferLatency, devicePeriods, [&] (Receiver& receiver, Player& player) {
+                        std::this_thread::sleep_for(std::chrono::seconds(CalibrationWarmup));
+                        receiver.resetJitter();
+                        player.resetStatistics();
+                        std::this_thread::sleep_for(std::chrono::seconds(calibrationTime));
+                        const auto statistics = player.statistics();
+                        trial.xruns = statistics.xruns;
+                        trial.underruns = statistics.underruns;
+                        trial.minHeadroom = statistics.minHeadroom;
+                        trial.jitter = receiver.jitter();
+                    });
+
+                    std::cout << "Latency " << trial.latency << ", device periods " << trial.periods
+                              << ": " << trial.xruns << " xruns, " << trial.underruns << " underruns, "
+                              << "min headroom " << trial.minHeadroom << " frames, "
+                              << "jitter " << trial.jitter * 1000000.0 << "us, "
+                              << (trial.stable() ? "stable" : "unstable") << "\n";
+
+                    if (trial.stable()) {
+                        found = true;
+                        result.latency = trial.latency;
+                        result.periods = trial.periods;
+                        result.jitter = trial.jitter;
+                        break;
+                    }
+                }
+            }
+
+            if (!found) {
+                std::cerr << "No stable configuration found up to a latency of " << latency << " periods\n";
+                return -1;
+            }
+
+            result.deviceName = deviceName;
+            result.sampleRate = sampleRate;
+            result.periodTime = periodTime;
+            result.channels = channels;
+            result.save(calibrationFile);
+            std::cout << "Calibrated latency of " << result.latency << " periods with " << result.periods
+                      << " device periods written to " << calibrationFile << "\n";
+            return 0;
+        }
+
+        if (!tuned) {
+            Calibration calibration;
+            if (calibration.load(calibrationFile) && calibration.matches(deviceName, sampleRate, periodTime, channels)) {
+                latency = calibration.latency;
+                periods = calibration.periods;
+                std::cout << "Using calibrated latency of " << latency << " periods with " << periods
+                          << " device periods from " << calibrationFile << "\n";
+            }
+        }
+
+        if (!senderAddress.empty()) {
+            const auto colon = senderAddress.rfind(':');
+            if (colon == std::string::npos) {
+                throw std::runtime_error("Expected address:port of the control port of the sender");
+            }
+            const auto controlPort = std::stoul(senderAddress.substr(colon + 1));
+            if (controlPort == 0 || controlPort > 65535) {
+                throw std::runtime_error("Invalid control port in " + senderAddress);
+            }
+            ControlClient client(senderAddress.substr(0, colon), static_cast<unsigned short>(controlPort), port);
+            unsigned short nextStreamId = streamId;
+            do {
+                const auto format = client.join(nextStreamId);
+                streamId = nextStreamId;
+                sampleRate = format.sampleRate;
+                periodTime = format.periodTime;
+                channels = format.channels;
+                std::cout << "Joined stream " << streamId << " with " << sampleRate << "Hz, " << periodTime
+                          << "us per period, " << channels << " channels\n";
+                run(latency, periods, [&] (Receiver& receiver, Player& player) {
+                    if (catchUp) {
+                        // The history fills the buffer ahead of the first packet written for playback.
+                        for (int waited = 0; !receiver.writing() && !interrupted && waited < CatchUpTimeout; ++waited) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                        if (receiver.writing()) {
+                            client.catchUp(latency * periodTime);
+                        }
+                    }
+                    nextStreamId = waitForStream(streamId, true, player, sampleRate);
+                });
+                client.leave();
+            } while (!interrupted);
+        } else {
+            run(latency, periods, [&] (Receiver&, Player& player) {
+                waitForStream(streamId, false, player, sampleRate);
+            });
+        }
     } catch (const std::exception& ex) {
         std::cerr << "Exception: " << ex.what() << "\n";
     }
+
+    if (!traceFile.empty()) {
+        try {
+            trace_dump(traceFile);
+            std::cout << "Trace written to " << traceFile << "\n";
+        } catch (const std::exception& ex) {
+            std::cerr << "Exception: " << ex.what() << "\n";
+        }
+    }
 }
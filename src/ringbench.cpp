@@ -0,0 +1,303 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "PacketRing.h"
+#include "Receiver.h"
+#include "CircularBuffer.h"
+#include "TimeInfo.h"
+#include "Packet.h"
+#include "Utils.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace boost::program_options;
+
+static const unsigned int DefaultStreams = 32;
+static const unsigned int DefaultDuration = 5;      // seconds per measurement
+static const unsigned int DefaultPeriodTime = 1000; // us
+static const unsigned int DefaultSampleRate = 48000;
+static const unsigned int DefaultChannels = 2;
+static const unsigned short DefaultPort = 24000;    // port of the first stream
+static const std::string DefaultInterface = "lo";
+static const std::string Loopback = "127.0.0.1";
+static const unsigned int Latency = 4;              // periods
+
+/** The receiving side of a stream: a Receiver resampling into its own buffer.
+ */
+struct Stream {
+    Stream(unsigned short port, uint16_t streamId, unsigned int sampleRate, unsigned int periodTime,
+        unsigned int periodSize, unsigned int channels)
+    : buffer(periodSize, channels, Latency)
+    , timeInfo()
+    , streaming(true)
+    , receiver(Loopback, port, streamId, sampleRate, periodTime, periodSize, channels, Latency,
+        buffer, timeInfo, streaming)
+    , received(0) {
+        receiver.prepare();
+    }
+
+    CircularBuffer buffer;          /**< The buffer the receiver writes to. */
+    SharedTimeInfo timeInfo;        /**< The timing state, never published. */
+    std::atomic<bool> streaming;    /**< Set, so packets are resampled.     */
+    Receiver receiver;              /**< The receiver of the stream.        */
+    uint64_t received;              /**< The packets handed to the receiver.    */
+};
+
+/** The configuration of a measurement.
+ */
+struct Config {
+    unsigned int streams;       /**< The number of streams.             */
+    unsigned int duration;      /**< The measurement time in seconds.   */
+    unsigned int sampleRate;    /**< The sample rate.                   */
+    unsigned int periodTime;    /**< The period time in microseconds.   */
+    unsigned int periodSize;    /**< The period size in frames.         */
+    unsigned int channels;      /**< The number of channels.            */
+    unsigned short port;        /**< The port of the first stream.      */
+    std::string interface;      /**< The interface of the packet ring.  */
+};
+
+/** The result of a measurement.
+ */
+struct Result {
+    uint64_t sent;      /**< The number of packets sent.                            */
+    uint64_t received;  /**< The number of packets handed to the receivers.         */
+    double cpu;         /**< The CPU time of the process without the sender in seconds. */
+    double elapsed;     /**< The wall-clock time in seconds.                        */
+};
+
+/** Returns the value of a clock in seconds.
+ */
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 0.000000001;
+}
+
+/** Sends one packet per stream and period to consecutive ports on the
+ *  loopback address for the duration of the measurement.
+ *
+ *  \param cpu set to the CPU time of the sending thread in seconds.
+ *  \return the number of packets sent.
+ */
+static uint64_t send(const Config& config, double& cpu) {
+    const auto begin = seconds(CLOCK_THREAD_CPUTIME_ID);
+    const uint32_t periodBytes = config.periodSize * config.channels * static_cast<uint32_t>(sizeof(int16_t));
+    const auto epoch = static_cast<uint32_t>(time_origin());
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    std::vector<std::unique_ptr<Packet>> packets;
+    std::vector<struct sockaddr_in> addrs(config.streams);
+    std::vector<struct iovec> iovs(config.streams);
+    std::vector<struct mmsghdr> messages(config.streams);
+    for (unsigned int i = 0; i < config.streams; ++i) {
+        packets.emplace_back(new Packet(periodBytes));
+        memset(packets[i]->data_, 0, periodBytes);
+        packets[i]->setStream(static_cast<uint16_t>(i + 1), epoch);
+        packets[i]->setFormat(config.sampleRate, static_cast<uint16_t>(config.periodSize), static_cast<uint8_t>(config.channels));
+        packets[i]->setPeriods(1, periodBytes);
+        memset(&addrs[i], 0, sizeof(addrs[i]));
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addrs[i].sin_port = htons(static_cast<unsigned short>(config.port + i));
+        iovs[i].iov_base = packets[i]->packet_;
+        iovs[i].iov_len = packets[i]->length_;
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_name = &addrs[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        messages[i].msg_hdr.msg_iov = &iovs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint64_t sent = 0;
+    const uint64_t periods = static_cast<uint64_t>(config.duration) * 1000000 / config.periodTime;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint64_t period = 0; period < periods; ++period) {
+        for (auto& packet : packets) {
+            packet->setTimestamp(period * config.periodSize);
+        }
+        const int n = sendmmsg(fd, messages.data(), config.streams, 0);
+        if (n > 0) {
+            sent += static_cast<uint64_t>(n);
+        }
+        next.tv_nsec += static_cast<long>(config.periodTime) * 1000;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec += 1;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    }
+    close(fd);
+    cpu = seconds(CLOCK_THREAD_CPUTIME_ID) - begin;
+    return sent;
+}
+
+/** Creates the receiving side of all streams.
+ */
+static std::vector<std::unique_ptr<Stream>> createStreams(const Config& config) {
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (unsigned int i = 0; i < config.streams; ++i) {
+        streams.emplace_back(new Stream(static_cast<unsigned short>(config.port + i), static_cast<uint16_t>(i + 1),
+            config.sampleRate, config.periodTime, config.periodSize, config.channels));
+    }
+    return streams;
+}
+
+/** Measures one socket and one thread with recv() per stream.
+ */
+static Result measureSockets(const Config& config) {
+    auto streams = createStreams(config);
+    std::vector<int> sockets;
+    for (unsigned int i = 0; i < config.streams; ++i) {
+        const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<unsigned short>(config.port + i));
+        if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error(std::string("Failed to bind socket: ") + strerror(errno));
+        }
+        sockets.push_back(fd);
+    }
+
+    const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+    const double start = seconds(CLOCK_MONOTONIC);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < config.streams; ++i) {
+        threads.emplace_back([&streams, &sockets, i] () {
+            Stream& stream = *streams[i];
+            uint8_t packet[Packet::headerSize + 65536];
+            ssize_t n;
+            while ((n = recv(sockets[i], packet, sizeof(packet), 0)) > 0) {
+                stream.receiver.deliver(packet, static_cast<std::size_t>(n), get_time());
+                stream.received += 1;
+            }
+        });
+    }
+
+    Result result = { 0, 0, 0, 0 };
+    double senderCpu = 0;
+    result.sent = send(config, senderCpu);
+    for (const auto fd : sockets) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu - senderCpu;
+    result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    for (const auto fd : sockets) {
+        close(fd);
+    }
+    for (const auto& stream : streams) {
+        result.received += stream->received;
+    }
+    return result;
+}
+
+/** Measures a single packet ring dispatching to all streams.
+ */
+static Result measureRing(const Config& config) {
+    auto streams = createStreams(config);
+    PacketRing ring(config.interface);
+    for (unsigned int i = 0; i < config.streams; ++i) {
+        Stream& stream = *streams[i];
+        ring.subscribe(Loopback, static_cast<unsigned short>(config.port + i), static_cast<uint16_t>(i + 1),
+            [&stream] (uint8_t* packet, std::size_t size, double arrival) {
+                stream.receiver.deliver(packet, size, arrival);
+                stream.received += 1;
+            });
+    }
+
+    const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+    const double start = seconds(CLOCK_MONOTONIC);
+    ring.start();
+
+    Result result = { 0, 0, 0, 0 };
+    double senderCpu = 0;
+    result.sent = send(config, senderCpu);
+    // Lets the ring hand over the last block.
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ring.stop();
+    result.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu - senderCpu;
+    result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    for (const auto& stream : streams) {
+        result.received += stream->received;
+    }
+    return result;
+}
+
+/** Prints a result.
+ */
+static void print(const char* path, const Config& config, const Result& result) {
+    const double perPacket = result.received > 0 ? result.cpu * 1000000.0 / static_cast<double>(result.received) : 0;
+    const double loss = result.sent > 0 ? 100.0 * static_cast<double>(result.sent - std::min(result.sent, result.received))
+        / static_cast<double>(result.sent) : 0;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(10) << path << std::setw(10) << config.streams
+              << std::setw(14) << static_cast<double>(result.received) / result.elapsed
+              << std::setw(10) << loss << std::setw(10) << result.cpu * 100.0 / result.elapsed
+              << std::setw(14) << perPacket << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    config.interface = DefaultInterface;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("streams", value<unsigned int>(&config.streams)->default_value(DefaultStreams), "number of streams")
+        ("duration", value<unsigned int>(&config.duration)->default_value(DefaultDuration), "measurement time per path in seconds")
+        ("rate,r", value<unsigned int>(&config.sampleRate)->default_value(DefaultSampleRate), "sample rate")
+        ("periodtime,t", value<unsigned int>(&config.periodTime)->default_value(DefaultPeriodTime), "period time in microseconds")
+        ("channels,c", value<unsigned int>(&config.channels)->default_value(DefaultChannels), "number of channels")
+        ("port,p", value<unsigned short>(&config.port)->default_value(DefaultPort), "port of the first stream, the others follow")
+        ("interface,i", value<std::string>(&config.interface)->default_value(DefaultInterface), "interface of the packet ring")
+        ("help,h", "produce help message");
+
+    try {
+        variables_map vm;
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 1;
+        }
+        if (config.streams == 0 || config.periodTime == 0) {
+            throw std::runtime_error("streams and periodtime must be positive");
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+    config.periodSize = static_cast<unsigned int>(std::lround(config.sampleRate * 0.000001 * config.periodTime));
+
+    std::cout << std::setw(10) << "path" << std::setw(10) << "streams" << std::setw(14) << "packets/s"
+              << std::setw(10) << "loss %" << std::setw(10) << "cpu %" << std::setw(14) << "us/packet" << "\n";
+    try {
+        print("sockets", config, measureSockets(config));
+        print("ring", config, measureRing(config));
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << "\n";
+        return -1;
+    }
+    return 0;
+}
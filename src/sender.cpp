@@ -2,41 +2,159 @@
 // Distributed under the BSD license.
 
 #include "Recorder.h"
+#include "AudioDevice.h"
 #include "Transmitter.h"
 #include "PacketPool.h"
 #include "Packet.h"
+#include "Realtime.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "ControlServer.h"
+#include "Announcement.h"
 
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <memory>
+#include <vector>
+#include <stdexcept>
 #include <unistd.h>
+#include <signal.h>
 
 using namespace boost::program_options;
 
 static const std::string DefaultDeviceName = "default";
+static const double DefaultDrift = 0;   // drift of a headless device in ppm
 static const unsigned int DefaultSampleRate = 48000;
 static const unsigned int DefaultPeriodTime = 1000; // period time in microseconds
+static const unsigned int DefaultPacketTime = 0;    // packet time in microseconds, 0 for the period time
 static const unsigned int DefaultChannels = 2;
+static const unsigned int DefaultPeriods = 2;  // periods in the buffer of the audio device
 static const std::string DefaultAddress = "224.1.2.3";
 static const unsigned int DefaultPort = 23776;
+static const unsigned short DefaultStreamId = 0;
+static const unsigned int DefaultSplit = 0;    // channels per stream, 0 for all channels of a device
+static const unsigned int PacketsPerStream = 5;
+static const int DefaultPriority = 0;   // SCHED_OTHER
+static const int DefaultCpu = -1;       // no CPU affinity
+static const std::size_t DefaultTraceEvents = 262144;  // events per thread
+static const unsigned short DefaultControlPort = 0;    // no control port
+static const unsigned int MembershipTimeout = 5000;    // in milliseconds
+static const unsigned int DefaultHistory = 100;        // milliseconds of packets kept for receivers joining late
+static const std::string DefaultPacing = "off";
+static const unsigned int DefaultPacingDelay = 500;    // in microseconds after the timestamp of a packet
+static const unsigned int DefaultAnnounceInterval = 1000;  // in milliseconds, 0 to disable
+static const int LowLatencyPriority = 6;                // SO_PRIORITY, the highest without CAP_NET_ADMIN
+static const int ExpeditedForwarding = 46;              // DSCP EF
+
+static void signalHandler(int) {
+    static unsigned int count = 0;
+    count++;
+    if (count > 1) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** Parses a unicast destination of the form address[:port].
+ *
+ *  \param destination the destination.
+ *  \param port the port used if the destination does not contain one.
+ */
+static boost::asio::ip::udp::endpoint parseDestination(const std::string& destination, unsigned short port) {
+    std::string address = destination;
+    const auto colon = destination.rfind(':');
+    if (colon != std::string::npos) {
+        address = destination.substr(0, colon);
+        const auto value = std::stoul(destination.substr(colon + 1));
+        if (value == 0 || value > 65535) {
+            throw std::runtime_error("Invalid port in destination " + destination);
+        }
+        port = static_cast<unsigned short>(value);
+    }
+    boost::system::error_code ec;
+    const auto ip = boost::asio::ip::address_v4::from_string(address, ec);
+    if (ec) {
+        throw std::runtime_error("Invalid IPv4 address in destination " + destination);
+    }
+    return boost::asio::ip::udp::endpoint(ip, port);
+}
+
+/** Parses the way packets are paced.
+ *
+ *  \param name one of "off", "fq", "etf" and "user".
+ */
+static Transmitter::Pacing parsePacing(const std::string& name) {
+    if (name == "off") {
+        return Transmitter::Pacing::Off;
+    } else if (name == "fq") {
+        return Transmitter::Pacing::Fq;
+    } else if (name == "etf") {
+        return Transmitter::Pacing::Etf;
+    } else if (name == "user") {
+        return Transmitter::Pacing::User;
+    }
+    throw std::runtime_error("Invalid pacing " + name);
+}
 
 int main(int argc, char* argv[]) {
-    std::string deviceName = DefaultDeviceName;
+    std::vector<std::string> deviceNames;
+    double drift = DefaultDrift;
     unsigned int sampleRate = DefaultSampleRate;
     unsigned int periodTime = DefaultPeriodTime;
+    unsigned int packetTime = DefaultPacketTime;
     unsigned int channels = DefaultChannels;
+    unsigned int periods = DefaultPeriods;
     std::string address = DefaultAddress;
     unsigned short port = DefaultPort;
-    bool verbose = false, click = false;
+    std::vector<std::string> destinations;
+    std::string redundant, redundantInterface, primaryInterface;
+    unsigned short streamId = DefaultStreamId;
+    unsigned int split = DefaultSplit;
+    unsigned short controlPort = DefaultControlPort;
+    std::string pacingName = DefaultPacing;
+    unsigned int pacingDelay = DefaultPacingDelay;
+    unsigned int announceInterval = DefaultAnnounceInterval;
+    unsigned int history = DefaultHistory;
+    Transmitter::Pacing pacing = Transmitter::Pacing::Off;
+    std::string metricsName;
+    std::string traceFile;
+    std::size_t traceEvents = DefaultTraceEvents;
+    ThreadSettings audioSettings, networkSettings;
+    SocketSettings socketSettings;
+    bool verbose = false, click = false, mlock = false, multicast = true, ioUring = false;
 
     options_description desc("Options");
     desc.add_options()
-        ("device,d", value<std::string>(&deviceName)->default_value(DefaultDeviceName), "device name of the audio hardware")
+        ("device,d", value<std::vector<std::string>>(&deviceNames)->composing(), "device name of the audio hardware, \"null\" or \"file:<path>\" for a headless device, may be repeated (default \"default\")")
+        ("drift", value<double>(&drift)->default_value(DefaultDrift), "sample rate deviation of a headless device in ppm")
         ("samplerate,s", value<unsigned int>(&sampleRate)->default_value(DefaultSampleRate), "sample rate in sample per second")
-        ("periodtime,t", value<unsigned int>(&periodTime)->default_value(DefaultPeriodTime), "packet time in microseconds (125, 250, 333, 1000)")
-        ("channels,c", value<unsigned int>(&channels)->default_value(DefaultChannels), "number of channels")
+        ("periodtime,t", value<unsigned int>(&periodTime)->default_value(DefaultPeriodTime), "period time of the audio device in microseconds (125, 250, 333, 1000)")
+        ("packettime", value<unsigned int>(&packetTime)->default_value(DefaultPacketTime), "time in microseconds sent in one packet, a multiple of the period time, 0 for the period time")
+        ("channels,c", value<unsigned int>(&channels)->default_value(DefaultChannels), "number of channels of each device")
+        ("split", value<unsigned int>(&split)->default_value(DefaultSplit), "number of channels per stream, 0 to send all channels of a device in one stream")
+        ("periods", value<unsigned int>(&periods)->default_value(DefaultPeriods), "number of periods in the buffer of the audio device")
         ("address,a", value<std::string>(&address)->default_value(DefaultAddress), "destination address for the stream")
         ("port,p", value<unsigned short>(&port)->default_value(DefaultPort), "destination port for the stream")
+        ("unicast,u", value<std::vector<std::string>>(&destinations)->composing(), "send to the unicast destination address[:port] instead of the address, may be repeated")
+        ("stream,i", value<unsigned short>(&streamId)->default_value(DefaultStreamId), "ID of the first stream, the following streams are numbered consecutively")
+        ("control-port", value<unsigned short>(&controlPort)->default_value(DefaultControlPort), "UDP port receivers join and leave streams on, 0 to disable")
+        ("history", value<unsigned int>(&history)->default_value(DefaultHistory), "milliseconds of recent packets per stream sent at once to receivers joining at the control port, 0 to disable")
+        ("pacing", value<std::string>(&pacingName)->default_value(DefaultPacing), "pace packets by their timestamps: \"off\", \"fq\" or \"etf\" for SO_TXTIME with that qdisc, \"user\" for the network thread")
+        ("pacing-delay", value<unsigned int>(&pacingDelay)->default_value(DefaultPacingDelay), "time in microseconds from the timestamp of a packet to its departure when pacing")
+        ("announce-interval", value<unsigned int>(&announceInterval)->default_value(DefaultAnnounceInterval), "time in milliseconds between SAP announcements of multicast streams, 0 to disable")
         ("click,k", "generate click sound every second instead of capturing PCM from the audio interface")
+        ("capture-priority", value<int>(&audioSettings.priority)->default_value(DefaultPriority), "SCHED_FIFO priority of the capture thread, 0 for SCHED_OTHER")
+        ("capture-cpu", value<int>(&audioSettings.cpu)->default_value(DefaultCpu), "CPU the capture thread is pinned to, -1 for any CPU")
+        ("network-priority", value<int>(&networkSettings.priority)->default_value(DefaultPriority), "SCHED_FIFO priority of the network thread, 0 for SCHED_OTHER")
+        ("network-cpu", value<int>(&networkSettings.cpu)->default_value(DefaultCpu), "CPU the network thread is pinned to, -1 for any CPU")
+        ("low-latency", "send with socket priority 6 and DSCP EF for expedited forwarding")
+        ("interface", value<std::string>(&socketSettings.interface), "network interface to send from, also for multicast")
+        ("redundant", value<std::string>(&redundant), "send every packet a second time to the address[:port] of a redundant path")
+        ("redundant-interface", value<std::string>(&redundantInterface), "network interface of the redundant path")
+        ("io-uring", "send through an io_uring instead of sendmmsg(), falls back to sendmmsg() if io_uring is not available")
+        ("mlock", "lock all memory pages of the process into RAM")
+        ("metrics", value<std::string>(&metricsName), "publish metrics to the shared-memory segment /streaming-<name>")
+        ("trace", value<std::string>(&traceFile), "record the pipeline stages and write them to the given file on exit")
+        ("trace-events", value<std::size_t>(&traceEvents)->default_value(DefaultTraceEvents), "number of most recent events kept per thread")
         ("verbose,v", "verbose output")
         ("help,h", "produce help message");
 
@@ -49,38 +167,203 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         verbose = vm.count("verbose") > 0;
+        mlock = vm.count("mlock") > 0;
         click = vm.count("click") > 0;
+        ioUring = vm.count("io-uring") > 0;
+        if (vm.count("low-latency")) {
+            socketSettings.priority = LowLatencyPriority;
+            socketSettings.dscp = ExpeditedForwarding;
+        }
+        // With a control port, only joined receivers get the streams unless an address is given.
+        multicast = controlPort == 0 || !vm["address"].defaulted();
+        if (deviceNames.empty()) {
+            deviceNames.push_back(DefaultDeviceName);
+        }
+        pacing = parsePacing(pacingName);
+        if (packetTime == 0) {
+            packetTime = periodTime;
+        }
+        if (packetTime % periodTime != 0 || packetTime / periodTime > Packet::maxPeriods) {
+            throw std::runtime_error("The packet time must be a multiple of the period time, up to "
+                + std::to_string(Packet::maxPeriods) + " periods");
+        }
+        if (!redundant.empty()) {
+            // The interfaces of both paths are chosen per packet, the socket is not bound.
+            primaryInterface = socketSettings.interface;
+            socketSettings.interface.clear();
+        } else if (!redundantInterface.empty()) {
+            throw std::runtime_error("--redundant-interface requires --redundant");
+        }
+        if (split == 0) {
+            split = channels;
+        }
+        if (split > channels || channels % split != 0) {
+            throw std::runtime_error("The number of channels must be a multiple of --split");
+        }
+        if (split > Packet::maxChannels) {
+            throw std::runtime_error("A stream has at most " + std::to_string(Packet::maxChannels) + " channels");
+        }
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << "\n";
         std::cout << desc << "\n";
         return -1;
     }
 
-    if (verbose) {
-        std::cout << "Streaming to " << address << ":" << port << " with " << sampleRate << "Hz, " << periodTime << "us per packet, " << channels << " channels\n";
+    if (verbose && !destinations.empty()) {
+        std::cout << "Streaming to " << destinations.size() << " unicast destinations with " << sampleRate << "Hz, " << packetTime << "us per packet, " << channels << " channels\n";
+    } else if (verbose && multicast) {
+        std::cout << "Streaming to " << address << ":" << port << " with " << sampleRate << "Hz, " << packetTime << "us per packet, " << channels << " channels\n";
+    }
+
+    if (mlock) {
+        lockMemory();
+    }
+
+    if (!traceFile.empty()) {
+        trace_enable("sender", traceEvents);
     }
 
     try {
-        const unsigned int payloadSize = static_cast<unsigned int>(std::round(sampleRate * 0.000001 * periodTime)) * channels * static_cast<unsigned int>(sizeof(int16_t));
+        const auto periodSize = static_cast<unsigned int>(std::round(sampleRate * 0.000001 * periodTime));
+        const unsigned int periodsPerPacket = packetTime / periodTime;
+        const unsigned int payloadSize = periodsPerPacket * periodSize * split * static_cast<unsigned int>(sizeof(int16_t));
+        const unsigned int streamsPerDevice = channels / split;
         Recorder::Mode mode = click ? Recorder::Mode::Click : Recorder::Mode::Capture;
 
+        std::unique_ptr<Metrics> metrics;
+        if (!metricsName.empty()) {
+            metrics.reset(new Metrics(metricsName));
+        }
+
+        // All streams share one pool, the packets are owned by the slab.
         PacketPool pool;
-        for (int i = 0; i < 5; ++i) {
-            pool.push(new Packet(payloadSize));
+        std::vector<std::unique_ptr<Packet>> slab;
+        // Paced packets are held by the transmitter for up to the pacing delay.
+        const unsigned int packetsPerStream = PacketsPerStream
+            + (pacing != Transmitter::Pacing::Off ? pacingDelay / packetTime + 1 : 0);
+        for (unsigned int i = 0; i < packetsPerStream * streamsPerDevice * deviceNames.size(); ++i) {
+            slab.emplace_back(new Packet(payloadSize));
+            pool.push(slab.back().get());
+        }
+        std::vector<boost::asio::ip::udp::endpoint> endpoints;
+        for (const auto& destination : destinations) {
+            endpoints.push_back(parseDestination(destination, port));
+        }
+        if (endpoints.empty() && multicast) {
+            endpoints.push_back(boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string(address), port));
+        }
+        Transmitter transmitter(endpoints, pool);
+        transmitter.setThreadSettings(networkSettings);
+        transmitter.setSocketSettings(socketSettings);
+        if (!redundant.empty()) {
+            const std::vector<boost::asio::ip::udp::endpoint> path(1, parseDestination(redundant, port));
+            if (!transmitter.setRedundantPath(path, primaryInterface, redundantInterface)) {
+                throw std::runtime_error("Unknown network interface of a path");
+            }
+            if (verbose) {
+                std::cout << "Sending a redundant copy to " << path.front() << "\n";
+            }
+        }
+        if (ioUring && transmitter.setIoUring() && verbose) {
+            std::cout << "Sending through io_uring\n";
+        }
+        if (metrics) {
+            transmitter.setMetrics(*metrics);
+        }
+        if (controlPort != 0 && history > 0) {
+            transmitter.setHistory((history * 1000 + packetTime - 1) / packetTime);
+        }
+        if (pacing != Transmitter::Pacing::Off) {
+            // The last period of a packet is captured one packet time after its timestamp.
+            const auto offset = pacingDelay + packetTime - periodTime;
+            const auto used = transmitter.setPacing(pacing, sampleRate, offset);
+            if (verbose || used != pacing) {
+                std::cout << "Pacing packets " << offset << "us after their timestamp "
+                          << (used == Transmitter::Pacing::User ? "in user space" : "with SO_TXTIME") << "\n";
+            }
         }
-        Transmitter transmitter(address.c_str(), port, pool);
-        Recorder recorder(deviceName, sampleRate, periodTime, channels, mode, transmitter, pool);
-        recorder.start();
 
-        pause();
+        // One recorder per device, each with its own timestamping, sharing the transmitter.
+        std::vector<std::unique_ptr<AudioDevice>> devices;
+        std::vector<std::unique_ptr<Recorder>> recorders;
+        std::vector<StreamFormat> formats;
+        std::vector<StreamAnnouncement> announcements;
+        unsigned int nextStreamId = streamId;
+        for (const auto& deviceName : deviceNames) {
+            std::vector<Recorder::Stream> streams;
+            for (unsigned int i = 0; i < streamsPerDevice; ++i) {
+                Recorder::Stream stream;
+                stream.id = static_cast<uint16_t>(nextStreamId++);
+                stream.firstChannel = i * split;
+                stream.channels = split;
+                streams.push_back(stream);
+                formats.push_back(StreamFormat{stream.id, sampleRate, periodTime, split, 0});
+                StreamAnnouncement announcement;
+                announcement.address = address;
+                announcement.port = port;
+                announcement.streamId = stream.id;
+                announcement.sampleRate = sampleRate;
+                announcement.periodTime = periodTime;
+                announcement.periodSize = periodSize;
+                announcement.channels = split;
+                announcement.packetTime = packetTime;
+                announcements.push_back(announcement);
+                if (verbose) {
+                    std::cout << "Stream " << stream.id << ": " << deviceName << " channels " << stream.firstChannel
+                              << "-" << stream.firstChannel + stream.channels - 1 << "\n";
+                }
+            }
+            devices.push_back(createAudioDevice(deviceName, AudioDevice::Direction::Capture, sampleRate, periodSize, periods, channels, drift));
+            recorders.emplace_back(new Recorder(*devices.back(), sampleRate, periodTime, channels, mode, streams, transmitter, pool,
+                periodsPerPacket));
+            recorders.back()->setThreadSettings(audioSettings);
+            if (metrics) {
+                recorders.back()->setMetrics(*metrics, "{index=\"" + std::to_string(devices.size() - 1)
+                    + "\",device=\"" + escape_label(deviceName) + "\"}");
+            }
+        }
+        for (auto& recorder : recorders) {
+            recorder->start();
+        }
+
+        ControlServer control(controlPort, formats, MembershipTimeout, transmitter);
+        if (controlPort != 0) {
+            control.start();
+            if (verbose) {
+                std::cout << "Accepting receivers on control port " << controlPort << "\n";
+            }
+        }
+
+        // Only streams sent to a multicast group can be found by announcement.
+        Announcer announcer(announcements, announceInterval,
+            primaryInterface.empty() ? socketSettings.interface : primaryInterface);
+        if (announceInterval > 0 && destinations.empty() && multicast
+            && boost::asio::ip::address::from_string(address).is_multicast()) {
+            announcer.start();
+            if (verbose) {
+                std::cout << "Announcing " << announcements.size() << " streams every " << announceInterval << "ms\n";
+            }
+        }
 
-        recorder.stop();
+        signal(SIGINT, signalHandler);
+        pause();
 
-        for (int i = 0; i < 5; ++i) {
-            auto packet = pool.pop();
-            delete packet;
+        announcer.stop();
+        control.stop();
+        for (auto& recorder : recorders) {
+            recorder->stop();
         }
+        recorders.clear();
     } catch (const std::exception& ex) {
         std::cerr << "Exception: " << ex.what() << "\n";
     }
+
+    if (!traceFile.empty()) {
+        try {
+            trace_dump(traceFile);
+            std::cout << "Trace written to " << traceFile << "\n";
+        } catch (const std::exception& ex) {
+            std::cerr << "Exception: " << ex.what() << "\n";
+        }
+    }
 }
@@ -0,0 +1,334 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Trace.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+
+using namespace boost::program_options;
+
+/** An event with its time converted to microseconds since the Unix epoch.
+ */
+struct Event {
+    double time;        /**< The wall-clock time in microseconds.   */
+    uint64_t id;        /**< The media timestamp.                   */
+    TracePoint point;   /**< The tracepoint.                        */
+};
+
+/** A thread of a trace file.
+ */
+struct Thread {
+    std::string name;               /**< The name of the thread.        */
+    int32_t tid;                    /**< The kernel ID of the thread.   */
+    std::vector<Event> events;      /**< The events, oldest first.      */
+};
+
+/** A trace file.
+ */
+struct Trace {
+    std::string program;            /**< The name of the traced program.    */
+    int32_t pid;                    /**< The ID of the traced process.      */
+    std::vector<Thread> threads;    /**< The threads.                       */
+};
+
+/** Returns a string without trailing zeros of a fixed size field.
+ */
+static std::string field(const char (&name)[16]) {
+    return std::string(name, strnlen(name, sizeof(name)));
+}
+
+/** Reads a trace file and converts the timestamps to wall-clock time. The
+ *  rate of trace_clock() is derived from the monotonic clock sampled at
+ *  the start and at the end of the trace.
+ */
+static Trace read_trace(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    TraceHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != TraceMagic) {
+        throw std::runtime_error(path + " is not a trace file");
+    }
+    if (header.version != TraceVersion) {
+        throw std::runtime_error(path + " has unsupported version " + std::to_string(header.version));
+    }
+
+    const double elapsed = static_cast<double>(header.monotonic1 - header.monotonic0);
+    const double ticks = static_cast<double>(header.tsc1 - header.tsc0);
+    const double nsPerTick = ticks > 0 && elapsed > 0 ? elapsed / ticks : 1.0;
+
+    Trace trace;
+    trace.program = field(header.name);
+    trace.pid = header.pid;
+    for (uint32_t i = 0; i < header.threads; ++i) {
+        TraceThread info;
+        if (!file.read(reinterpret_cast<char*>(&info), sizeof(info))) {
+            throw std::runtime_error(path + " is truncated");
+        }
+        Thread thread;
+        thread.name = field(info.name);
+        thread.tid = info.tid;
+        thread.events.reserve(static_cast<std::size_t>(info.events));
+        for (uint64_t n = 0; n < info.events; ++n) {
+            TraceEvent raw;
+            if (!file.read(reinterpret_cast<char*>(&raw), sizeof(raw))) {
+                throw std::runtime_error(path + " is truncated");
+            }
+            Event event;
+            const double offset = static_cast<double>(static_cast<int64_t>(raw.tsc - header.tsc0)) * nsPerTick;
+            event.time = (static_cast<double>(header.realtime0) + offset) * 0.001;
+            event.id = raw.id;
+            event.point = static_cast<TracePoint>(raw.point);
+            thread.events.push_back(event);
+        }
+        trace.threads.push_back(thread);
+    }
+    return trace;
+}
+
+/** Writes Chrome trace events. Every event but the first is preceded by a comma.
+ */
+class Writer {
+public:
+    explicit Writer(std::ostream& stream) : stream_(stream), first_(true) {
+        stream_.precision(15);
+    }
+
+    /** Writes the name of a process or a thread.
+     */
+    void metadata(const char* kind, int32_t pid, int32_t tid, const std::string& name) {
+        begin();
+        stream_ << "{\"ph\":\"M\",\"name\":\"" << kind << "\",\"pid\":" << pid << ",\"tid\":" << tid
+                << ",\"args\":{\"name\":\"" << escape(name) << "\"}}";
+    }
+
+    /** Writes a stage of a thread.
+     */
+    void complete(const char* name, int32_t pid, int32_t tid, double begin, double end, uint64_t id) {
+        this->begin();
+        stream_ << "{\"ph\":\"X\",\"cat\":\"stage\",\"name\":\"" << name << "\",\"pid\":" << pid << ",\"tid\":" << tid
+                << ",\"ts\":" << begin << ",\"dur\":" << end - begin << ",\"args\":{\"id\":" << id << "}}";
+    }
+
+    /** Writes a point in time of a thread.
+     */
+    void instant(const char* name, int32_t pid, int32_t tid, double time, uint64_t id) {
+        begin();
+        stream_ << "{\"ph\":\"i\",\"s\":\"t\",\"cat\":\"stage\",\"name\":\"" << name << "\",\"pid\":" << pid
+                << ",\"tid\":" << tid << ",\"ts\":" << time << ",\"args\":{\"id\":" << id << "}}";
+    }
+
+    /** Writes a span of a packet between two threads or processes.
+     */
+    void async(const char* name, int32_t pid, int32_t tid, double begin, double end, const std::string& id) {
+        this->begin();
+        stream_ << "{\"ph\":\"b\",\"cat\":\"packet\",\"name\":\"" << name << "\",\"id\":\"" << id
+                << "\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":" << begin << "},\n";
+        stream_ << "{\"ph\":\"e\",\"cat\":\"packet\",\"name\":\"" << name << "\",\"id\":\"" << id
+                << "\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":" << end << "}";
+    }
+
+private:
+    void begin() {
+        stream_ << (first_ ? "" : ",\n");
+        first_ = false;
+    }
+
+    static std::string escape(const std::string& text) {
+        std::string result;
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            if (static_cast<unsigned char>(c) >= 0x20) {
+                result += c;
+            }
+        }
+        return result;
+    }
+
+    std::ostream& stream_;  /**< The output.                        */
+    bool first_;            /**< True before the first event.       */
+};
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> inputs;
+    std::string output;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("output,o", value<std::string>(&output), "JSON file to write, stdout if omitted")
+        ("inputs", value<std::vector<std::string>>(&inputs), "trace files written by sender and receivers")
+        ("help,h", "produce help message");
+    positional_options_description positional;
+    positional.add("inputs", -1);
+
+    try {
+        variables_map vm;
+        store(command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+        notify(vm);
+        if (vm.count("help") || inputs.empty()) {
+            std::cout << "Usage: " << argv[0] << " [options] trace...\n" << desc << "\n";
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+
+    try {
+        std::vector<Trace> traces;
+        for (const auto& input : inputs) {
+            traces.push_back(read_trace(input));
+        }
+
+        std::ofstream file;
+        if (!output.empty()) {
+            file.open(output);
+            if (!file) {
+                throw std::runtime_error("Failed to open " + output);
+            }
+        }
+        std::ostream& stream = output.empty() ? std::cout : file;
+        stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        Writer writer(stream);
+
+        // Packets sent by any of the senders, matched with their arrival at every receiver.
+        std::map<uint64_t, double> sent;
+        for (const auto& trace : traces) {
+            for (const auto& thread : trace.threads) {
+                for (const auto& event : thread.events) {
+                    if (event.point == TracePoint::SendComplete) {
+                        sent[event.id] = event.time;
+                    }
+                }
+            }
+        }
+
+        for (const auto& trace : traces) {
+            writer.metadata("process_name", trace.pid, 0, trace.program + " (" + std::to_string(trace.pid) + ")");
+
+            // The network thread may be listed before the capture threads.
+            std::map<uint64_t, std::pair<int32_t, double>> queued;
+            for (const auto& thread : trace.threads) {
+                for (const auto& event : thread.events) {
+                    if (event.point == TracePoint::SendQueued) {
+                        queued[event.id] = std::make_pair(thread.tid, event.time);
+                    }
+                }
+            }
+
+            std::vector<std::pair<uint64_t, double>> reads;
+            std::vector<std::pair<uint64_t, double>> writes;
+            int32_t playbackTid = 0, receiveTid = 0;
+
+            for (const auto& thread : trace.threads) {
+                writer.metadata("thread_name", trace.pid, thread.tid, thread.name);
+                double capture = -1, receive = -1, playback = -1;
+                for (const auto& event : thread.events) {
+                    switch (event.point) {
+                    case TracePoint::CaptureBegin:
+                        capture = event.time;
+                        break;
+                    case TracePoint::CaptureEnd:
+                        if (capture >= 0) {
+                            writer.complete("capture", trace.pid, thread.tid, capture, event.time, event.id);
+                        }
+                        capture = -1;
+                        break;
+                    case TracePoint::SendQueued:
+                        break;
+                    case TracePoint::SendComplete: {
+                        const auto it = queued.find(event.id);
+                        if (it != queued.end()) {
+                            writer.async("transmit", trace.pid, it->second.first, it->second.second, event.time,
+                                "tx-" + std::to_string(trace.pid) + "-" + std::to_string(event.id));
+                            queued.erase(it);
+                        }
+                        break;
+                    }
+                    case TracePoint::ReceiveBegin: {
+                        receive = event.time;
+                        receiveTid = thread.tid;
+                        // The completion handler of the sender may run after the packet
+                        // has arrived on a loaded host, the span is empty then.
+                        const auto it = sent.find(event.id);
+                        if (it != sent.end()) {
+                            writer.async("network", trace.pid, thread.tid, std::min(it->second, event.time), event.time,
+                                "net-" + std::to_string(trace.pid) + "-" + std::to_string(event.id));
+                        }
+                        break;
+                    }
+                    case TracePoint::ReceiveEnd:
+                        if (receive >= 0) {
+                            writer.complete("receive", trace.pid, thread.tid, receive, event.time, event.id);
+                            writes.push_back(std::make_pair(event.id, event.time));
+                        }
+                        receive = -1;
+                        break;
+                    case TracePoint::PlaybackBegin:
+                        playback = event.time;
+                        break;
+                    case TracePoint::PlaybackRead:
+                        playbackTid = thread.tid;
+                        reads.push_back(std::make_pair(event.id, event.time));
+                        break;
+                    case TracePoint::PlaybackEnd:
+                        if (playback >= 0) {
+                            writer.complete("playback", trace.pid, thread.tid, playback, event.time, event.id);
+                        }
+                        playback = -1;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+
+            // The residency of a packet in the circular buffer ends with the
+            // first read of a period that contains its first frame. Packets
+            // written after that read arrived too late to be played.
+            if (reads.size() > 1 && !writes.empty()) {
+                // The period size is the most frequent distance of consecutive reads.
+                std::map<uint64_t, std::size_t> distances;
+                for (std::size_t i = 1; i < reads.size(); ++i) {
+                    distances[reads[i].first - reads[i - 1].first] += 1;
+                }
+                const uint64_t period = std::max_element(distances.begin(), distances.end(),
+                    [] (const std::pair<const uint64_t, std::size_t>& a, const std::pair<const uint64_t, std::size_t>& b) {
+                        return a.second < b.second;
+                    })->first;
+                std::sort(reads.begin(), reads.end());
+                for (const auto& write : writes) {
+                    const auto it = std::upper_bound(reads.begin(), reads.end(),
+                        std::make_pair(write.first >= period ? write.first - period : 0, 1e300));
+                    if (it == reads.end() || it->first > write.first) {
+                        continue;
+                    }
+                    if (it->second >= write.second) {
+                        writer.async("buffer", trace.pid, receiveTid ? receiveTid : playbackTid, write.second, it->second,
+                            "buf-" + std::to_string(trace.pid) + "-" + std::to_string(write.first));
+                    } else {
+                        writer.instant("late", trace.pid, receiveTid, write.second, write.first);
+                    }
+                }
+            }
+        }
+        stream << "\n]}\n";
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << "\n";
+        return -1;
+    }
+    return 0;
+}
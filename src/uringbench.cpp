@@ -0,0 +1,289 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Transmitter.h"
+#include "PacketPool.h"
+#include "Packet.h"
+#include "Uring.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace boost::program_options;
+
+static const unsigned int DefaultDuration = 5;      // seconds per measurement
+static const unsigned int DefaultSize = 192;        // payload bytes, 1 ms of 48 kHz stereo
+static const unsigned int DefaultDestinations = 1;
+static const unsigned int PoolSize = 256;           // packets in flight in the transmitter
+static const unsigned int BurstSize = 64;           // datagrams per sendmmsg() of the load generator
+static const unsigned int UringEntries = 8;
+static const unsigned int UringBuffers = 64;
+static const int SinkBufferSize = 4096;             // bytes, keeps the sinks dropping cheaply
+
+/** The result of a measurement.
+ */
+struct Result {
+    uint64_t packets;   /**< The number of packets sent or received.           */
+    double cpu;         /**< The CPU time of the measured path in seconds.     */
+    double elapsed;     /**< The wall-clock time in seconds.                   */
+};
+
+/** Returns the value of a clock in seconds.
+ */
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 0.000000001;
+}
+
+/** Creates a UDP socket bound to an ephemeral loopback port.
+ *
+ *  \param port set to the bound port.
+ */
+static int bindLoopback(unsigned short& port) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0) {
+        throw std::runtime_error(std::string("Failed to bind socket: ") + strerror(errno));
+    }
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/** Measures the Transmitter sending packets as fast as the pool allows. The
+ *  CPU time is that of the whole process, i.e. the producer and the network thread.
+ */
+static Result measureSend(const std::vector<boost::asio::ip::udp::endpoint>& endpoints, unsigned int size,
+    unsigned int duration, bool uring) {
+    PacketPool pool;
+    std::vector<std::unique_ptr<Packet>> packets;
+    for (unsigned int i = 0; i < PoolSize; ++i) {
+        packets.emplace_back(new Packet(size));
+        pool.push(packets.back().get());
+    }
+
+    Result result = { 0, 0, 0 };
+    {
+        Transmitter transmitter(endpoints, pool);
+        const auto queue = transmitter.addQueue();
+        if (uring && !transmitter.setIoUring()) {
+            return result;
+        }
+        const double cpu = seconds(CLOCK_PROCESS_CPUTIME_ID);
+        const double start = seconds(CLOCK_MONOTONIC);
+        while (seconds(CLOCK_MONOTONIC) - start < duration) {
+            Packet* packet = pool.pop();
+            if (packet) {
+                packet->setTimestamp(result.packets);
+                if (!transmitter.send(packet, queue)) {
+                    pool.push(packet);
+                    sched_yield();
+                } else {
+                    result.packets += 1;
+                }
+            } else {
+                sched_yield();
+            }
+        }
+        result.cpu = seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+        result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    }
+    return result;
+}
+
+/** Receives with recv() like the Receiver until the socket is shut down.
+ */
+static uint64_t receiveRecv(int fd, Packet& packet) {
+    uint64_t count = 0;
+    while (recv(fd, packet.packet_, packet.packetSize_, 0) > 0) {
+        count += 1;
+    }
+    return count;
+}
+
+/** Receives with a multishot receive into provided buffers like the Receiver
+ *  until the ring is interrupted.
+ */
+static uint64_t receiveUring(int fd, Uring& uring) {
+    uint64_t count = 0;
+    bool armed = false, running = true;
+    while (running) {
+        if (!armed) {
+            auto entry = uring.entry();
+            entry->opcode = IORING_OP_RECV;
+            entry->fd = fd;
+            entry->ioprio = IORING_RECV_MULTISHOT;
+            entry->flags = IOSQE_BUFFER_SELECT;
+            entry->buf_group = 0;
+            armed = true;
+        }
+        const int result = uring.submit(1);
+        if (result < 0 && result != -EINTR) {
+            break;
+        }
+        uring.complete([&] (const struct io_uring_cqe& cqe) {
+            if (cqe.user_data == Uring::Interrupted) {
+                running = false;
+                return;
+            }
+            if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                armed = false;
+            }
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uring.provide(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            if (cqe.res > 0) {
+                count += 1;
+            } else if (cqe.res != -ENOBUFS) {
+                running = false;
+            }
+        });
+    }
+    return count;
+}
+
+/** Measures the receive paths against a load generator sending bursts with
+ *  sendmmsg(). The CPU time is that of the receiving thread only.
+ */
+static Result measureReceive(unsigned int size, unsigned int duration, bool uring) {
+    unsigned short port = 0;
+    const int fd = bindLoopback(port);
+    Packet packet(size);
+    std::vector<std::unique_ptr<Packet>> slab;
+    std::unique_ptr<Uring> ring;
+    if (uring) {
+        ring.reset(new Uring(UringEntries));
+        std::vector<uint8_t*> buffers;
+        for (unsigned int i = 0; i < UringBuffers; ++i) {
+            slab.emplace_back(new Packet(size));
+            buffers.push_back(slab.back()->packet_);
+        }
+        ring->registerBuffers(0, buffers, packet.packetSize_);
+    }
+
+    Result result = { 0, 0, 0 };
+    double cpu = 0;
+    std::thread receiver([&] () {
+        const double begin = seconds(CLOCK_THREAD_CPUTIME_ID);
+        result.packets = uring ? receiveUring(fd, *ring) : receiveRecv(fd, packet);
+        cpu = seconds(CLOCK_THREAD_CPUTIME_ID) - begin;
+    });
+
+    const int out = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    struct iovec payload;
+    payload.iov_base = packet.packet_;
+    payload.iov_len = packet.packetSize_;
+    std::vector<struct mmsghdr> messages(BurstSize);
+    for (auto& message : messages) {
+        memset(&message, 0, sizeof(message));
+        message.msg_hdr.msg_name = &addr;
+        message.msg_hdr.msg_namelen = sizeof(addr);
+        message.msg_hdr.msg_iov = &payload;
+        message.msg_hdr.msg_iovlen = 1;
+    }
+    const double start = seconds(CLOCK_MONOTONIC);
+    while (seconds(CLOCK_MONOTONIC) - start < duration) {
+        if (sendmmsg(out, messages.data(), BurstSize, 0) < 0) {
+            break;
+        }
+        // Lets the receiver run on a single CPU.
+        sched_yield();
+    }
+    shutdown(fd, SHUT_RDWR);
+    if (ring) {
+        ring->interrupt();
+    }
+    receiver.join();
+    result.cpu = cpu;
+    result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    close(out);
+    close(fd);
+    return result;
+}
+
+/** Prints a result.
+ */
+static void print(const char* direction, const char* path, const Result& result) {
+    const double perPacket = result.packets > 0 ? result.cpu * 1000000.0 / static_cast<double>(result.packets) : 0;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(10) << direction << std::setw(10) << path
+              << std::setw(14) << static_cast<double>(result.packets) / result.elapsed
+              << std::setw(10) << result.cpu * 100.0 / result.elapsed << std::setw(14) << perPacket << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int duration = DefaultDuration;
+    unsigned int size = DefaultSize;
+    unsigned int destinations = DefaultDestinations;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("duration", value<unsigned int>(&duration)->default_value(DefaultDuration), "measurement time per path in seconds")
+        ("size", value<unsigned int>(&size)->default_value(DefaultSize), "payload size in bytes")
+        ("destinations", value<unsigned int>(&destinations)->default_value(DefaultDestinations), "number of unicast destinations when sending")
+        ("help,h", "produce help message");
+
+    try {
+        variables_map vm;
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+
+    try {
+        // The destinations are local sockets that are never read, the kernel
+        // drops the packets once their small receive buffers are full.
+        std::vector<int> sinks;
+        std::vector<boost::asio::ip::udp::endpoint> endpoints;
+        for (unsigned int i = 0; i < destinations; ++i) {
+            unsigned short port = 0;
+            sinks.push_back(bindLoopback(port));
+            setsockopt(sinks.back(), SOL_SOCKET, SO_RCVBUF, &SinkBufferSize, sizeof(SinkBufferSize));
+            endpoints.push_back(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+        }
+
+        std::cout << std::setw(10) << "direction" << std::setw(10) << "path" << std::setw(14) << "packets/s"
+                  << std::setw(10) << "cpu %" << std::setw(14) << "us/packet" << "\n";
+        print("send", "sendmmsg", measureSend(endpoints, size, duration, false));
+        print("send", "io_uring", measureSend(endpoints, size, duration, true));
+        print("receive", "recv", measureReceive(size, duration, false));
+        print("receive", "io_uring", measureReceive(size, duration, true));
+
+        for (const auto fd : sinks) {
+            close(fd);
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << "\n";
+        return -1;
+    }
+    return 0;
+}
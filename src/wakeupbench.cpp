@@ -0,0 +1,205 @@
+// © 2017 Jan Deinhard.
+// Distributed under the BSD license.
+
+#include "Realtime.h"
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace boost::program_options;
+
+static const unsigned int DefaultDuration = 5;      // seconds per measurement
+static const unsigned int DefaultPeriodTime = 1000; // us between packets
+static const unsigned int DefaultSize = 216;        // bytes, a 1 ms packet of 48 kHz stereo
+static const int DefaultBusyPoll = 50;              // us
+static const int DefaultCpu = -1;                   // no CPU affinity
+static const int ReceiveBuffer = 16 * 2048;         // bytes of the low-latency profile
+
+/** The result of a measurement.
+ */
+struct Result {
+    std::vector<double> latencies;  /**< The wakeup latencies in seconds.               */
+    double cpu;                     /**< The CPU time of the receiving thread in seconds. */
+    double elapsed;                 /**< The wall-clock time in seconds.                */
+};
+
+/** Returns the value of a clock in seconds.
+ */
+static double seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 0.000000001;
+}
+
+/** Receives datagrams until the socket is shut down or running is cleared
+ *  and records the time from their kernel timestamp to their reception.
+ */
+static void receive(int fd, bool spin, const std::atomic<bool>& running, Result& result) {
+    const double begin = seconds(CLOCK_THREAD_CPUTIME_ID);
+    uint8_t buffer[65536];
+    union {
+        struct cmsghdr header;
+        uint8_t data[CMSG_SPACE(sizeof(struct timespec))];
+    } control;
+    while (running) {
+        struct iovec iov;
+        iov.iov_base = buffer;
+        iov.iov_len = sizeof(buffer);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+        const auto n = recvmsg(fd, &msg, spin ? MSG_DONTWAIT : 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            break;
+        } else if (n < 0) {
+            continue;
+        }
+        const double now = seconds(CLOCK_REALTIME);
+        const auto cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            result.latencies.push_back(now - static_cast<double>(ts.tv_sec) - ts.tv_nsec * 0.000000001);
+        }
+    }
+    result.cpu = seconds(CLOCK_THREAD_CPUTIME_ID) - begin;
+}
+
+/** Sends one datagram per period to a local socket and measures the wakeup
+ *  latency of the receiving thread.
+ *
+ *  \param socketSettings the settings of the receiving socket.
+ *  \param threadSettings the settings of the receiving thread.
+ */
+static Result measure(unsigned int duration, unsigned int periodTime, unsigned int size,
+    const SocketSettings& socketSettings, const ThreadSettings& threadSettings) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    const int enable = 1;
+    if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0
+        || setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) != 0) {
+        throw std::runtime_error(std::string("Failed to bind socket: ") + strerror(errno));
+    }
+    applySocketSettings("receive", fd, socketSettings);
+
+    Result result;
+    result.cpu = 0;
+    std::atomic<bool> running(true);
+    std::thread receiver([&] () {
+        applyThreadSettings("receive", threadSettings);
+        receive(fd, socketSettings.busyPoll > 0, running, result);
+    });
+
+    const int out = socket(AF_INET, SOCK_DGRAM, 0);
+    std::vector<uint8_t> payload(size, 0);
+    const double start = seconds(CLOCK_MONOTONIC);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    const uint64_t packets = static_cast<uint64_t>(duration) * 1000000 / periodTime;
+    for (uint64_t i = 0; i < packets; ++i) {
+        sendto(out, payload.data(), payload.size(), 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        next.tv_nsec += static_cast<long>(periodTime) * 1000;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec += 1;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    }
+    running = false;
+    shutdown(fd, SHUT_RDWR);
+    receiver.join();
+    result.elapsed = seconds(CLOCK_MONOTONIC) - start;
+    close(out);
+    close(fd);
+    return result;
+}
+
+/** Prints the distribution of the wakeup latencies.
+ */
+static void print(const char* profile, Result& result) {
+    auto& latencies = result.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies] (double p) {
+        if (latencies.empty()) {
+            return 0.0;
+        }
+        const auto index = static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1));
+        return latencies[index] * 1000000.0;
+    };
+    std::cout << std::fixed << std::setprecision(1)
+              << std::setw(12) << profile << std::setw(10) << latencies.size()
+              << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99)
+              << std::setw(10) << percentile(0.999) << std::setw(10) << percentile(1.0)
+              << std::setw(10) << result.cpu * 100.0 / result.elapsed << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int duration = DefaultDuration;
+    unsigned int periodTime = DefaultPeriodTime;
+    unsigned int size = DefaultSize;
+    SocketSettings lowLatency;
+    ThreadSettings pinned;
+
+    options_description desc("Options");
+    desc.add_options()
+        ("duration", value<unsigned int>(&duration)->default_value(DefaultDuration), "measurement time per profile in seconds")
+        ("periodtime,t", value<unsigned int>(&periodTime)->default_value(DefaultPeriodTime), "time between packets in microseconds")
+        ("size", value<unsigned int>(&size)->default_value(DefaultSize), "datagram size in bytes")
+        ("busy-poll", value<int>(&lowLatency.busyPoll)->default_value(DefaultBusyPoll), "busy poll time of the low-latency profile in microseconds")
+        ("cpu", value<int>(&pinned.cpu)->default_value(DefaultCpu), "CPU the receive thread of the low-latency profile is pinned to, -1 for any CPU")
+        ("priority", value<int>(&pinned.priority)->default_value(0), "SCHED_FIFO priority of the receive thread of the low-latency profile")
+        ("help,h", "produce help message");
+
+    try {
+        variables_map vm;
+        store(parse_command_line(argc, argv, desc), vm);
+        notify(vm);
+        if (vm.count("help")) {
+            std::cout << desc << "\n";
+            return 1;
+        }
+        if (periodTime == 0) {
+            throw std::runtime_error("periodtime must be positive");
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        std::cout << desc << "\n";
+        return -1;
+    }
+    lowLatency.receiveBuffer = ReceiveBuffer;
+
+    try {
+        auto standard = measure(duration, periodTime, size, SocketSettings(), ThreadSettings());
+        auto tuned = measure(duration, periodTime, size, lowLatency, pinned);
+        std::cout << "Wakeup latency in us\n"
+                  << std::setw(12) << "profile" << std::setw(10) << "packets" << std::setw(10) << "p50"
+                  << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max"
+                  << std::setw(10) << "cpu %" << "\n";
+        print("default", standard);
+        print("low-latency", tuned);
+    } catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << "\n";
+        return -1;
+    }
+    return 0;
+}